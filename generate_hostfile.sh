@@ -3,16 +3,42 @@
 # Get system
 unameOut="$(uname -s)"
 case "${unameOut}" in
-    Linux*)     NUM_CORES=$(sysctl -n hw.ncpu)  # For macO
-    Darwin*)    NUM_CORES=$(nproc)
-    *)          machine="UNKNOWN:${unameOut}"
+    Linux*)
+        # Physical cores, not hardware threads: SMT siblings share a core id within their socket
+        NUM_CORES=$(lscpu -p=CORE,SOCKET 2>/dev/null | grep -v '^#' | sort -u | wc -l)
+        NUM_SOCKETS=$(lscpu -p=SOCKET 2>/dev/null | grep -v '^#' | sort -u | wc -l)
+        ;;
+    Darwin*)
+        NUM_CORES=$(sysctl -n hw.physicalcpu)
+        NUM_SOCKETS=$(sysctl -n hw.packages 2>/dev/null)
+        ;;
+    *)
+        machine="UNKNOWN:${unameOut}"
+        NUM_CORES=1
+        ;;
 esac
+if [ -z "$NUM_CORES" ] || [ "$NUM_CORES" -lt 1 ]; then
+    NUM_CORES=$(nproc 2>/dev/null || echo 1)
+fi
+if [ -z "$NUM_SOCKETS" ] || [ "$NUM_SOCKETS" -lt 1 ]; then
+    NUM_SOCKETS=1
+fi
+CORES_PER_SOCKET=$((NUM_CORES / NUM_SOCKETS))
 
 # Create or overwrite hostfile
 echo "# Auto-generated hostfile" > hostfile.txt
 echo "localhost slots=$NUM_CORES max_slots=$NUM_CORES" >> hostfile.txt
 
-# Optional: Add CPU binding
-echo "# CPU binding configuration" >> hostfile.txt
-CPU_LIST=$(seq -s ',' 0 $((NUM_CORES-1)))
-echo "localhost slots=$NUM_CORES max_slots=$NUM_CORES cpu_ids=$CPU_LIST" >> hostfile.txt
+# Hybrid runs: one rank per socket, bound to that socket's cores so its memory and OpenMP threads
+# stay on one NUMA node. Open MPI rankfile lines are rank N=host slot=socket:cores
+echo "# Auto-generated rankfile, one rank per socket" > rankfile.txt
+for ((socket = 0; socket < NUM_SOCKETS; socket++)); do
+    echo "rank $socket=localhost slot=$socket:0-$((CORES_PER_SOCKET - 1))" >> rankfile.txt
+done
+
+echo "MPI runs, one rank per core:"
+echo "  mpirun --hostfile hostfile.txt -np $NUM_CORES --map-by core --bind-to core run_tests -m"
+echo "Hybrid runs, one rank per socket with its threads pinned inside it:"
+echo "  OMP_PLACES=cores OMP_PROC_BIND=close mpirun --hostfile hostfile.txt -np $NUM_SOCKETS \\"
+echo "    --map-by ppr:1:package:PE=$CORES_PER_SOCKET --bind-to core -x OMP_PLACES -x OMP_PROC_BIND run_tests -H -r $NUM_SOCKETS -N close"
+echo "  or: mpirun -np $NUM_SOCKETS --rankfile rankfile.txt run_tests -H -r $NUM_SOCKETS -N close"
@@ -0,0 +1,38 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <stddef.h>
+
+// Where bind_openmp_threads pins the threads of a team, within the CPUs the process may run on
+typedef enum {
+    BIND_NONE,  // Leave threads to the OS, or to OMP_PLACES and OMP_PROC_BIND when those are set
+    BIND_CLOSE,  // Thread t on the t-th CPU, filling one NUMA node before the next
+    BIND_SPREAD,  // Threads dealt round-robin over NUMA nodes, so every memory controller is used
+} ThreadBinding;
+
+// Pages of a range counted by the NUMA node they lie on
+typedef struct {
+    size_t local_pages;  // On the node expected to use them
+    size_t remote_pages;  // On another node
+    size_t unplaced_pages;  // Not touched yet, or the kernel cannot tell
+} PagePlacement;
+
+// Function prototypes
+void set_thread_binding(ThreadBinding binding);
+ThreadBinding get_thread_binding(void);
+const char* get_thread_binding_name(ThreadBinding binding);
+
+// Function to pin each thread of a team of omp_get_max_threads() to one CPU with the selected binding.
+// New threads start on the CPU of the thread that creates them, so call it again after changing the
+// thread count. Returns the number of threads pinned, 0 if binding is off or OMP_PLACES or
+// OMP_PROC_BIND already has the runtime place threads, and -1 if a thread could not be pinned.
+int bind_openmp_threads(void);
+
+// NUMA nodes with CPUs, 1 where the kernel has no NUMA support, and the node of the calling thread's CPU
+int get_numa_node_count(void);
+int get_current_numa_node(void);
+
+// Function to add the pages of data[0, bytes) to placement, as local if they lie on node
+void count_page_placement(const void* data, size_t bytes, int node, PagePlacement* placement);
+
+#endif // AFFINITY_H
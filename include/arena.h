@@ -0,0 +1,41 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator over one lazily mapped region. Threads of a parallel region carve slabs of it for
+// themselves and allocate from those without synchronising, and every page is first touched, and so
+// placed on a NUMA node, by whichever thread writes it first. Nothing is freed on its own: the arena
+// is released back to a mark or reset in bulk, keeping its pages mapped for the next use.
+typedef struct Arena Arena;
+
+// Function prototypes
+// Reserves capacity bytes of address space, returns NULL if the mapping fails
+Arena* create_arena(size_t capacity);
+void free_arena(Arena* arena);
+
+// Function to carve bytes aligned to a cache line, returns NULL once the arena is full.
+// Safe to call from the threads of one parallel region at once.
+void* arena_alloc(Arena* arena, size_t bytes);
+
+// Function to release everything allocated after mark, while no thread allocates from the arena
+size_t arena_mark(const Arena* arena);
+void arena_release(Arena* arena, size_t mark);
+void arena_reset(Arena* arena);
+
+size_t arena_capacity(const Arena* arena);
+size_t arena_peak(const Arena* arena);  // Most bytes in use at once, including the unused ends of slabs
+
+// Function to have matrix storage and kernel workspaces carved from arena, NULL restores the heap.
+// Whatever is allocated while an arena is set must be done with before the arena is released.
+void set_matrix_arena(Arena* arena);
+Arena* get_matrix_arena(void);
+
+// Allocation of matrix arrays and workspaces: from the matrix arena while one is set and has room,
+// otherwise from the heap, aligned to a cache line either way. matrix_free only frees heap blocks,
+// arena blocks go when their arena is released. fallbacks counts arena requests the heap served.
+void* matrix_alloc(size_t bytes);
+void matrix_free(void* ptr);
+size_t get_arena_fallbacks(void);
+
+#endif // ARENA_H
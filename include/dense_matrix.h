@@ -0,0 +1,29 @@
+#ifndef DENSE_MATRIX_H
+#define DENSE_MATRIX_H
+
+#include <stddef.h>
+
+#define DENSE_ALIGNMENT 64
+
+// Dense matrix in a single aligned buffer, row i starts at data + i * stride
+typedef struct {
+    int* data;
+    size_t rows;
+    size_t cols;
+    size_t stride;  // Elements per row including padding, a multiple of DENSE_ALIGNMENT bytes
+    size_t bytes;  // Size of the buffer
+    int mapped;  // Buffer comes from mmap (huge page backed) rather than the heap
+} DenseMatrix;
+
+#define DENSE_ROW(m, i) ((m)->data + (size_t)(i) * (m)->stride)
+
+// Function prototypes
+// Allocates the buffer with one call; zero clears it with the threads that will later use each row
+DenseMatrix* allocate_dense_matrix(size_t rows, size_t cols, int zero);
+void free_dense_matrix(DenseMatrix* matrix);
+void print_dense_matrix(const DenseMatrix* matrix);
+
+// Function to back large dense buffers with transparent huge pages
+void set_dense_huge_pages(int enabled);
+
+#endif // DENSE_MATRIX_H
\ No newline at end of file
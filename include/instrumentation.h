@@ -0,0 +1,43 @@
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Quantities accumulated alongside region times
+typedef enum {
+    PROFILE_NNZ,  // Stored elements of A fed to a multiplication
+    PROFILE_MULTIPLY_ADDS,
+    PROFILE_BYTES_SENT,
+    PROFILE_BYTES_RECEIVED,
+    PROFILE_COUNTER_COUNT
+} ProfileCounter;
+
+// Regions are named by string literals and may nest; every thread times its own regions.
+// Without ENABLE_PROFILING the macros compile to nothing and their arguments are never evaluated.
+#ifdef ENABLE_PROFILING
+
+#define PROFILE_BEGIN(name) do { \
+    static int profile_region_id = -1; \
+    profile_begin(&profile_region_id, name); \
+} while (0)
+#define PROFILE_END(name) profile_end(name)
+#define PROFILE_COUNT(counter, amount) profile_count(counter, (uint64_t)(amount))
+
+void profile_begin(int* region_id, const char* name);
+void profile_end(const char* name);
+void profile_count(ProfileCounter counter, uint64_t amount);
+
+#else
+
+#define PROFILE_BEGIN(name) ((void)0)
+#define PROFILE_END(name) ((void)0)
+#define PROFILE_COUNT(counter, amount) ((void)0)
+
+#endif // ENABLE_PROFILING
+
+// Function to print the regions and counters of every rank. Collective over MPI_COMM_WORLD while MPI
+// is active, otherwise covers this process alone. Without an explicit call the report is printed at exit.
+void profile_report(FILE* out);
+
+#endif // INSTRUMENTATION_H
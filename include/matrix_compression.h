@@ -2,17 +2,49 @@
 #define MATRIX_COMPRESSION_H
 
 #include <stddef.h>
+#include "dense_matrix.h"
 
+// Row compression stored as CSR: row i occupies [row_ptr[i], row_ptr[i + 1])
+// of the contiguous values (B) and col_idx (C) arrays.
 typedef struct {
-    int** B;  // Matrix B storing non-zero elements
-    int** C;  // Matrix C storing column indices
-    size_t* row_sizes;  // Actual number of elements in each row
+    int* values;  // Non-zero elements of every row, back to back
+    int* col_idx;  // Column index of each stored element
+    size_t* row_ptr;  // Offset of each row's first element, num_rows + 1 entries
     size_t num_rows;
     size_t num_cols;
+    size_t nnz;  // Total stored elements, equal to row_ptr[num_rows]
+    void* mapping;  // File mapping backing the arrays, NULL when they are heap allocated
+    size_t mapping_size;
 } CompressedMatrix;
 
+// Rows without non-zero elements store two consecutive 0s
+#define EMPTY_ROW_SIZE 2
+
+// Number of stored elements in row i
+#define ROW_SIZE(m, i) ((m)->row_ptr[(i) + 1] - (m)->row_ptr[(i)])
+
+// Whether row i holds only the two 0s of an empty row; no row with elements stores column 0 twice
+#define IS_EMPTY_ROW(m, i) (ROW_SIZE(m, i) == EMPTY_ROW_SIZE \
+    && (m)->col_idx[(m)->row_ptr[i]] == 0 && (m)->col_idx[(m)->row_ptr[i] + 1] == 0 \
+    && (m)->values[(m)->row_ptr[i]] == 0 && (m)->values[(m)->row_ptr[i] + 1] == 0)
+
+// Writes the two 0s of an empty row into its slices of values and col_idx
+static inline void store_empty_row(int* values, int* cols) {
+    for (size_t k = 0; k < EMPTY_ROW_SIZE; k++) {
+        values[k] = 0;
+        cols[k] = 0;
+    }
+}
+
 // Function prototypes
-CompressedMatrix* compress_matrix(int** matrix, size_t rows, size_t cols, float density);
+// Allocates the struct and row_ptr; storage is allocated once nnz is known
+CompressedMatrix* allocate_compressed_matrix(size_t rows, size_t cols);
+int allocate_compressed_storage(CompressedMatrix* compressed, size_t nnz);
+
+// Turns row sizes stored in row_ptr[1..rows] into offsets, returns nnz
+size_t scan_row_sizes(size_t* row_ptr, size_t rows);
+
+CompressedMatrix* compress_matrix(const DenseMatrix* matrix);
 void free_compressed_matrix(CompressedMatrix* compressed);
 void print_compressed_matrix(const CompressedMatrix* compressed);
 
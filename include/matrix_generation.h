@@ -1,14 +1,37 @@
 #ifndef MATRIX_GENERATION_H
 #define MATRIX_GENERATION_H
 
+#include "matrix_compression.h"
+#include "dense_matrix.h"
+
 #define ROWS 100000
 #define COLS 100000
 
+// Where the non-zeros of a generated matrix fall
+typedef enum {
+    PATTERN_UNIFORM,  // Every entry independently
+    PATTERN_BANDED,  // A solid band of density * cols columns around the diagonal
+    PATTERN_BLOCK_DIAGONAL,  // Half-full square blocks along the diagonal, zeros elsewhere
+    PATTERN_POWER_LAW,  // R-MAT: row and column counts follow a power law, heaviest at low indices
+    PATTERN_SKEWED,  // Uniform columns, Pareto distributed row lengths scattered over the rows
+    PATTERN_COUNT
+} SparsityPattern;
+
 // Function prototypes
-int** allocateMatrix(int rows, int cols);
-void initialiseMatrix(int** matrix, int rows, int cols, float sparsity);
-void freeMatrix(int** matrix, int rows);
-void printMatrix(int** matrix, int rows, int cols);
-int setCellValue(float sparsity);
+// Every generator draws from counter-based streams keyed by seed and row, so its result depends only
+// on seed, never on the number of threads or ranks.
+DenseMatrix* allocateMatrix(size_t rows, size_t cols);
+void initialiseMatrix(DenseMatrix* matrix, float sparsity, unsigned long long seed);  // Same entries as generateSparseMatrix
+void freeMatrix(DenseMatrix* matrix);
+void printMatrix(const DenseMatrix* matrix);
+int setCellValue(float sparsity, unsigned long long seed, size_t row, size_t col);  // One cell, drawn independently
+
+// Generates the compressed form directly, each entry non-zero with probability density
+CompressedMatrix* generateSparseMatrix(size_t rows, size_t cols, float density, unsigned long long seed);
+// Generates pattern with about density * rows * cols elements. Skewed rows are cut at cols and R-MAT
+// merges repeated draws, so both fall short at higher densities, R-MAT already by about a quarter at 0.01.
+CompressedMatrix* generatePatternMatrix(size_t rows, size_t cols, float density, SparsityPattern pattern, unsigned long long seed);
+const char* getPatternName(SparsityPattern pattern);
+int parsePattern(const char* name, SparsityPattern* pattern);
 
 #endif // MATRIX_GENERATION_H
\ No newline at end of file
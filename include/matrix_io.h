@@ -0,0 +1,46 @@
+#ifndef MATRIX_IO_H
+#define MATRIX_IO_H
+
+#include "matrix_compression.h"
+#include <stdint.h>
+
+#define COMPRESSED_FILE_MAGIC "CSRMAT\0"
+#define COMPRESSED_FILE_VERSION 1
+#define COMPRESSED_FILE_ALIGNMENT 64
+
+// Header of the binary compressed format. The row_ptr, col_idx and values arrays follow
+// at the given byte offsets, each aligned to COMPRESSED_FILE_ALIGNMENT so they can be mapped in place.
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;  // 0x01020304 as written by the producing machine
+    uint32_t offset_size;  // sizeof(size_t) of row_ptr entries
+    uint32_t index_size;  // sizeof(int) of col_idx entries
+    uint32_t value_size;  // sizeof(int) of values entries
+    uint32_t reserved;
+    uint64_t num_rows;
+    uint64_t num_cols;
+    uint64_t nnz;
+    uint64_t row_ptr_offset;
+    uint64_t col_idx_offset;
+    uint64_t values_offset;
+} CompressedFileHeader;
+
+// Function prototypes
+int write_compressed_matrix_binary(const CompressedMatrix* compressed, const char* path);
+// Fills in the header of a matrix with these dimensions, laying the arrays out one after another.
+// Only values_offset depends on nnz.
+void build_compressed_file_header(size_t rows, size_t cols, size_t nnz, CompressedFileHeader* header);
+int read_compressed_file_header(const char* path, CompressedFileHeader* header);
+
+// Maps a binary compressed file and returns a view of it without copying;
+// free_compressed_matrix unmaps it
+CompressedMatrix* map_compressed_matrix(const char* path);
+
+// Matrix Market coordinate files. Reading splits the body into byte ranges parsed by
+// separate threads; real values are rounded to int, symmetric storage is expanded, duplicate
+// entries are summed and entries that are or sum to zero are dropped.
+CompressedMatrix* read_matrix_market(const char* path);
+int write_matrix_market(const CompressedMatrix* compressed, const char* path);
+
+#endif // MATRIX_IO_H
\ No newline at end of file
@@ -2,31 +2,128 @@
 #define MATRIX_MULTIPLICATION_H
 
 #include "matrix_compression.h"
+#include "dense_matrix.h"
+#include "affinity.h"
+#include <mpi.h>
 #include <stddef.h>
 
 typedef enum {
     MULT_SEQUENTIAL,
     MULT_OMP,
     MULT_MPI,
+    MULT_HYBRID,  // MPI row blocks, each multiplied with OpenMP inside its rank
 } parallelisation_type;
 
-typedef struct {
-    int** data;
-    size_t rows;
-    size_t cols;
-} DenseMatrix;
+// How OpenMP hands out rows of A to threads
+typedef enum {
+    SCHEDULE_STATIC,
+    SCHEDULE_DYNAMIC,
+    SCHEDULE_GUIDED,
+    SCHEDULE_AUTO,
+    SCHEDULE_BALANCED,  // One contiguous row range per thread holding an equal share of the estimated multiply-adds
+    SCHEDULE_WORK_STEALING,  // Balanced ranges split into blocks of chunk rows that idle threads steal
+} ScheduleType;
+
+// How rows of a compressed product are accumulated
+typedef enum {
+    KERNEL_MARKER,  // Each output column remembers its slot in the row, columns in first-touch order
+    KERNEL_GUSTAVSON,  // Dense accumulator plus list of touched columns, which can be sorted
+    KERNEL_HASH,  // Open addressing table sized per row, nothing as wide as B, columns can be sorted
+    KERNEL_AUTO,  // Hash for rows with few outputs relative to a wide B, Gustavson otherwise
+} MultiplicationKernel;
+
+// Column panel widths of tiled dense products
+#define TILE_NONE 0  // Whole rows of B at once
+#define TILE_AUTO ((size_t)-1)  // Sized to L2 and checked against neighbouring widths on a sample of rows
 
 // Function Prototypes
+// Function to select the OpenMP schedule, chunk_size <= 0 uses the runtime default.
+// For work stealing the chunk size is the grain of each block.
+void set_multiplication_schedule(ScheduleType schedule_type, int chunk_size);
+const char* get_schedule_name(ScheduleType schedule_type);
+
+// Function to select the kernel of compressed products; sort_columns orders each output row
+// by column where the kernel supports it
+void set_multiplication_kernel(MultiplicationKernel kernel, int sort_columns);
+const char* get_kernel_name(MultiplicationKernel kernel);
+
+// Function to make sequential and OpenMP dense products go over B one panel of panel_cols columns at
+// a time, so the panel's rows of B and the slice of each output row stay in cache while all of A passes.
+// Rows of B are sorted first if they are not already; widths of B's full width or more are not tiled.
+// Auto widths are kept for the last pair of inputs until the tiling is set again.
+void set_multiplication_tiling(size_t panel_cols);
+size_t get_last_panel_cols(void);  // Width the last dense product used, 0 if it was not tiled
+
 // FUnction to multiply two compressed matrices and return a dense matrix
 DenseMatrix* multiply_matrices(const CompressedMatrix* A, const CompressedMatrix* B, parallelisation_type schedule_type);
 
-//function to multiply matrices with MPI
-void multiply_matrices_mpi(const CompressedMatrix* A, const CompressedMatrix* B, DenseMatrix* result);
+// Function to multiply two compressed matrices and return the compressed product,
+// sized by a symbolic pass so memory scales with the product's nnz
+CompressedMatrix* multiply_matrices_sparse(const CompressedMatrix* A, const CompressedMatrix* B, parallelisation_type schedule_type);
+
+// Function to multiply matrices with MPI, collective over the multiplication communicator.
+// A and B are only read on rank 0; rank 0 scatters row blocks of A of equal estimated cost, broadcasts B,
+// every rank multiplies its block with local_type and rank 0 gathers the product.
+// Returns the product on rank 0 and NULL on every other rank.
+CompressedMatrix* multiply_matrices_mpi(const CompressedMatrix* A, const CompressedMatrix* B, parallelisation_type local_type);
+
+// Symbolic work of A * B kept for repeated products of inputs whose values change but whose patterns do not
+typedef struct MultiplicationPlan MultiplicationPlan;
+typedef struct DistributedPlan DistributedPlan;
+
+// Function to analyse A * B once: the product's structure in the selected kernel's column order, the
+// row split of the selected schedule and every thread's workspace. The structure follows A's stored
+// pattern, so elements of A that are 0 at creation still place their products. Plans never take storage
+// from the matrix arena, they stay valid across its resets. Returns NULL on failure.
+MultiplicationPlan* create_multiplication_plan(const CompressedMatrix* A, const CompressedMatrix* B, parallelisation_type schedule_type);
+
+// Function to multiply inputs with the patterns the plan was made from, using only their current values.
+// Allocates nothing; the product belongs to the plan and the next execution overwrites it. Returns NULL
+// if the inputs' shapes or nnz differ from the plan's, patterns are otherwise trusted to match.
+const CompressedMatrix* execute_multiplication_plan(MultiplicationPlan* plan, const CompressedMatrix* A, const CompressedMatrix* B);
+const CompressedMatrix* get_plan_product(const MultiplicationPlan* plan);  // Product of the last execution or of creation
+void free_multiplication_plan(MultiplicationPlan* plan);
+
+// MPI plans, collective over the multiplication communicator when created, duplicated for the plan.
+// Every rank keeps its row block of A, its replica of B's structure and a plan of its block, so an
+// execution only moves values: A's are scattered, B's broadcast and the product's gathered.
+// A and B are only read on rank 0 and the product is returned there, NULL elsewhere. Like local plans
+// they keep out of the matrix arena.
+DistributedPlan* create_distributed_plan(const CompressedMatrix* A, const CompressedMatrix* B, parallelisation_type local_type);
+const CompressedMatrix* execute_distributed_plan(DistributedPlan* plan, const CompressedMatrix* A, const CompressedMatrix* B);
+const CompressedMatrix* get_distributed_plan_product(const DistributedPlan* plan);
+void free_distributed_plan(DistributedPlan* plan);  // Collective, it frees the plan's communicator
+
+// Function to multiply a compressed matrix by a block of X->cols dense vectors, writing A * X to Y.
+// Y is overwritten and allocated by the caller, so repeated products allocate nothing; its rows may
+// be padded like any DenseMatrix. MPI variants read A and X and write Y on rank 0 only.
+// Returns 0 on success and -1 if the dimensions do not match.
+int multiply_matrix_dense(const CompressedMatrix* A, const DenseMatrix* X, DenseMatrix* Y, parallelisation_type schedule_type);
+
+// Function to multiply a compressed matrix by the dense vector x of A->num_cols elements, writing
+// the A->num_rows elements of A * x to y. Same as multiply_matrix_dense with one column.
+int multiply_matrix_vector(const CompressedMatrix* A, const int* x, int* y, parallelisation_type schedule_type);
+
+// Function to multiply by dense vectors with MPI, collective over the multiplication communicator.
+// Rank 0 scatters row blocks of A of equal nnz and broadcasts X, every rank multiplies its block with
+// local_type and rank 0 gathers Y. Returns 0 on every rank on success.
+int multiply_matrix_dense_mpi(const CompressedMatrix* A, const DenseMatrix* X, DenseMatrix* Y, parallelisation_type local_type);
+
+// Function to run MPI multiplications over a subset of ranks, MPI_COMM_NULL restores MPI_COMM_WORLD
+void set_multiplication_communicator(MPI_Comm comm);
+
+// Function to copy A with each row first touched by the OpenMP thread the selected schedule first deals it
+// to in A * B, with omp_get_max_threads() threads. With threads pinned, every row then sits on the NUMA node
+// that multiplies it; dynamic schedules have no fixed owner and are split evenly. Returns NULL on failure.
+CompressedMatrix* place_matrix_rows(const CompressedMatrix* A, const CompressedMatrix* B);
 
-// Function to free a dense matrix
-void free_dense_matrix(DenseMatrix* matrix);
+// Function to count the pages of A's rows, and of result's if it is not NULL, on and off the NUMA node of
+// the thread that owns those rows in A * B, split as place_matrix_rows splits them. B is read by every
+// thread and is not counted.
+void measure_row_placement(const CompressedMatrix* A, const CompressedMatrix* B, const DenseMatrix* result,
+                           PagePlacement* placement);
 
-// Function to print a dense matrix
-void print_dense_matrix(const DenseMatrix* matrix);
+// Function to expand a compressed matrix into a dense one
+DenseMatrix* compressed_to_dense(const CompressedMatrix* compressed);
 
 #endif // MATRIX_MULTIPLICATION_H
\ No newline at end of file
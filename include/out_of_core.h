@@ -0,0 +1,18 @@
+#ifndef OUT_OF_CORE_H
+#define OUT_OF_CORE_H
+
+#include "matrix_multiplication.h"
+#include <stddef.h>
+
+// Bytes of A held per panel when the caller passes 0
+#define DEFAULT_PANEL_BYTES ((size_t)64 << 20)
+
+// Function to multiply the binary compressed files at a_path and b_path, writing the product to
+// out_path in the same format. B stays mapped while row panels of A, each holding about panel_bytes
+// of A, are read on a helper thread: one panel is multiplied with local_type (sequential or OpenMP)
+// while the next is read and the previous product is written. Memory holds B, two panels of A and
+// two panel products, whatever the size of A or the product. Returns 0 on success, -1 on failure.
+int multiply_matrices_out_of_core(const char* a_path, const char* b_path, const char* out_path,
+                                  size_t panel_bytes, parallelisation_type local_type);
+
+#endif // OUT_OF_CORE_H
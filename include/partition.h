@@ -0,0 +1,23 @@
+#ifndef PARTITION_H
+#define PARTITION_H
+
+#include "matrix_compression.h"
+#include <stddef.h>
+
+// Function prototypes
+// Estimates the work of each row of A * B as one multiply-add per element of B its non-zeros reach,
+// plus one for the row itself. Returns num_rows + 1 prefix sums, cost of rows [i, j) being
+// costs[j] - costs[i], or NULL if the allocation fails. Release them with matrix_free.
+size_t* estimate_row_costs(const CompressedMatrix* A, const CompressedMatrix* B);
+
+// Splits rows into parts contiguous ranges of nearly equal cost; bounds receives parts + 1 entries,
+// part p owning rows [bounds[p], bounds[p + 1])
+void partition_rows(const size_t* costs, size_t rows, int parts, size_t* bounds);
+
+// Rows [begin, end) of one part of the same split, for threads that each find their own range
+void partition_range(const size_t* costs, size_t rows, int part, int parts, size_t* begin, size_t* end);
+
+// Costliest range over the average range, 1.0 being a perfect split
+double partition_imbalance(const size_t* costs, const size_t* bounds, int parts);
+
+#endif // PARTITION_H
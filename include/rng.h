@@ -0,0 +1,34 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Counter-based random numbers: every stream is a pure function of (seed, key, stream), where the key
+// names what is being generated (a row, a cell). Whichever thread or rank draws a key, in whatever
+// order, gets the same values, so generated data depends only on the seed.
+
+// SplitMix64 finaliser, a bijection that scatters neighbouring inputs across all 64 bits
+static inline uint64_t rng_mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Advances a SplitMix64 state and returns its next 64 bits
+static inline uint64_t rng_next(uint64_t* state) {
+    return rng_mix(*state += 0x9E3779B97F4A7C15ULL);
+}
+
+// Starting state of stream number stream (0 to 3) of key under seed
+static inline uint64_t rng_stream(const unsigned long long seed, const uint64_t key, const uint64_t stream) {
+    uint64_t state = seed ^ (0xD1B54A32D192ED03ULL * (key + 1)) ^ (stream << 62);
+    return rng_next(&state);
+}
+
+// Uniform double in (0, 1]
+static inline double rng_unit(uint64_t* state) {
+    return (double)((rng_next(state) >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+#endif // RNG_H
@@ -0,0 +1,33 @@
+#ifndef SIMD_KERNELS_H
+#define SIMD_KERNELS_H
+
+#include <stddef.h>
+
+// Instruction sets the kernels can use, the best one the CPU supports is picked at runtime
+typedef enum {
+    SIMD_SCALAR,
+    SIMD_AVX2,
+    SIMD_AVX512,
+} SimdLevel;
+
+// Function prototypes
+// Function to cap the instruction set, SIMD_SCALAR forces the plain loops
+void set_simd_level(SimdLevel level);
+SimdLevel get_simd_level(void);
+const char* get_simd_level_name(SimdLevel level);
+
+// Number of non-zero elements in row[0, cols)
+size_t count_nonzeros(const int* row, size_t cols);
+
+// Function to copy the non-zeros of row[0, cols) to values and their columns to col_idx in column order,
+// returns how many there were. Nothing is written past them.
+size_t extract_nonzeros(const int* row, size_t cols, int* values, int* col_idx);
+
+// Sum of values[j] * x[cols[j] * stride] over j in [0, count), the elements of x gathered
+int gather_dot(const int* values, const int* cols, size_t count, const int* x, size_t stride);
+
+// Function to write to y[0, k) the rows of x at cols[0, count), scaled by values and summed; row c of x
+// starts at x + c * stride. Each block of y stays in registers while every row is added to it.
+void sum_scaled_rows(int* y, const int* x, size_t stride, const int* values, const int* cols, size_t count, size_t k);
+
+#endif // SIMD_KERNELS_H
@@ -5,6 +5,8 @@
 #include <time.h>
 #include <stdio.h>
 
+// Stopwatch for callers that record a single duration; phases inside the library
+// are timed with the PROFILE_* macros of instrumentation.h
 typedef struct {
     clock_t cpu_start;
     double wall_start;
@@ -21,8 +23,6 @@ clock_t cpu_end = clock(); \
 double wall_end = omp_get_wtime(); \
 X.cpu_time = (double)(cpu_end - X.cpu_start) / CLOCKS_PER_SEC; \
 X.wall_time = wall_end - X.wall_start; \
-printf("CPU Time: %f seconds\n", X.cpu_time); \
-printf("Wall Clock Time: %f seconds\n", X.wall_time); \
 } while(0)
 
 #endif // TIMING_H
\ No newline at end of file
@@ -0,0 +1,70 @@
+#ifndef TYPED_MATRIX_H
+#define TYPED_MATRIX_H
+
+#include "matrix_compression.h"
+#include "matrix_multiplication.h"
+#include <stdint.h>
+#include <stddef.h>
+
+// CSR variants with their own value and column index widths, laid out like CompressedMatrix
+// (empty rows store two 0s). Each entry is X(NAME, label, value type, index type, PRODUCT):
+// products of two NAME matrices accumulate in and are stored as the PRODUCT variant, which is wide
+// enough that products of the generator's values cannot overflow.
+#define CSR_VARIANTS(X) \
+    X(I8, "int8", int8_t, int32_t, I32) \
+    X(I16, "int16", int16_t, int32_t, I64) \
+    X(I32, "int32", int32_t, int32_t, I64) \
+    X(I64, "int64", int64_t, int32_t, I64) \
+    X(F32, "float", float, int32_t, F64) \
+    X(F64, "double", double, int32_t, F64) \
+    X(I32W, "int32-wide", int32_t, int64_t, I64W) \
+    X(I64W, "int64-wide", int64_t, int64_t, I64W)
+
+#define CSR_VARIANT_STRUCT(NAME, LABEL, VALUE, INDEX, PRODUCT) \
+    typedef struct { \
+        VALUE* values; \
+        INDEX* col_idx; \
+        size_t* row_ptr;  /* num_rows + 1 offsets, as in CompressedMatrix */ \
+        size_t num_rows; \
+        size_t num_cols; \
+        size_t nnz; \
+    } Csr##NAME; \
+    typedef VALUE Csr##NAME##Value; \
+    typedef INDEX Csr##NAME##Index;
+
+#define CSR_VARIANT_PROTOTYPES(NAME, LABEL, VALUE, INDEX, PRODUCT) \
+    Csr##NAME* csr_##NAME##_allocate(size_t rows, size_t cols, size_t nnz); \
+    void csr_##NAME##_free(Csr##NAME* matrix); \
+    Csr##NAME* csr_##NAME##_from_compressed(const CompressedMatrix* compressed); \
+    CompressedMatrix* csr_##NAME##_to_compressed(const Csr##NAME* matrix); \
+    Csr##PRODUCT* csr_##NAME##_multiply(const Csr##NAME* A, const Csr##NAME* B, parallelisation_type parallelisation_type);
+
+CSR_VARIANTS(CSR_VARIANT_STRUCT)
+// Per variant NAME: allocation with storage for nnz elements, conversion from int storage (NULL if
+// a value or column index does not fit), conversion back (NULL if a value does not fit an int), and
+// the sequential or OpenMP product sized by a symbolic pass like multiply_matrices_sparse
+CSR_VARIANTS(CSR_VARIANT_PROTOTYPES)
+
+// Variant picked at runtime, for callers that only learn the width from their input
+#define CSR_VARIANT_ENUM(NAME, LABEL, VALUE, INDEX, PRODUCT) CSR_##NAME,
+typedef enum {
+    CSR_VARIANTS(CSR_VARIANT_ENUM)
+    CSR_VARIANT_COUNT
+} CsrVariant;
+
+typedef struct {
+    CsrVariant variant;
+    void* matrix;  // The Csr struct of variant
+} TypedMatrix;
+
+// Function prototypes
+const char* get_csr_variant_name(CsrVariant variant);
+int parse_csr_variant(const char* name, CsrVariant* variant);
+
+TypedMatrix* typed_from_compressed(const CompressedMatrix* compressed, CsrVariant variant);
+TypedMatrix* typed_multiply(const TypedMatrix* A, const TypedMatrix* B, parallelisation_type parallelisation_type);
+CompressedMatrix* typed_to_compressed(const TypedMatrix* typed);
+size_t typed_bytes(const TypedMatrix* typed);  // Storage of the row offsets, values and indices
+void free_typed_matrix(TypedMatrix* typed);
+
+#endif // TYPED_MATRIX_H
@@ -0,0 +1,25 @@
+#ifndef WORK_STEALING_H
+#define WORK_STEALING_H
+
+#include <stddef.h>
+
+// Rows dealt to the threads of a parallel region. Each thread takes grain rows at a time from the
+// front of its own deque and, once that is empty, steals the back half of another thread's deque,
+// so threads only contend when one of them runs out of work.
+typedef struct WorkQueue WorkQueue;
+
+// Function prototypes
+// Deals rows [0, rows) to threads deques as contiguous ranges, of equal cost when costs holds the
+// prefix sums from estimate_row_costs and of equal length when it is NULL. grain 0 picks one from the
+// row and thread counts. Threads need not all show up, the rows of absent threads are stolen.
+// costs must outlive the queue. Returns NULL if the allocation fails.
+WorkQueue* create_work_queue(size_t rows, size_t grain, int threads, const size_t* costs);
+void free_work_queue(WorkQueue* queue);
+
+// Function to deal the rows out again for another pass, while no thread uses the queue
+void reset_work_queue(WorkQueue* queue);
+
+// Function to get the next rows [begin, end) of thread, returns 0 once every deque is empty
+int next_row_block(WorkQueue* queue, int thread, size_t* begin, size_t* end);
+
+#endif // WORK_STEALING_H
@@ -0,0 +1,223 @@
+#define _GNU_SOURCE
+#include "affinity.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <omp.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sched.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#endif
+
+// Nodes past this are ignored, they would need more sockets than any machine we run on
+#define MAX_NUMA_NODES 64
+// Pages asked about per move_pages call
+#define PLACEMENT_BATCH 512
+
+static ThreadBinding thread_binding = BIND_NONE;
+
+void set_thread_binding(ThreadBinding binding) {
+    thread_binding = binding;
+}
+
+ThreadBinding get_thread_binding(void) {
+    return thread_binding;
+}
+
+const char* get_thread_binding_name(ThreadBinding binding) {
+    switch (binding) {
+        case BIND_NONE: return "none";
+        case BIND_CLOSE: return "close";
+        case BIND_SPREAD: return "spread";
+        default: return "unknown";
+    }
+}
+
+#ifdef __linux__
+// Node of every CPU, read once from sysfs; every CPU is on node 0 without NUMA support
+static int cpu_node[CPU_SETSIZE];
+static int node_ids = 1;  // One past the highest node with CPUs
+static int node_count = 1;
+// CPUs the process may run on, taken before any of its threads is pinned
+static cpu_set_t process_cpus;
+static pthread_once_t topology_once = PTHREAD_ONCE_INIT;
+
+// Assigns node to every CPU of a sysfs list such as "0-3,8-11", returns how many it named
+static int assign_cpu_list(const char* list, const int node) {
+    int assigned = 0;
+    while (*list) {
+        char* end;
+        const long first = strtol(list, &end, 10);
+        if (end == list) {
+            break;
+        }
+        long last = first;
+        if (*end == '-') {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+        }
+        for (long cpu = first; cpu <= last && cpu >= 0 && cpu < CPU_SETSIZE; cpu++) {
+            cpu_node[cpu] = node;
+            assigned++;
+        }
+        list = *end == ',' ? end + 1 : end;
+        if (*list == '\n') {
+            break;
+        }
+    }
+    return assigned;
+}
+
+static void load_topology(void) {
+    sched_getaffinity(0, sizeof(process_cpus), &process_cpus);
+
+    int found = 0;
+    for (int node = 0; node < MAX_NUMA_NODES; node++) {
+        char path[64];
+        char list[4096];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE* file = fopen(path, "r");
+        if (!file) {
+            continue;
+        }
+        if (fgets(list, sizeof(list), file) && assign_cpu_list(list, node) > 0) {
+            node_ids = node + 1;
+            found++;
+        }
+        fclose(file);
+    }
+    node_count = found > 0 ? found : 1;
+}
+
+// Allowed CPUs in the order threads are pinned to them, returns how many there are
+static int binding_order(const ThreadBinding binding, int* order) {
+    int count = 0;
+    if (binding == BIND_CLOSE) {
+        for (int node = 0; node < node_ids; node++) {
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &process_cpus) && cpu_node[cpu] == node) {
+                    order[count++] = cpu;
+                }
+            }
+        }
+        return count;
+    }
+
+    // The k-th CPU of every node comes before the (k + 1)-th of any node
+    int next[MAX_NUMA_NODES] = {0};
+    for (int dealt = 1; dealt;) {
+        dealt = 0;
+        for (int node = 0; node < node_ids; node++) {
+            int cpu = next[node];
+            while (cpu < CPU_SETSIZE && !(CPU_ISSET(cpu, &process_cpus) && cpu_node[cpu] == node)) {
+                cpu++;
+            }
+            if (cpu < CPU_SETSIZE) {
+                order[count++] = cpu;
+                dealt = 1;
+            }
+            next[node] = cpu + 1;
+        }
+    }
+    return count;
+}
+#endif
+
+int bind_openmp_threads(void) {
+    // Places given to the runtime win over our own binding
+    if (thread_binding == BIND_NONE || getenv("OMP_PLACES") || omp_get_proc_bind() != omp_proc_bind_false) {
+        return 0;
+    }
+#ifdef __linux__
+    pthread_once(&topology_once, load_topology);
+    int* order = malloc(CPU_SETSIZE * sizeof(int));
+    const int cpus = order ? binding_order(thread_binding, order) : 0;
+    if (cpus == 0) {
+        fprintf(stderr, "Failed to find CPUs to bind threads to\n");
+        free(order);
+        return -1;
+    }
+
+    int failed = 0;
+    int threads = 1;
+    #pragma omp parallel
+    {
+        // Teams larger than the CPU set wrap around it
+        cpu_set_t cpu;
+        CPU_ZERO(&cpu);
+        CPU_SET(order[omp_get_thread_num() % cpus], &cpu);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpu), &cpu) != 0) {
+            #pragma omp atomic write
+            failed = 1;
+        }
+        #pragma omp single
+        threads = omp_get_num_threads();
+    }
+    free(order);
+    if (failed) {
+        fprintf(stderr, "Failed to bind every OpenMP thread to a CPU\n");
+        return -1;
+    }
+    return threads;
+#else
+    fprintf(stderr, "Thread binding is only supported on Linux, threads are left unpinned\n");
+    return -1;
+#endif
+}
+
+int get_numa_node_count(void) {
+#ifdef __linux__
+    pthread_once(&topology_once, load_topology);
+    return node_count;
+#else
+    return 1;
+#endif
+}
+
+int get_current_numa_node(void) {
+#ifdef __linux__
+    pthread_once(&topology_once, load_topology);
+    const int cpu = sched_getcpu();
+    return cpu >= 0 && cpu < CPU_SETSIZE ? cpu_node[cpu] : -1;
+#else
+    return 0;
+#endif
+}
+
+void count_page_placement(const void* data, const size_t bytes, const int node, PagePlacement* placement) {
+    if (!data || bytes == 0) {
+        return;
+    }
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    const uintptr_t first = (uintptr_t)data / page * page;
+    const size_t pages = ((uintptr_t)data + bytes - first + page - 1) / page;
+
+#if defined(__linux__) && defined(SYS_move_pages)
+    void* addresses[PLACEMENT_BATCH];
+    int status[PLACEMENT_BATCH];
+    for (size_t p = 0; p < pages; p += PLACEMENT_BATCH) {
+        const size_t count = pages - p < PLACEMENT_BATCH ? pages - p : PLACEMENT_BATCH;
+        for (size_t k = 0; k < count; k++) {
+            addresses[k] = (void*)(first + (p + k) * page);
+        }
+        // Without target nodes move_pages moves nothing and reports the node of each page
+        if (syscall(SYS_move_pages, 0, count, addresses, NULL, status, 0) != 0) {
+            placement->unplaced_pages += pages - p;
+            return;
+        }
+        for (size_t k = 0; k < count; k++) {
+            if (status[k] < 0) {
+                placement->unplaced_pages++;
+            } else if (status[k] == node) {
+                placement->local_pages++;
+            } else {
+                placement->remote_pages++;
+            }
+        }
+    }
+#else
+    placement->unplaced_pages += pages;
+#endif
+}
@@ -0,0 +1,186 @@
+#include "arena.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <omp.h>
+
+#define CACHE_LINE 64
+// Threads take this much of the arena at a time; larger requests are carved from it directly
+#define ARENA_SLAB_BYTES ((size_t)1 << 20)
+// Threads numbered past this share the arena's own bump pointer
+#define ARENA_MAX_THREADS 256
+
+// Unused part [cursor, end) of one thread's slab, as offsets into the arena, a cache line each
+typedef struct {
+    _Alignas(CACHE_LINE) size_t cursor;
+    size_t end;
+} ArenaSlab;
+
+struct Arena {
+    char* base;
+    size_t capacity;
+    size_t offset;  // Start of the part no slab or allocation holds yet
+    size_t peak;
+    ArenaSlab* slabs;
+    Arena* next;  // Live arenas, so matrix_free can tell their blocks from heap blocks
+};
+
+// Arenas are created and freed outside parallel regions, like every other setting
+static Arena* live_arenas = NULL;
+static Arena* matrix_arena = NULL;
+static size_t arena_fallbacks = 0;
+
+Arena* create_arena(const size_t capacity) {
+    Arena* arena = malloc(sizeof(Arena));
+    if (!arena) {
+        fprintf(stderr, "Failed to allocate memory for Arena\n");
+        return NULL;
+    }
+    arena->capacity = (capacity + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+    arena->offset = 0;
+    arena->peak = 0;
+    arena->slabs = aligned_alloc(CACHE_LINE, ARENA_MAX_THREADS * sizeof(ArenaSlab));
+
+    // Pages are only backed once written, by the thread that writes them
+    void* mapping = arena->capacity > 0
+                    ? mmap(NULL, arena->capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0)
+                    : MAP_FAILED;
+    if (mapping == MAP_FAILED || !arena->slabs) {
+        fprintf(stderr, "Failed to reserve %zu bytes for arena\n", capacity);
+        if (mapping != MAP_FAILED) {
+            munmap(mapping, arena->capacity);
+        }
+        free(arena->slabs);
+        free(arena);
+        return NULL;
+    }
+    arena->base = mapping;
+    arena_reset(arena);
+
+    arena->next = live_arenas;
+    live_arenas = arena;
+    return arena;
+}
+
+void free_arena(Arena* arena) {
+    if (!arena) {
+        return;
+    }
+    for (Arena** link = &live_arenas; *link; link = &(*link)->next) {
+        if (*link == arena) {
+            *link = arena->next;
+            break;
+        }
+    }
+    if (matrix_arena == arena) {
+        matrix_arena = NULL;
+    }
+    munmap(arena->base, arena->capacity);
+    free(arena->slabs);
+    free(arena);
+}
+
+// Takes bytes off the shared bump pointer, returns their offset or SIZE_MAX if they do not fit.
+// A failed request still moves the pointer, the arena counts as full until it is released.
+static size_t carve_shared(Arena* arena, const size_t bytes) {
+    size_t start;
+    #pragma omp atomic capture
+    {
+        start = arena->offset;
+        arena->offset += bytes;
+    }
+    return start <= arena->capacity && bytes <= arena->capacity - start ? start : SIZE_MAX;
+}
+
+void* arena_alloc(Arena* arena, size_t bytes) {
+    bytes = bytes > 0 ? (bytes + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE : CACHE_LINE;
+
+    // Only threads of the outermost parallel region have distinct numbers to pick their slab by
+    const int thread = omp_get_active_level() == 1 ? omp_get_thread_num() : -1;
+    if (thread >= 0 && thread < ARENA_MAX_THREADS && bytes <= ARENA_SLAB_BYTES / 2) {
+        ArenaSlab* slab = &arena->slabs[thread];
+        if (slab->end - slab->cursor < bytes) {
+            const size_t start = carve_shared(arena, ARENA_SLAB_BYTES);
+            if (start == SIZE_MAX) {
+                return NULL;
+            }
+            slab->cursor = start;
+            slab->end = start + ARENA_SLAB_BYTES;
+        }
+        void* block = arena->base + slab->cursor;
+        slab->cursor += bytes;
+        return block;
+    }
+
+    const size_t start = carve_shared(arena, bytes);
+    return start == SIZE_MAX ? NULL : arena->base + start;
+}
+
+size_t arena_mark(const Arena* arena) {
+    return arena->offset;
+}
+
+void arena_release(Arena* arena, const size_t mark) {
+    const size_t used = arena->offset < arena->capacity ? arena->offset : arena->capacity;
+    arena->peak = used > arena->peak ? used : arena->peak;
+    arena->offset = mark;
+    // Slabs may lie past the mark, threads take new ones on their next allocation
+    for (int t = 0; t < ARENA_MAX_THREADS; t++) {
+        arena->slabs[t].cursor = 0;
+        arena->slabs[t].end = 0;
+    }
+}
+
+void arena_reset(Arena* arena) {
+    arena_release(arena, 0);
+}
+
+size_t arena_capacity(const Arena* arena) {
+    return arena->capacity;
+}
+
+size_t arena_peak(const Arena* arena) {
+    const size_t used = arena->offset < arena->capacity ? arena->offset : arena->capacity;
+    return used > arena->peak ? used : arena->peak;
+}
+
+void set_matrix_arena(Arena* arena) {
+    matrix_arena = arena;
+}
+
+Arena* get_matrix_arena(void) {
+    return matrix_arena;
+}
+
+void* matrix_alloc(const size_t bytes) {
+    if (matrix_arena) {
+        void* block = arena_alloc(matrix_arena, bytes);
+        if (block) {
+            return block;
+        }
+        #pragma omp atomic
+        arena_fallbacks++;
+    }
+    void* block = NULL;
+    return posix_memalign(&block, CACHE_LINE, bytes > 0 ? bytes : CACHE_LINE) == 0 ? block : NULL;
+}
+
+void matrix_free(void* ptr) {
+    if (!ptr) {
+        return;
+    }
+    for (const Arena* arena = live_arenas; arena; arena = arena->next) {
+        if ((char*)ptr >= arena->base && (char*)ptr < arena->base + arena->capacity) {
+            return;
+        }
+    }
+    free(ptr);
+}
+
+size_t get_arena_fallbacks(void) {
+    size_t fallbacks;
+    #pragma omp atomic read
+    fallbacks = arena_fallbacks;
+    return fallbacks;
+}
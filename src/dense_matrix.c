@@ -0,0 +1,92 @@
+#include "dense_matrix.h"
+#include "arena.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+// Buffers below one huge page gain nothing from being mapped
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+
+static int use_huge_pages = 0;
+
+void set_dense_huge_pages(int enabled) {
+    use_huge_pages = enabled;
+}
+
+DenseMatrix* allocate_dense_matrix(const size_t rows, const size_t cols, const int zero) {
+    DenseMatrix* matrix = malloc(sizeof(DenseMatrix));
+    if (!matrix) {
+        fprintf(stderr, "Failed to allocate memory for DenseMatrix\n");
+        return NULL;
+    }
+
+    const size_t row_alignment = DENSE_ALIGNMENT / sizeof(int);
+    matrix->rows = rows;
+    matrix->cols = cols;
+    matrix->stride = (cols + row_alignment - 1) / row_alignment * row_alignment;
+    matrix->mapped = 0;
+    matrix->data = NULL;
+
+    if (matrix->stride != 0 && rows > SIZE_MAX / sizeof(int) / matrix->stride) {
+        fprintf(stderr, "Cannot safely allocate a %zu x %zu dense matrix\n", rows, cols);
+        free(matrix);
+        return NULL;
+    }
+    matrix->bytes = rows * matrix->stride * sizeof(int);
+    const size_t bytes = matrix->bytes > 0 ? matrix->bytes : DENSE_ALIGNMENT;
+
+    // A matrix arena already keeps its pages mapped from one product to the next
+    if (use_huge_pages && bytes >= HUGE_PAGE_SIZE && !get_matrix_arena()) {
+        // Anonymous mappings arrive zeroed, pages are only faulted in on first touch
+        void* mapping = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping != MAP_FAILED) {
+#ifdef MADV_HUGEPAGE
+            madvise(mapping, bytes, MADV_HUGEPAGE);
+#endif
+            matrix->data = mapping;
+            matrix->mapped = 1;
+            return matrix;
+        }
+    }
+
+    // Arena blocks and the heap fallback are both aligned to a cache line, which DENSE_ALIGNMENT matches
+    void* buffer = matrix_alloc(bytes);
+    if (!buffer) {
+        fprintf(stderr, "Failed to allocate %zu bytes for dense matrix\n", bytes);
+        free(matrix);
+        return NULL;
+    }
+    matrix->data = buffer;
+
+    if (zero) {
+        #pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < rows; i++) {
+            memset(DENSE_ROW(matrix, i), 0, matrix->stride * sizeof(int));
+        }
+    }
+    return matrix;
+}
+
+void free_dense_matrix(DenseMatrix* matrix) {
+    if (!matrix) {
+        return;
+    }
+    if (matrix->mapped) {
+        munmap(matrix->data, matrix->bytes);
+    } else {
+        matrix_free(matrix->data);
+    }
+    free(matrix);
+}
+
+void print_dense_matrix(const DenseMatrix* matrix) {
+    for (size_t i = 0; i < matrix->rows; i++) {
+        const int* row = DENSE_ROW(matrix, i);
+        for (size_t j = 0; j < matrix->cols; j++) {
+            printf("%2d ", row[j]);
+        }
+        printf("\n");
+    }
+}
\ No newline at end of file
@@ -0,0 +1,282 @@
+#include "instrumentation.h"
+
+#ifdef ENABLE_PROFILING
+
+#include <mpi.h>
+#include <omp.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_PROFILE_REGIONS 64
+#define MAX_PROFILE_DEPTH 16
+#define PROFILE_NAME_SIZE 48
+
+// Times and counters of one thread, only ever written by that thread
+typedef struct ThreadProfile {
+    double inclusive[MAX_PROFILE_REGIONS];
+    double children[MAX_PROFILE_REGIONS];  // Time spent in regions nested directly inside
+    uint64_t calls[MAX_PROFILE_REGIONS];
+    int depths[MAX_PROFILE_REGIONS];  // Deepest nesting the region was opened at
+    uint64_t counters[PROFILE_COUNTER_COUNT];
+    int stack[MAX_PROFILE_DEPTH];  // Open regions, innermost last
+    double start[MAX_PROFILE_DEPTH];
+    int depth;
+    struct ThreadProfile* next;
+} ThreadProfile;
+
+// One region of one rank as it travels to the root for the report
+typedef struct {
+    char name[PROFILE_NAME_SIZE];
+    int depth;
+    uint64_t calls;
+    double wall;  // Longest time a single thread spent inside
+    double thread_seconds;  // Time inside summed over threads
+    double self_seconds;  // thread_seconds minus nested regions
+} RegionRecord;
+
+// Regions are shared by name between call sites and threads
+static const char* region_names[MAX_PROFILE_REGIONS];
+static int num_regions = 0;
+
+static ThreadProfile* thread_profiles = NULL;
+static _Thread_local ThreadProfile* thread_profile = NULL;
+static int reported = 0;
+
+static const char* counter_names[PROFILE_COUNTER_COUNT] = {
+    "nnz", "multiply_adds", "bytes_sent", "bytes_received",
+};
+
+static void report_at_exit(void) {
+    if (!reported) {
+        profile_report(stderr);
+    }
+}
+
+static ThreadProfile* get_thread_profile(void) {
+    if (thread_profile == NULL) {
+        ThreadProfile* profile = calloc(1, sizeof(ThreadProfile));
+        if (!profile) {
+            return NULL;
+        }
+        #pragma omp critical(profile_registry)
+        {
+            if (thread_profiles == NULL) {
+                atexit(report_at_exit);
+            }
+            profile->next = thread_profiles;
+            thread_profiles = profile;
+        }
+        thread_profile = profile;
+    }
+    return thread_profile;
+}
+
+// Returns the id of name, adding it on first use; -1 once the table is full
+static int register_region(const char* name) {
+    int id = -1;
+    #pragma omp critical(profile_registry)
+    {
+        for (int r = 0; r < num_regions && id < 0; r++) {
+            if (strcmp(region_names[r], name) == 0) {
+                id = r;
+            }
+        }
+        if (id < 0 && num_regions < MAX_PROFILE_REGIONS) {
+            id = num_regions;
+            region_names[id] = name;
+            num_regions++;
+        }
+    }
+    return id;
+}
+
+void profile_begin(int* region_id, const char* name) {
+    ThreadProfile* profile = get_thread_profile();
+    if (!profile) {
+        return;
+    }
+
+    // Each call site caches its id so the registry is only searched once
+    int id;
+    #pragma omp atomic read
+    id = *region_id;
+    if (id < 0) {
+        id = register_region(name);
+        #pragma omp atomic write
+        *region_id = id;
+    }
+
+    if (profile->depth < MAX_PROFILE_DEPTH) {
+        // Threads of a parallel region start with empty stacks, so keep the deepest nesting seen
+        if (id >= 0 && profile->depth > profile->depths[id]) {
+            profile->depths[id] = profile->depth;
+        }
+        profile->stack[profile->depth] = id;
+        profile->start[profile->depth] = omp_get_wtime();
+    }
+    profile->depth++;
+}
+
+void profile_end(const char* name) {
+    ThreadProfile* profile = thread_profile;
+    if (!profile || profile->depth == 0) {
+        return;
+    }
+    const double now = omp_get_wtime();
+    const int level = --profile->depth;
+    if (level >= MAX_PROFILE_DEPTH || profile->stack[level] < 0) {
+        return;
+    }
+
+    const int id = profile->stack[level];
+    if (strcmp(region_names[id], name) != 0) {
+        fprintf(stderr, "Profile region %s ended while %s is open\n", name, region_names[id]);
+    }
+    const double elapsed = now - profile->start[level];
+    profile->inclusive[id] += elapsed;
+    profile->calls[id]++;
+    if (level > 0 && level - 1 < MAX_PROFILE_DEPTH && profile->stack[level - 1] >= 0) {
+        profile->children[profile->stack[level - 1]] += elapsed;
+    }
+}
+
+void profile_count(const ProfileCounter counter, const uint64_t amount) {
+    ThreadProfile* profile = get_thread_profile();
+    if (profile) {
+        profile->counters[counter] += amount;
+    }
+}
+
+// Folds every thread of this process into one record per region
+static int collect_local(RegionRecord* records, uint64_t* counters) {
+    const int count = num_regions;
+    for (int r = 0; r < count; r++) {
+        memset(&records[r], 0, sizeof(RegionRecord));
+        snprintf(records[r].name, PROFILE_NAME_SIZE, "%s", region_names[r]);
+    }
+    memset(counters, 0, PROFILE_COUNTER_COUNT * sizeof(uint64_t));
+
+    for (const ThreadProfile* profile = thread_profiles; profile; profile = profile->next) {
+        for (int r = 0; r < count; r++) {
+            records[r].calls += profile->calls[r];
+            records[r].thread_seconds += profile->inclusive[r];
+            records[r].self_seconds += profile->inclusive[r] - profile->children[r];
+            if (profile->inclusive[r] > records[r].wall) {
+                records[r].wall = profile->inclusive[r];
+            }
+            if (profile->depths[r] > records[r].depth) {
+                records[r].depth = profile->depths[r];
+            }
+        }
+        for (int c = 0; c < PROFILE_COUNTER_COUNT; c++) {
+            counters[c] += profile->counters[c];
+        }
+    }
+    return count;
+}
+
+// Prints the records of all ranks, merging regions of the same name
+static void print_report(FILE* out, const RegionRecord* records, const int total, const int ranks,
+                         const uint64_t* counter_sums, const uint64_t* counter_max) {
+    fprintf(out, "\nProfile of %d rank(s), times in seconds\n", ranks);
+    fprintf(out, "%-32s %10s %10s %10s %10s %12s %12s\n",
+            "region", "calls", "wall min", "wall avg", "wall max", "thread-s", "self thread-s");
+
+    char* printed = calloc((size_t)total + 1, 1);
+    for (int i = 0; i < total; i++) {
+        if (printed && printed[i]) {
+            continue;
+        }
+        uint64_t calls = 0;
+        double wall_min = records[i].wall, wall_max = 0.0, wall_sum = 0.0, thread_seconds = 0.0, self_seconds = 0.0;
+        int present = 0;
+        for (int j = i; j < total; j++) {
+            if (strcmp(records[j].name, records[i].name) != 0) {
+                continue;
+            }
+            if (printed) {
+                printed[j] = 1;
+            }
+            calls += records[j].calls;
+            wall_sum += records[j].wall;
+            thread_seconds += records[j].thread_seconds;
+            self_seconds += records[j].self_seconds;
+            if (records[j].wall < wall_min) wall_min = records[j].wall;
+            if (records[j].wall > wall_max) wall_max = records[j].wall;
+            present++;
+        }
+        fprintf(out, "%*s%-*s %10llu %10.6f %10.6f %10.6f %12.6f %12.6f\n",
+                2 * records[i].depth, "", 32 - 2 * records[i].depth, records[i].name, (unsigned long long)calls,
+                wall_min, wall_sum / present, wall_max, thread_seconds, self_seconds);
+    }
+    free(printed);
+
+    fprintf(out, "%-32s %20s %20s\n", "counter", "total", "max per rank");
+    for (int c = 0; c < PROFILE_COUNTER_COUNT; c++) {
+        fprintf(out, "%-32s %20llu %20llu\n", counter_names[c],
+                (unsigned long long)counter_sums[c], (unsigned long long)counter_max[c]);
+    }
+    fflush(out);
+}
+
+void profile_report(FILE* out) {
+    reported = 1;
+
+    RegionRecord local[MAX_PROFILE_REGIONS];
+    uint64_t counters[PROFILE_COUNTER_COUNT];
+    const int count = collect_local(local, counters);
+
+    int initialized = 0, finalized = 0;
+    MPI_Initialized(&initialized);
+    MPI_Finalized(&finalized);
+    if (!initialized || finalized) {
+        print_report(out, local, count, 1, counters, counters);
+        return;
+    }
+
+    int rank, size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+    uint64_t counter_sums[PROFILE_COUNTER_COUNT], counter_max[PROFILE_COUNTER_COUNT];
+    MPI_Reduce(counters, counter_sums, PROFILE_COUNTER_COUNT, MPI_UINT64_T, MPI_SUM, 0, MPI_COMM_WORLD);
+    MPI_Reduce(counters, counter_max, PROFILE_COUNTER_COUNT, MPI_UINT64_T, MPI_MAX, 0, MPI_COMM_WORLD);
+
+    // Ranks may have opened different regions, so records travel as bytes and are merged by name
+    const int local_bytes = count * (int)sizeof(RegionRecord);
+    int* bytes = rank == 0 ? malloc((size_t)size * sizeof(int)) : NULL;
+    int* displs = rank == 0 ? malloc((size_t)size * sizeof(int)) : NULL;
+
+    RegionRecord* all = NULL;
+    int total = 0;
+    if (rank == 0) {
+        all = malloc((size_t)size * MAX_PROFILE_REGIONS * sizeof(RegionRecord));
+        if (!bytes || !displs || !all) {
+            fprintf(stderr, "Failed to allocate memory for the profile report\n");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+    }
+    MPI_Gather(&local_bytes, 1, MPI_INT, bytes, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (rank == 0) {
+        for (int r = 0; r < size; r++) {
+            displs[r] = total * (int)sizeof(RegionRecord);
+            total += bytes[r] / (int)sizeof(RegionRecord);
+        }
+    }
+    MPI_Gatherv(local, local_bytes, MPI_BYTE, all, bytes, displs, MPI_BYTE, 0, MPI_COMM_WORLD);
+
+    if (rank == 0) {
+        print_report(out, all, total, size, counter_sums, counter_max);
+    }
+    free(all);
+    free(bytes);
+    free(displs);
+}
+
+#else
+
+void profile_report(FILE* out) {
+    (void)out;
+}
+
+#endif // ENABLE_PROFILING
@@ -1,10 +1,14 @@
 #include "matrix_compression.h"
+#include "instrumentation.h"
+#include "simd_kernels.h"
+#include "arena.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <omp.h>
 #include <stdint.h>
+#include <sys/mman.h>
 
-CompressedMatrix* compress_matrix(int** matrix, const size_t rows, const size_t cols, float density) {
+CompressedMatrix* allocate_compressed_matrix(const size_t rows, const size_t cols) {
     CompressedMatrix* compressed = malloc(sizeof(CompressedMatrix));
     if (!compressed) {
         fprintf(stderr, "Failed to allocate memory for CompressedMatrix\n");
@@ -12,112 +16,167 @@ CompressedMatrix* compress_matrix(int** matrix, const size_t rows, const size_t
     }
     compressed->num_rows = rows;
     compressed->num_cols = cols;
+    compressed->nnz = 0;
+    compressed->values = NULL;
+    compressed->col_idx = NULL;
+    compressed->mapping = NULL;
+    compressed->mapping_size = 0;
+    compressed->row_ptr = matrix_alloc((rows + 1) * sizeof(size_t));
+
+    if (!compressed->row_ptr) {
+        fprintf(stderr, "Failed to allocate memory for compressed matrix row offsets\n");
+        free(compressed);
+        return NULL;
+    }
+    // Cleared with the static schedule of the row loops that fill it, so each part is first touched by its thread
+    #pragma omp parallel for schedule(static) if(rows >= 4096)
+    for (size_t i = 0; i <= rows; i++) {
+        compressed->row_ptr[i] = 0;
+    }
+    return compressed;
+}
+
+int allocate_compressed_storage(CompressedMatrix* compressed, const size_t nnz) {
+    if (nnz > SIZE_MAX / sizeof(int)) {
+        fprintf(stderr, "Cannot safely allocate %zu compressed elements\n", nnz);
+        return -1;
+    }
+
+    // Never ask malloc for zero bytes so a valid matrix always has storage
+    const size_t capacity = nnz > 0 ? nnz : 1;
+    compressed->values = matrix_alloc(capacity * sizeof(int));
+    compressed->col_idx = matrix_alloc(capacity * sizeof(int));
+    if (!compressed->values || !compressed->col_idx) {
+        fprintf(stderr, "Failed to allocate memory for %zu compressed elements\n", nnz);
+        matrix_free(compressed->values);
+        matrix_free(compressed->col_idx);
+        compressed->values = NULL;
+        compressed->col_idx = NULL;
+        return -1;
+    }
+    compressed->nnz = nnz;
+    return 0;
+}
 
-    // Estimate the number of useful elements per row (+1 for funsies)
-    size_t estimated_non_zero_per_row = (size_t)(cols * density) + 1;
+size_t scan_row_sizes(size_t* row_ptr, const size_t rows) {
+    row_ptr[0] = 0;
+    const int num_threads = omp_get_max_threads();
+    if (rows < 4096 || num_threads == 1) {
+        for (size_t i = 0; i < rows; i++) {
+            row_ptr[i + 1] += row_ptr[i];
+        }
+        return row_ptr[rows];
+    }
+
+    // Two-level scan: each thread scans its block, then adds the totals of the blocks before it
+    size_t* block_totals = calloc((size_t)num_threads + 1, sizeof(size_t));
+    if (!block_totals) {
+        for (size_t i = 0; i < rows; i++) {
+            row_ptr[i + 1] += row_ptr[i];
+        }
+        return row_ptr[rows];
+    }
 
-    // Allocate memory for B and C matrices
-    compressed->B = malloc(rows * sizeof(int*));
-    compressed->C = malloc(rows * sizeof(int*));
-    compressed->row_sizes = calloc(rows, sizeof(size_t));
+    #pragma omp parallel num_threads(num_threads)
+    {
+        const int tid = omp_get_thread_num();
+        const int nt = omp_get_num_threads();
+        const size_t begin = 1 + rows * tid / nt;
+        const size_t end = 1 + rows * (tid + 1) / nt;
+
+        size_t sum = 0;
+        for (size_t i = begin; i < end; i++) {
+            sum += row_ptr[i];
+            row_ptr[i] = sum;
+        }
+        block_totals[tid + 1] = sum;
 
-    if (!compressed->B || !compressed->C || !compressed->row_sizes) {
-        fprintf(stderr, "Failed to allocate memory for compressed matrix arrays\n");
+        #pragma omp barrier
+        #pragma omp single
+        for (int t = 0; t < nt; t++) {
+            block_totals[t + 1] += block_totals[t];
+        }
+
+        const size_t offset = block_totals[tid];
+        for (size_t i = begin; i < end; i++) {
+            row_ptr[i] += offset;
+        }
+    }
+
+    free(block_totals);
+    return row_ptr[rows];
+}
+
+CompressedMatrix* compress_matrix(const DenseMatrix* matrix) {
+    const size_t rows = matrix->rows;
+    const size_t cols = matrix->cols;
+    CompressedMatrix* compressed = allocate_compressed_matrix(rows, cols);
+    if (!compressed) {
+        return NULL;
+    }
+
+    PROFILE_BEGIN("compress");
+
+    // First pass: count the elements of each row into row_ptr[i + 1]
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < rows; i++) {
+        const size_t non_zero_count = count_nonzeros(DENSE_ROW(matrix, i), cols);
+        // If there are only zeros in this row, store two 0s
+        compressed->row_ptr[i + 1] = non_zero_count > 0 ? non_zero_count : EMPTY_ROW_SIZE;
+    }
+
+    const size_t nnz = scan_row_sizes(compressed->row_ptr, rows);
+    if (allocate_compressed_storage(compressed, nnz) != 0) {
+        PROFILE_END("compress");
         free_compressed_matrix(compressed);
         return NULL;
     }
 
-    // parallelize compression
-    #pragma omp parallel
-    {
-        #pragma omp for schedule(dynamic)
-        for (size_t i = 0; i < rows; i++) {
-            compressed->B[i] = malloc(estimated_non_zero_per_row * sizeof(int));
-            compressed->C[i] = malloc(estimated_non_zero_per_row * sizeof(int));
-
-            if (!compressed->B[i] || !compressed->C[i]) {
-                fprintf(stderr, "Failed to allocate memory for row %zu\n", i);
-                continue;
-            }
-
-            size_t non_zero_count = 0;
-            size_t current_capacity = estimated_non_zero_per_row;
-
-            for (size_t j = 0; j < cols; j++) {
-                if (matrix[i][j] != 0) {
-                    if (non_zero_count >= current_capacity) {
-                        // Check overflow before reallocating
-                        if (current_capacity > SIZE_MAX / 2) {
-                            fprintf(stderr, "Cannot safely resize array for row %zu\n", i);
-                            break;
-                        }
-                        size_t new_capacity = current_capacity * 2;
-                        int* new_B = realloc(compressed->B[i], new_capacity * sizeof(int));
-                        int* new_C = realloc(compressed->C[i], new_capacity * sizeof(int));
-
-                        if (!new_B || !new_C) {
-                            fprintf(stderr, "Failed to reallocate memory for row %zu\n", i);
-                            break;
-                        }
-
-                        compressed->B[i] = new_B;
-                        compressed->C[i] = new_C;
-                        current_capacity = new_capacity;
-                    }
-                    compressed->B[i][non_zero_count] = matrix[i][j];
-                    compressed->C[i][non_zero_count] = j;
-                    non_zero_count++;
-                }
-            }
-
-            // If there are only zeros in this row, store two 0s
-            if (non_zero_count == 0) {
-                compressed->B[i][0] = 0;
-                compressed->B[i][1] = 0;
-                compressed->C[i][0] = 0;
-                compressed->C[i][1] = 0;
-                non_zero_count = 2;
-            }
-
-            // Trim excess memory
-            int* trimmed_B = realloc(compressed->B[i], non_zero_count * sizeof(int));
-            int* trimmed_C = realloc(compressed->C[i], non_zero_count * sizeof(int));
-
-            if (trimmed_B) compressed->B[i] = trimmed_B;
-            if (trimmed_C) compressed->C[i] = trimmed_C;
-
-            compressed->row_sizes[i] = non_zero_count;
+    // Second pass: fill each row's slice, using the same schedule so rows are first touched by their owner
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < rows; i++) {
+        const int* row = DENSE_ROW(matrix, i);
+        int* values = compressed->values + compressed->row_ptr[i];
+        int* col_idx = compressed->col_idx + compressed->row_ptr[i];
+
+        if (extract_nonzeros(row, cols, values, col_idx) == 0) {
+            store_empty_row(values, col_idx);
         }
     }
 
+    PROFILE_END("compress");
     return compressed;
 }
 
 
 void free_compressed_matrix(CompressedMatrix* compressed) {
-    for (size_t i = 0; i < compressed->num_rows; i++) {
-        free(compressed->B[i]);
-        free(compressed->C[i]);
+    if (!compressed) {
+        return;
+    }
+    if (compressed->mapping) {
+        // The arrays are views into the mapped file
+        munmap(compressed->mapping, compressed->mapping_size);
+    } else {
+        matrix_free(compressed->values);
+        matrix_free(compressed->col_idx);
+        matrix_free(compressed->row_ptr);
     }
-    free(compressed->B);
-    free(compressed->C);
-    free(compressed->row_sizes);
     free(compressed);
 }
 
 void print_compressed_matrix(const CompressedMatrix* compressed) {
     printf("Matrix B (non-zero elements):\n");
     for (size_t i = 0; i < compressed->num_rows; i++) {
-        for (size_t j = 0; j < compressed->row_sizes[i]; j++) {
-            printf("%2d ", compressed->B[i][j]);
+        for (size_t k = compressed->row_ptr[i]; k < compressed->row_ptr[i + 1]; k++) {
+            printf("%2d ", compressed->values[k]);
         }
         printf("\n");
     }
 
     printf("\nMatrix C (column indices):\n");
     for (size_t i = 0; i < compressed->num_rows; i++) {
-        for (size_t j = 0; j < compressed->row_sizes[i]; j++) {
-            printf("%2d ", compressed->C[i][j]);
+        for (size_t k = compressed->row_ptr[i]; k < compressed->row_ptr[i + 1]; k++) {
+            printf("%2d ", compressed->col_idx[k]);
         }
         printf("\n");
     }
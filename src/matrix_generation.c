@@ -1,64 +1,347 @@
 #include "matrix_generation.h"
+#include "instrumentation.h"
+#include "rng.h"
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
 #include <omp.h>
 
-int setCellValue(const float sparsity) {
-    // Generate a random float between 0 and 1
-    const float random_float = (float)rand() / RAND_MAX;
+// Streams of each row: where its non-zeros fall, and what they hold
+#define COLUMN_STREAM 0
+#define VALUE_STREAM 1
+#define CELL_STREAM 2
+#define SHAPE_STREAM 3  // Per-row shape parameters such as a drawn row length
 
-    // If the random float is less than the sparsity, set a non-zero value
-    if (random_float < sparsity) {
-        // Return int between 1 and 10
-        return (rand() % 10) + 1;
+// Rows handed out at a time while generating, rows of structured patterns vary widely in length
+#define GENERATION_CHUNK 64
+// Fraction of each block that is non-zero in the block-diagonal pattern
+#define BLOCK_FILL 0.5
+// Graph500 R-MAT quadrant probabilities: top-left, top-right, bottom-left, bottom-right
+#define RMAT_A 0.57
+#define RMAT_B 0.19
+#define RMAT_C 0.19
+#define RMAT_D 0.05
+#define RMAT_ATTEMPTS 64
+// Tail exponent of skewed row lengths, heavy but with a finite mean
+#define SKEW_ALPHA 1.5
+
+// Int between 1 and 10
+static int cellValue(uint64_t* state) {
+    return (int)(rng_next(state) % 10) + 1;
+}
+
+int setCellValue(const float sparsity, const unsigned long long seed, const size_t row, const size_t col) {
+    // Each cell gets its own stream, so cells can be drawn from any thread in any order
+    uint64_t state = rng_mix(rng_stream(seed, row, CELL_STREAM) + col * 0x9E3779B97F4A7C15ULL);
+
+    // If the random number is less than the sparsity, set a non-zero value
+    if (rng_unit(&state) < sparsity) {
+        return cellValue(&state);
     } else {
         return 0;
     }
 }
 
 
-int **allocateMatrix(const int rows, const int cols) {
-    int** matrix = (int**) malloc(rows * sizeof(int*));
-    #pragma omp parallel for
-    for (int i = 0; i < rows; i++) {
-        matrix[i] = (int*) malloc(cols * sizeof(int*));
-    }
-  return matrix;
+DenseMatrix* allocateMatrix(const size_t rows, const size_t cols) {
+    // Every element is written by initialiseMatrix, so skip zeroing the buffer
+    return allocate_dense_matrix(rows, cols, 0);
 }
 
 
-void initialiseMatrix(int** matrix, const int rows, const int cols, const float sparsity) {
-    #pragma omp parallel
-    {
-        unsigned int seed = omp_get_thread_num();
-    #pragma omp for
-        for (int i = 0; i < rows; i++) {
-            for (int j = 0; j < cols; j++) {
-                float random_float = (float)rand_r(&seed) / RAND_MAX;
-                if (random_float < sparsity) {
-                    matrix[i][j] = (rand_r(&seed) % 10) + 1;
-                } else {
-                    matrix[i][j] = 0;
+// Column of the next non-zero at or after col, skipping a geometrically distributed gap
+static size_t next_column(uint64_t* state, const size_t col, const double log_zero_prob) {
+    const double gap = floor(log(rng_unit(state)) / log_zero_prob);
+    return gap >= (double)SIZE_MAX - (double)col ? SIZE_MAX : col + (size_t)gap;
+}
+
+void initialiseMatrix(DenseMatrix* matrix, const float sparsity, const unsigned long long seed) {
+    const int all_non_zero = sparsity >= 1.0f;
+    const int all_zero = sparsity <= 0.0f || matrix->cols == 0;
+    const double log_zero_prob = all_non_zero || all_zero ? 0.0 : log1p(-(double)sparsity);
+
+    // Rows replay the streams generateSparseMatrix uses, so both give the same matrix for a seed
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < matrix->rows; i++) {
+        int* row = DENSE_ROW(matrix, i);
+        uint64_t col_state = rng_stream(seed, i, COLUMN_STREAM);
+        uint64_t value_state = rng_stream(seed, i, VALUE_STREAM);
+
+        if (all_non_zero) {
+            for (size_t j = 0; j < matrix->cols; j++) {
+                row[j] = cellValue(&value_state);
+            }
+        } else {
+            memset(row, 0, matrix->cols * sizeof(int));
+            if (!all_zero) {
+                for (size_t j = next_column(&col_state, 0, log_zero_prob); j < matrix->cols; j = next_column(&col_state, j + 1, log_zero_prob)) {
+                    row[j] = cellValue(&value_state);
                 }
             }
         }
     }
 }
 
-void freeMatrix(int** matrix, int rows) {
-    #pragma omp parallel for
-    for (int i = 0; i < rows; i++) {
-        free(matrix[i]);
+void freeMatrix(DenseMatrix* matrix) {
+    free_dense_matrix(matrix);
+}
+
+void printMatrix(const DenseMatrix* matrix) {
+    print_dense_matrix(matrix);
+}
+
+
+// Shape of a pattern, fixed before any row is drawn
+typedef struct {
+    SparsityPattern pattern;
+    size_t rows;
+    size_t cols;
+    float density;
+    unsigned long long seed;
+    size_t band;  // Banded: columns per row
+    size_t blocks;  // Block-diagonal: blocks along the diagonal
+    float block_density;  // Block-diagonal: density inside each block
+    int levels;  // R-MAT: bits of the padded square
+    double rmat_scale;  // R-MAT: expected row length per unit of row probability
+    size_t max_row;  // Upper bound on the columns of any row
+} PatternShape;
+
+static const char* pattern_names[PATTERN_COUNT] = {
+    "uniform", "banded", "block", "rmat", "skewed",
+};
+
+const char* getPatternName(const SparsityPattern pattern) {
+    return pattern >= 0 && pattern < PATTERN_COUNT ? pattern_names[pattern] : "unknown";
+}
+
+int parsePattern(const char* name, SparsityPattern* pattern) {
+    for (int p = 0; p < PATTERN_COUNT; p++) {
+        if (strcmp(name, pattern_names[p]) == 0) {
+            *pattern = (SparsityPattern)p;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Writes the columns of [first, last) that are non-zero, each independently with probability density
+static size_t scatterColumns(uint64_t* state, const size_t first, const size_t last, const float density, int* col_idx) {
+    size_t count = 0;
+    if (density >= 1.0f) {
+        for (size_t j = first; j < last; j++) {
+            col_idx[count++] = (int)j;
+        }
+    } else if (density > 0.0f && first < last) {
+        const double log_zero_prob = log1p(-(double)density);
+        for (size_t j = next_column(state, first, log_zero_prob); j < last; j = next_column(state, j + 1, log_zero_prob)) {
+            col_idx[count++] = (int)j;
+        }
     }
-    free(matrix);
+    return count;
 }
 
-void printMatrix(int** matrix, int rows, int cols) {
-    for (int i = 0; i < rows; i++) {
-        for (int j = 0; j < cols; j++) {
-            printf("%2d ", matrix[i][j]);
+// R-MAT probability of landing in row i, the product over its bits of the top or bottom half's share
+static double rmatRowProbability(const size_t i, const int levels) {
+    double probability = 1.0;
+    for (int l = 0; l < levels; l++) {
+        probability *= (i >> l) & 1 ? RMAT_C + RMAT_D : RMAT_A + RMAT_B;
+    }
+    return probability;
+}
+
+static int compareColumns(const void* a, const void* b) {
+    const int x = *(const int*)a;
+    const int y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+// Row i of an R-MAT matrix: its length follows the row's share of the recursive quadrant split,
+// each column descends the quadrants of that row, and repeated columns are merged
+static size_t rmatRow(const PatternShape* shape, const size_t i, int* col_idx) {
+    uint64_t length_state = rng_stream(shape->seed, i, SHAPE_STREAM);
+    const double expected = shape->rmat_scale * rmatRowProbability(i, shape->levels);
+    double draws = floor(expected);
+    draws += rng_unit(&length_state) <= expected - draws ? 1.0 : 0.0;
+    const size_t count = draws < (double)shape->max_row ? (size_t)draws : shape->max_row;
+
+    uint64_t state = rng_stream(shape->seed, i, COLUMN_STREAM);
+    size_t drawn = 0;
+    for (size_t k = 0; k < count; k++) {
+        // Columns past the end of a non-power-of-two matrix are drawn again, a bounded number of times
+        for (int attempt = 0; attempt < RMAT_ATTEMPTS; attempt++) {
+            size_t col = 0;
+            for (int l = shape->levels - 1; l >= 0; l--) {
+                const double left = (i >> l) & 1 ? RMAT_C / (RMAT_C + RMAT_D) : RMAT_A / (RMAT_A + RMAT_B);
+                col = col << 1 | (rng_unit(&state) > left);
+            }
+            if (col < shape->cols) {
+                col_idx[drawn++] = (int)col;
+                break;
+            }
+        }
+    }
+
+    qsort(col_idx, drawn, sizeof(int), compareColumns);
+    size_t unique = 0;
+    for (size_t k = 0; k < drawn; k++) {
+        if (unique == 0 || col_idx[unique - 1] != col_idx[k]) {
+            col_idx[unique++] = col_idx[k];
         }
-        printf("\n");
     }
+    return unique;
+}
+
+// Writes the sorted columns of row i to col_idx, which has room for shape->max_row, and returns how many
+static size_t patternRow(const PatternShape* shape, const size_t i, int* col_idx) {
+    uint64_t state = rng_stream(shape->seed, i, COLUMN_STREAM);
+    switch (shape->pattern) {
+        case PATTERN_BANDED: {
+            // The band follows the diagonal, scaled to the column count for rectangular matrices,
+            // and is shifted inwards at the edges so every row keeps its full width
+            const size_t centre = (size_t)((double)i * shape->cols / shape->rows);
+            size_t first = centre > shape->band / 2 ? centre - shape->band / 2 : 0;
+            first = first + shape->band > shape->cols ? shape->cols - shape->band : first;
+            return scatterColumns(&state, first, first + shape->band, 1.0f, col_idx);
+        }
+        case PATTERN_BLOCK_DIAGONAL: {
+            const size_t block = i * shape->blocks / shape->rows;
+            return scatterColumns(&state, block * shape->cols / shape->blocks, (block + 1) * shape->cols / shape->blocks,
+                                  shape->block_density, col_idx);
+        }
+        case PATTERN_POWER_LAW:
+            return rmatRow(shape, i, col_idx);
+        case PATTERN_SKEWED: {
+            // Pareto distributed lengths with the requested mean before truncation to the row
+            uint64_t length_state = rng_stream(shape->seed, i, SHAPE_STREAM);
+            const double mean = (double)shape->density * shape->cols;
+            const double length = mean * (SKEW_ALPHA - 1.0) / SKEW_ALPHA * pow(rng_unit(&length_state), -1.0 / SKEW_ALPHA);
+            return scatterColumns(&state, 0, shape->cols, length >= shape->cols ? 1.0f : (float)(length / shape->cols), col_idx);
+        }
+        case PATTERN_UNIFORM:
+        default:
+            return scatterColumns(&state, 0, shape->cols, shape->density, col_idx);
+    }
+}
+
+// Sizes the pattern's parameters from the requested density; -1 if the pattern is unknown
+static int shapePattern(PatternShape* shape) {
+    const double target = (double)shape->density * shape->cols;
+    shape->max_row = shape->cols;
+    switch (shape->pattern) {
+        case PATTERN_UNIFORM:
+        case PATTERN_SKEWED:
+            return 0;
+        case PATTERN_BANDED:
+            shape->band = target >= shape->cols ? shape->cols : (size_t)(target + 0.5);
+            shape->band = shape->band > 0 || shape->density <= 0.0f ? shape->band : 1;
+            return 0;
+        case PATTERN_BLOCK_DIAGONAL: {
+            // As many blocks as keep each one BLOCK_FILL full, at least one row and column per block
+            const double blocks = shape->density > 0.0f ? floor(BLOCK_FILL / shape->density) : 1.0;
+            const size_t limit = shape->rows < shape->cols ? shape->rows : shape->cols;
+            shape->blocks = blocks < 1.0 ? 1 : blocks > (double)limit ? limit : (size_t)blocks;
+            shape->blocks = shape->blocks > 0 ? shape->blocks : 1;
+            shape->block_density = fminf(1.0f, shape->density * (float)shape->blocks);
+            return 0;
+        }
+        case PATTERN_POWER_LAW: {
+            const size_t side = shape->rows > shape->cols ? shape->rows : shape->cols;
+            shape->levels = 0;
+            while (shape->levels < 63 && ((size_t)1 << shape->levels) < side) {
+                shape->levels++;
+            }
+            // Rows past the end of a non-power-of-two matrix take no share, so normalise over the real ones
+            double total = 0.0;
+            #pragma omp parallel for schedule(static) reduction(+:total)
+            for (size_t i = 0; i < shape->rows; i++) {
+                total += rmatRowProbability(i, shape->levels);
+            }
+            shape->rmat_scale = total > 0.0 ? target * shape->rows / total : 0.0;
+            return 0;
+        }
+        default:
+            return -1;
+    }
+}
+
+CompressedMatrix* generatePatternMatrix(const size_t rows, const size_t cols, const float density,
+                                        const SparsityPattern pattern, const unsigned long long seed) {
+    PatternShape shape = {
+        .pattern = pattern,
+        .rows = rows,
+        .cols = cols,
+        .density = density,
+        .seed = seed,
+    };
+    if (shapePattern(&shape) != 0) {
+        fprintf(stderr, "Unknown sparsity pattern %d\n", (int)pattern);
+        return NULL;
+    }
+    CompressedMatrix* compressed = allocate_compressed_matrix(rows, cols);
+    if (!compressed) {
+        return NULL;
+    }
+
+    PROFILE_BEGIN("generate");
+    int failed = 0;
+    #pragma omp parallel
+    {
+        // Rows are drawn into a scratch row, R-MAT rows only know their length once repeats are merged
+        int* scratch = malloc((shape.max_row > 0 ? shape.max_row : 1) * sizeof(int));
+        if (!scratch) {
+            #pragma omp atomic write
+            failed = 1;
+        }
+        #pragma omp barrier
+
+        // First pass: replay each row's streams to count its elements
+        if (!failed) {
+            #pragma omp for schedule(dynamic, GENERATION_CHUNK)
+            for (size_t i = 0; i < rows; i++) {
+                const size_t count = patternRow(&shape, i, scratch);
+                // If there are only zeros in this row, store two 0s
+                compressed->row_ptr[i + 1] = count > 0 ? count : EMPTY_ROW_SIZE;
+            }
+
+            #pragma omp single
+            {
+                const size_t nnz = scan_row_sizes(compressed->row_ptr, rows);
+                failed = allocate_compressed_storage(compressed, nnz) != 0;
+            }
+        }
+
+        // Second pass: replay the same streams and draw values from a separate one
+        if (!failed) {
+            #pragma omp for schedule(dynamic, GENERATION_CHUNK)
+            for (size_t i = 0; i < rows; i++) {
+                int* values = compressed->values + compressed->row_ptr[i];
+                int* col_idx = compressed->col_idx + compressed->row_ptr[i];
+                uint64_t value_state = rng_stream(seed, i, VALUE_STREAM);
+                const size_t count = patternRow(&shape, i, scratch);
+
+                for (size_t k = 0; k < count; k++) {
+                    values[k] = cellValue(&value_state);
+                    col_idx[k] = scratch[k];
+                }
+                if (count == 0) {
+                    store_empty_row(values, col_idx);
+                }
+            }
+        }
+        free(scratch);
+    }
+
+    PROFILE_END("generate");
+    if (failed) {
+        fprintf(stderr, "Failed to allocate memory for generation\n");
+        free_compressed_matrix(compressed);
+        return NULL;
+    }
+    return compressed;
+}
+
+CompressedMatrix* generateSparseMatrix(const size_t rows, const size_t cols, const float density, const unsigned long long seed) {
+    return generatePatternMatrix(rows, cols, density, PATTERN_UNIFORM, seed);
 }
@@ -0,0 +1,691 @@
+#include "matrix_io.h"
+#include "instrumentation.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+#include <ctype.h>
+#include <omp.h>
+
+#define BYTE_ORDER_MARK 0x01020304u
+
+static uint64_t align_up(const uint64_t offset) {
+    return (offset + COMPRESSED_FILE_ALIGNMENT - 1) / COMPRESSED_FILE_ALIGNMENT * COMPRESSED_FILE_ALIGNMENT;
+}
+
+void build_compressed_file_header(const size_t rows, const size_t cols, const size_t nnz, CompressedFileHeader* header) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, COMPRESSED_FILE_MAGIC, sizeof(header->magic));
+    header->version = COMPRESSED_FILE_VERSION;
+    header->byte_order = BYTE_ORDER_MARK;
+    header->offset_size = sizeof(size_t);
+    header->index_size = sizeof(int);
+    header->value_size = sizeof(int);
+    header->num_rows = rows;
+    header->num_cols = cols;
+    header->nnz = nnz;
+    header->row_ptr_offset = align_up(sizeof(CompressedFileHeader));
+    header->col_idx_offset = align_up(header->row_ptr_offset + (rows + 1) * sizeof(size_t));
+    header->values_offset = align_up(header->col_idx_offset + nnz * sizeof(int));
+}
+
+// Writes one array at its offset, zero-padding the gap after the current position
+static int write_section(FILE* file, const uint64_t offset, const void* data, const size_t bytes) {
+    static const char padding[COMPRESSED_FILE_ALIGNMENT] = {0};
+    long position = ftell(file);
+    if (position < 0 || (uint64_t)position > offset) {
+        return -1;
+    }
+    const size_t gap = offset - (uint64_t)position;
+    if (gap > 0 && fwrite(padding, 1, gap, file) != gap) {
+        return -1;
+    }
+    return bytes == 0 || fwrite(data, 1, bytes, file) == bytes ? 0 : -1;
+}
+
+int write_compressed_matrix_binary(const CompressedMatrix* compressed, const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Error opening %s for writing: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    PROFILE_BEGIN("write_binary");
+    CompressedFileHeader header;
+    build_compressed_file_header(compressed->num_rows, compressed->num_cols, compressed->nnz, &header);
+
+    int status = write_section(file, 0, &header, sizeof(header));
+    if (status == 0) status = write_section(file, header.row_ptr_offset, compressed->row_ptr, (compressed->num_rows + 1) * sizeof(size_t));
+    if (status == 0) status = write_section(file, header.col_idx_offset, compressed->col_idx, compressed->nnz * sizeof(int));
+    if (status == 0) status = write_section(file, header.values_offset, compressed->values, compressed->nnz * sizeof(int));
+
+    if (fclose(file) != 0) {
+        status = -1;
+    }
+    PROFILE_END("write_binary");
+    if (status != 0) {
+        fprintf(stderr, "Error writing compressed matrix to %s\n", path);
+    }
+    return status;
+}
+
+// Whether count elements of size bytes starting at offset end within file_size, without overflowing
+static int section_fits(const uint64_t offset, const uint64_t count, const uint64_t size, const uint64_t file_size) {
+    return count <= UINT64_MAX / size && offset <= file_size && count * size <= file_size - offset;
+}
+
+// Checks that a header describes arrays this build can use in place and that fit in file_size
+static int validate_header(const CompressedFileHeader* header, const uint64_t file_size, const char* path) {
+    if (memcmp(header->magic, COMPRESSED_FILE_MAGIC, sizeof(header->magic)) != 0) {
+        fprintf(stderr, "Error: %s is not a compressed matrix file\n", path);
+        return -1;
+    }
+    if (header->version != COMPRESSED_FILE_VERSION) {
+        fprintf(stderr, "Error: %s has unsupported version %u\n", path, header->version);
+        return -1;
+    }
+    if (header->byte_order != BYTE_ORDER_MARK || header->offset_size != sizeof(size_t)
+        || header->index_size != sizeof(int) || header->value_size != sizeof(int)) {
+        fprintf(stderr, "Error: %s was written with a different byte order or type sizes\n", path);
+        return -1;
+    }
+    if (header->row_ptr_offset % COMPRESSED_FILE_ALIGNMENT || header->col_idx_offset % COMPRESSED_FILE_ALIGNMENT
+        || header->values_offset % COMPRESSED_FILE_ALIGNMENT
+        || header->num_rows == UINT64_MAX || header->num_rows > SIZE_MAX || header->num_cols > SIZE_MAX
+        || !section_fits(header->row_ptr_offset, header->num_rows + 1, sizeof(size_t), file_size)
+        || !section_fits(header->col_idx_offset, header->nnz, sizeof(int), file_size)
+        || !section_fits(header->values_offset, header->nnz, sizeof(int), file_size)) {
+        fprintf(stderr, "Error: %s is truncated or has a corrupt layout\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+// Checks that the arrays of a mapped file form valid CSR, so no kernel indexes past them:
+// row offsets start at 0, never decrease and end at nnz, and every column lies inside the matrix
+static int validate_contents(const CompressedMatrix* compressed, const char* path) {
+    const size_t* row_ptr = compressed->row_ptr;
+    const size_t rows = compressed->num_rows;
+    int bad = row_ptr[0] != 0 || row_ptr[rows] != compressed->nnz;
+
+    #pragma omp parallel for schedule(static) reduction(||:bad)
+    for (size_t i = 0; i < rows; i++) {
+        bad = bad || row_ptr[i] > row_ptr[i + 1];
+    }
+    // Empty rows of a matrix without columns still store their column 0
+    const size_t cols = compressed->num_cols > 0 ? compressed->num_cols : 1;
+    #pragma omp parallel for schedule(static) reduction(||:bad)
+    for (size_t k = 0; k < compressed->nnz; k++) {
+        bad = bad || compressed->col_idx[k] < 0 || (size_t)compressed->col_idx[k] >= cols;
+    }
+
+    if (bad) {
+        fprintf(stderr, "Error: %s has corrupt row offsets or column indices\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+int read_compressed_file_header(const char* path, CompressedFileHeader* header) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Error opening %s for reading: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    int status = fstat(fileno(file), &st) == 0 && fread(header, sizeof(*header), 1, file) == 1 ? 0 : -1;
+    fclose(file);
+    if (status != 0) {
+        fprintf(stderr, "Error reading compressed matrix header from %s\n", path);
+        return -1;
+    }
+    return validate_header(header, (uint64_t)st.st_size, path);
+}
+
+CompressedMatrix* map_compressed_matrix(const char* path) {
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error opening %s for reading: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(CompressedFileHeader)) {
+        fprintf(stderr, "Error: %s is too small to be a compressed matrix file\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    // Private writable mapping: pages are shared with the page cache until something writes to them
+    const size_t size = (size_t)st.st_size;
+    void* mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Error mapping %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+
+    const CompressedFileHeader* header = mapping;
+    CompressedMatrix* compressed = malloc(sizeof(CompressedMatrix));
+    if (validate_header(header, size, path) != 0 || compressed == NULL) {
+        free(compressed);
+        munmap(mapping, size);
+        return NULL;
+    }
+    madvise(mapping, size, MADV_WILLNEED);
+
+    char* base = mapping;
+    compressed->num_rows = header->num_rows;
+    compressed->num_cols = header->num_cols;
+    compressed->nnz = header->nnz;
+    compressed->row_ptr = (size_t*)(base + header->row_ptr_offset);
+    compressed->col_idx = (int*)(base + header->col_idx_offset);
+    compressed->values = (int*)(base + header->values_offset);
+    compressed->mapping = mapping;
+    compressed->mapping_size = size;
+    if (validate_contents(compressed, path) != 0) {
+        free_compressed_matrix(compressed);
+        return NULL;
+    }
+    return compressed;
+}
+
+
+typedef enum { MARKET_INTEGER, MARKET_REAL, MARKET_PATTERN } MarketField;
+typedef enum { MARKET_GENERAL, MARKET_SYMMETRIC, MARKET_SKEW_SYMMETRIC } MarketSymmetry;
+
+// Entries parsed from one byte range of the body, zero-based
+typedef struct {
+    size_t* rows;
+    int* cols;
+    int* values;
+    size_t count;
+    size_t lines;  // Entry lines read, before symmetric expansion
+} MarketChunk;
+
+// Bodies smaller than this are parsed by a single thread
+#define MARKET_MIN_CHUNK_BYTES ((size_t)1 << 20)
+// Rows written per round when exporting, bounding the text held in memory
+#define MARKET_WRITE_ROWS 65536
+
+static const char* skip_blanks(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    return p;
+}
+
+static const char* next_line(const char* p, const char* end) {
+    const char* newline = memchr(p, '\n', (size_t)(end - p));
+    return newline ? newline + 1 : end;
+}
+
+static int parse_index(const char** cursor, const char* end, size_t* out) {
+    const char* p = skip_blanks(*cursor, end);
+    if (p == end || !isdigit((unsigned char)*p)) return -1;
+    size_t value = 0;
+    while (p < end && isdigit((unsigned char)*p)) {
+        const size_t digit = (size_t)(*p - '0');
+        // An index that does not fit is out of range, not a wrapped-around small one
+        if (value > (SIZE_MAX - digit) / 10) return -1;
+        value = value * 10 + digit;
+        p++;
+    }
+    *out = value;
+    *cursor = p;
+    return 0;
+}
+
+// Reads one value; reals are copied out first because the mapping is not NUL-terminated
+static int parse_value(const char** cursor, const char* end, const MarketField field, int* out) {
+    if (field == MARKET_PATTERN) {
+        *out = 1;
+        return 0;
+    }
+
+    const char* p = skip_blanks(*cursor, end);
+    char token[64];
+    size_t length = 0;
+    while (p < end && length < sizeof(token) - 1 && !isspace((unsigned char)*p)) {
+        token[length++] = *p++;
+    }
+    if (length == 0) return -1;
+    token[length] = '\0';
+
+    char* token_end;
+    if (field == MARKET_INTEGER) {
+        const long value = strtol(token, &token_end, 10);
+        if (*token_end != '\0' || value < INT_MIN || value > INT_MAX) return -1;
+        *out = (int)value;
+    } else {
+        const double value = strtod(token, &token_end);
+        if (*token_end != '\0' || !(fabs(value) <= INT_MAX)) return -1;
+        *out = (int)lround(value);
+    }
+    *cursor = p;
+    return 0;
+}
+
+// Moves a raw split point to the start of the next line so no line is cut in two
+static const char* align_to_line(const char* split, const char* begin, const char* end) {
+    if (split <= begin || split[-1] == '\n') return split;
+    return next_line(split, end);
+}
+
+static int parse_market_banner(const char* line, const char* end, MarketField* field, MarketSymmetry* symmetry) {
+    char words[5][32];
+    int count = 0;
+    const char* p = line;
+    while (count < 5) {
+        p = skip_blanks(p, end);
+        if (p == end || *p == '\n') break;
+        size_t length = 0;
+        while (p < end && !isspace((unsigned char)*p)) {
+            if (length < sizeof(words[0]) - 1) words[count][length++] = (char)tolower((unsigned char)*p);
+            p++;
+        }
+        words[count++][length] = '\0';
+    }
+
+    if (count < 5 || strcmp(words[0], "%%matrixmarket") != 0 || strcmp(words[1], "matrix") != 0) return -1;
+    if (strcmp(words[2], "coordinate") != 0) {
+        fprintf(stderr, "Error: only coordinate Matrix Market files are supported\n");
+        return -1;
+    }
+
+    if (strcmp(words[3], "integer") == 0) *field = MARKET_INTEGER;
+    else if (strcmp(words[3], "real") == 0 || strcmp(words[3], "double") == 0) *field = MARKET_REAL;
+    else if (strcmp(words[3], "pattern") == 0) *field = MARKET_PATTERN;
+    else {
+        fprintf(stderr, "Error: unsupported Matrix Market field %s\n", words[3]);
+        return -1;
+    }
+
+    if (strcmp(words[4], "general") == 0) *symmetry = MARKET_GENERAL;
+    else if (strcmp(words[4], "symmetric") == 0) *symmetry = MARKET_SYMMETRIC;
+    else if (strcmp(words[4], "skew-symmetric") == 0) *symmetry = MARKET_SKEW_SYMMETRIC;
+    else {
+        fprintf(stderr, "Error: unsupported Matrix Market symmetry %s\n", words[4]);
+        return -1;
+    }
+    return 0;
+}
+
+// Parses every entry line in [begin, end), mirroring off-diagonal entries of symmetric files
+static int parse_market_chunk(const char* begin, const char* end, const MarketField field, const MarketSymmetry symmetry,
+                              const size_t rows, const size_t cols, MarketChunk* chunk) {
+    size_t lines = 1;
+    for (const char* p = begin; (p = memchr(p, '\n', (size_t)(end - p))) != NULL; p++) {
+        lines++;
+    }
+    const size_t capacity = symmetry == MARKET_GENERAL ? lines : 2 * lines;
+    chunk->rows = malloc(capacity * sizeof(size_t));
+    chunk->cols = malloc(capacity * sizeof(int));
+    chunk->values = malloc(capacity * sizeof(int));
+    chunk->count = 0;
+    chunk->lines = 0;
+    if (!chunk->rows || !chunk->cols || !chunk->values) return -1;
+
+    for (const char* line = begin; line < end; line = next_line(line, end)) {
+        const char* p = skip_blanks(line, end);
+        if (p == end || *p == '\n' || *p == '%') continue;
+
+        size_t row, col;
+        int value;
+        if (parse_index(&p, end, &row) != 0 || parse_index(&p, end, &col) != 0
+            || parse_value(&p, end, field, &value) != 0
+            || row == 0 || row > rows || col == 0 || col > cols) {
+            return -1;
+        }
+
+        chunk->lines++;
+        chunk->rows[chunk->count] = row - 1;
+        chunk->cols[chunk->count] = (int)(col - 1);
+        chunk->values[chunk->count++] = value;
+        if (symmetry != MARKET_GENERAL && row != col) {
+            chunk->rows[chunk->count] = col - 1;
+            chunk->cols[chunk->count] = (int)(row - 1);
+            chunk->values[chunk->count++] = symmetry == MARKET_SKEW_SYMMETRIC ? -value : value;
+        }
+    }
+    return 0;
+}
+
+static int compare_packed_entries(const void* a, const void* b) {
+    const uint64_t x = *(const uint64_t*)a;
+    const uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Sorts row i by column, packing (column, value) pairs into one key so they move together
+static int sort_row(CompressedMatrix* compressed, const size_t i, uint64_t** buffer, size_t* capacity) {
+    const size_t start = compressed->row_ptr[i];
+    const size_t length = ROW_SIZE(compressed, i);
+    if (length < 2) return 0;
+
+    if (length > *capacity) {
+        uint64_t* grown = realloc(*buffer, length * sizeof(uint64_t));
+        if (!grown) return -1;
+        *buffer = grown;
+        *capacity = length;
+    }
+    for (size_t k = 0; k < length; k++) {
+        (*buffer)[k] = (uint64_t)(uint32_t)compressed->col_idx[start + k] << 32 | (uint32_t)compressed->values[start + k];
+    }
+    qsort(*buffer, length, sizeof(uint64_t), compare_packed_entries);
+    for (size_t k = 0; k < length; k++) {
+        compressed->col_idx[start + k] = (int)((*buffer)[k] >> 32);
+        compressed->values[start + k] = (int)(uint32_t)(*buffer)[k];
+    }
+    return 0;
+}
+
+// Sums entries of a sorted row that share a column and drops those that come to zero, explicit zeros
+// included, leaving the remaining entries at the front of the row. Returns how many remain.
+static size_t merge_row(CompressedMatrix* compressed, const size_t i) {
+    int* cols = compressed->col_idx + compressed->row_ptr[i];
+    int* values = compressed->values + compressed->row_ptr[i];
+    const size_t length = ROW_SIZE(compressed, i);
+    size_t kept = 0;
+    for (size_t k = 0; k < length;) {
+        const int col = cols[k];
+        long long sum = 0;
+        for (; k < length && cols[k] == col; k++) {
+            sum += values[k];
+        }
+        if (sum != 0) {
+            cols[kept] = col;
+            values[kept++] = (int)sum;
+        }
+    }
+    return kept;
+}
+
+// Groups the parsed chunks into rows: count per row, scan, scatter through per-row cursors, sort and
+// merge duplicates, then copy the merged rows into a matrix sized for them
+static CompressedMatrix* assemble_market_chunks(MarketChunk* chunks, const int num_chunks, const size_t rows, const size_t cols) {
+    CompressedMatrix* staged = allocate_compressed_matrix(rows, cols);
+    size_t* cursor = malloc((rows + 1) * sizeof(size_t));
+    if (!staged || !cursor) {
+        free(cursor);
+        free_compressed_matrix(staged);
+        return NULL;
+    }
+    size_t* row_ptr = staged->row_ptr;
+
+    #pragma omp parallel for schedule(static, 1)
+    for (int c = 0; c < num_chunks; c++) {
+        for (size_t e = 0; e < chunks[c].count; e++) {
+            #pragma omp atomic
+            row_ptr[chunks[c].rows[e] + 1]++;
+        }
+    }
+    const size_t staged_nnz = scan_row_sizes(row_ptr, rows);
+    if (allocate_compressed_storage(staged, staged_nnz) != 0) {
+        free(cursor);
+        free_compressed_matrix(staged);
+        return NULL;
+    }
+    memcpy(cursor, row_ptr, (rows + 1) * sizeof(size_t));
+
+    #pragma omp parallel for schedule(static, 1)
+    for (int c = 0; c < num_chunks; c++) {
+        for (size_t e = 0; e < chunks[c].count; e++) {
+            size_t pos;
+            #pragma omp atomic capture
+            pos = cursor[chunks[c].rows[e]]++;
+            staged->col_idx[pos] = chunks[c].cols[e];
+            staged->values[pos] = chunks[c].values[e];
+        }
+    }
+
+    // cursor is reused for the merged length of each row
+    int failed = 0;
+    #pragma omp parallel reduction(|:failed)
+    {
+        uint64_t* buffer = NULL;
+        size_t capacity = 0;
+
+        #pragma omp for schedule(dynamic, 256)
+        for (size_t i = 0; i < rows; i++) {
+            if (sort_row(staged, i, &buffer, &capacity) != 0) {
+                failed = 1;
+                cursor[i] = 0;
+            } else {
+                cursor[i] = merge_row(staged, i);
+            }
+        }
+        free(buffer);
+    }
+
+    CompressedMatrix* compressed = failed ? NULL : allocate_compressed_matrix(rows, cols);
+    if (failed) {
+        fprintf(stderr, "Error: Failed to allocate row sort buffer\n");
+    }
+    if (compressed) {
+        // Rows with no entries left are padded with two 0s
+        #pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < rows; i++) {
+            compressed->row_ptr[i + 1] = cursor[i] > 0 ? cursor[i] : EMPTY_ROW_SIZE;
+        }
+        if (allocate_compressed_storage(compressed, scan_row_sizes(compressed->row_ptr, rows)) != 0) {
+            free_compressed_matrix(compressed);
+            compressed = NULL;
+        }
+    }
+    if (compressed) {
+        #pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < rows; i++) {
+            const size_t to = compressed->row_ptr[i];
+            if (cursor[i] == 0) {
+                store_empty_row(compressed->values + to, compressed->col_idx + to);
+            } else {
+                memcpy(compressed->col_idx + to, staged->col_idx + row_ptr[i], cursor[i] * sizeof(int));
+                memcpy(compressed->values + to, staged->values + row_ptr[i], cursor[i] * sizeof(int));
+            }
+        }
+    }
+
+    free(cursor);
+    free_compressed_matrix(staged);
+    return compressed;
+}
+
+CompressedMatrix* read_matrix_market(const char* path) {
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error opening %s for reading: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        fprintf(stderr, "Error: %s is empty or cannot be inspected\n", path);
+        close(fd);
+        return NULL;
+    }
+    const size_t size = (size_t)st.st_size;
+    void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Error mapping %s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    madvise(mapping, size, MADV_SEQUENTIAL);
+
+    const char* data = mapping;
+    const char* end = data + size;
+    MarketField field;
+    MarketSymmetry symmetry;
+    if (parse_market_banner(data, end, &field, &symmetry) != 0) {
+        fprintf(stderr, "Error: %s has no valid Matrix Market banner\n", path);
+        munmap(mapping, size);
+        return NULL;
+    }
+
+    // Skip comments and blank lines to the size line
+    const char* p = next_line(data, end);
+    while (p < end) {
+        const char* first = skip_blanks(p, end);
+        if (first < end && *first != '%' && *first != '\n') break;
+        p = next_line(p, end);
+    }
+    size_t rows, cols, entries;
+    if (parse_index(&p, end, &rows) != 0 || parse_index(&p, end, &cols) != 0
+        || parse_index(&p, end, &entries) != 0 || cols > INT_MAX) {
+        fprintf(stderr, "Error: %s has an invalid size line\n", path);
+        munmap(mapping, size);
+        return NULL;
+    }
+    const char* body = next_line(p, end);
+
+    // One byte range per thread, each starting on a line boundary
+    const size_t body_size = (size_t)(end - body);
+    int num_chunks = omp_get_max_threads();
+    if (body_size < MARKET_MIN_CHUNK_BYTES * (size_t)num_chunks) {
+        num_chunks = (int)(body_size / MARKET_MIN_CHUNK_BYTES) + 1;
+    }
+    MarketChunk* chunks = calloc((size_t)num_chunks, sizeof(MarketChunk));
+    if (!chunks) {
+        munmap(mapping, size);
+        return NULL;
+    }
+
+    int failed = 0;
+    PROFILE_BEGIN("market_parse");
+    #pragma omp parallel for schedule(static, 1) reduction(|:failed)
+    for (int c = 0; c < num_chunks; c++) {
+        const char* begin = align_to_line(body + body_size * c / num_chunks, body, end);
+        const char* stop = align_to_line(body + body_size * (c + 1) / num_chunks, body, end);
+        failed |= parse_market_chunk(begin, stop, field, symmetry, rows, cols, &chunks[c]) != 0;
+    }
+    PROFILE_END("market_parse");
+
+    size_t stored = 0;
+    for (int c = 0; c < num_chunks; c++) {
+        stored += chunks[c].lines;
+    }
+
+    CompressedMatrix* compressed = NULL;
+    if (failed) {
+        fprintf(stderr, "Error: %s has a malformed or out of range entry\n", path);
+    } else {
+        if (stored != entries) {
+            fprintf(stderr, "Warning: %s declares %zu entries but contains %zu\n", path, entries, stored);
+        }
+        PROFILE_BEGIN("market_assemble");
+        compressed = assemble_market_chunks(chunks, num_chunks, rows, cols);
+        PROFILE_END("market_assemble");
+    }
+
+    for (int c = 0; c < num_chunks; c++) {
+        free(chunks[c].rows);
+        free(chunks[c].cols);
+        free(chunks[c].values);
+    }
+    free(chunks);
+    munmap(mapping, size);
+    return compressed;
+}
+
+// Appends the decimal form of value, returns the new end of the text
+static char* append_number(char* out, long long value) {
+    char digits[24];
+    int length = 0;
+    unsigned long long magnitude = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+    do {
+        digits[length++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+    if (value < 0) *out++ = '-';
+    while (length > 0) *out++ = digits[--length];
+    return out;
+}
+
+int write_matrix_market(const CompressedMatrix* compressed, const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Error opening %s for writing: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    PROFILE_BEGIN("write_market");
+
+    // Padding zeros of empty rows are not entries of the matrix
+    size_t entries = 0;
+    #pragma omp parallel for reduction(+:entries) schedule(static)
+    for (size_t k = 0; k < compressed->nnz; k++) {
+        entries += compressed->values[k] != 0;
+    }
+    fprintf(file, "%%%%MatrixMarket matrix coordinate integer general\n");
+    fprintf(file, "%zu %zu %zu\n", compressed->num_rows, compressed->num_cols, entries);
+
+    // Threads format consecutive row ranges into their own buffers, written back in order
+    const int num_threads = omp_get_max_threads();
+    char** buffers = calloc((size_t)num_threads, sizeof(char*));
+    size_t* lengths = calloc((size_t)num_threads, sizeof(size_t));
+    int status = buffers && lengths ? 0 : -1;
+
+    for (size_t block = 0; status == 0 && block < compressed->num_rows; block += MARKET_WRITE_ROWS) {
+        const size_t block_end = block + MARKET_WRITE_ROWS < compressed->num_rows ? block + MARKET_WRITE_ROWS : compressed->num_rows;
+        // The team may be smaller than num_threads, buffers it leaves untouched must not be written again
+        memset(lengths, 0, (size_t)num_threads * sizeof(size_t));
+
+        #pragma omp parallel num_threads(num_threads)
+        {
+            const int tid = omp_get_thread_num();
+            const int nt = omp_get_num_threads();
+            const size_t begin = block + (block_end - block) * tid / nt;
+            const size_t end = block + (block_end - block) * (tid + 1) / nt;
+
+            // Three numbers of at most 20 digits, separators and a newline per entry
+            const size_t bytes = (compressed->row_ptr[end] - compressed->row_ptr[begin]) * 66 + 1;
+            char* text = realloc(buffers[tid], bytes);
+            if (text == NULL) {
+                #pragma omp atomic write
+                status = -1;
+                lengths[tid] = 0;
+            } else {
+                buffers[tid] = text;
+                char* out = text;
+                for (size_t i = begin; i < end; i++) {
+                    for (size_t k = compressed->row_ptr[i]; k < compressed->row_ptr[i + 1]; k++) {
+                        if (compressed->values[k] == 0) continue;
+                        out = append_number(out, (long long)i + 1);
+                        *out++ = ' ';
+                        out = append_number(out, (long long)compressed->col_idx[k] + 1);
+                        *out++ = ' ';
+                        out = append_number(out, compressed->values[k]);
+                        *out++ = '\n';
+                    }
+                }
+                lengths[tid] = (size_t)(out - text);
+            }
+        }
+
+        for (int t = 0; status == 0 && t < num_threads; t++) {
+            if (lengths[t] > 0 && fwrite(buffers[t], 1, lengths[t], file) != lengths[t]) {
+                status = -1;
+            }
+        }
+    }
+
+    if (buffers) {
+        for (int t = 0; t < num_threads; t++) free(buffers[t]);
+    }
+    free(buffers);
+    free(lengths);
+    if (fclose(file) != 0) {
+        status = -1;
+    }
+    PROFILE_END("write_market");
+    if (status != 0) {
+        fprintf(stderr, "Error writing Matrix Market file %s\n", path);
+    }
+    return status;
+}
@@ -1,202 +1,1350 @@
-#include <mpi.h>
 #include "matrix_multiplication.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include "timing.h"
+#include "instrumentation.h"
+#include "partition.h"
+#include "work_stealing.h"
+#include "simd_kernels.h"
+#include "arena.h"
 #include <omp.h>
+#include <stdint.h>
+#include <unistd.h>
+
+static ScheduleType omp_schedule_type = SCHEDULE_DYNAMIC;
+static int omp_chunk_size = 0;
+static MultiplicationKernel product_kernel = KERNEL_MARKER;
+static int sort_product_columns = 0;
+static size_t tile_panel_cols = TILE_NONE;
+static size_t last_panel_cols = 0;
+// Width auto-tuning settled on for the last pair of inputs, so repeated products tune once. Inputs are
+// recognised by address and shape, a new pair at the old addresses with the same shape reuses the width.
+static struct {
+    const CompressedMatrix* A;
+    const CompressedMatrix* B;
+    size_t a_nnz;
+    size_t b_nnz;
+    size_t a_rows;
+    size_t a_cols;
+    size_t b_cols;
+    size_t panel_cols;
+} tuned_tile = {NULL, NULL, 0, 0, 0, 0, 0, 0};
+
+void set_multiplication_schedule(ScheduleType schedule_type, int chunk_size) {
+    omp_schedule_type = schedule_type;
+    omp_chunk_size = chunk_size > 0 ? chunk_size : 0;
+}
+
+const char* get_schedule_name(ScheduleType schedule_type) {
+    switch (schedule_type) {
+        case SCHEDULE_STATIC: return "static";
+        case SCHEDULE_DYNAMIC: return "dynamic";
+        case SCHEDULE_GUIDED: return "guided";
+        case SCHEDULE_AUTO: return "auto";
+        case SCHEDULE_BALANCED: return "balanced";
+        case SCHEDULE_WORK_STEALING: return "stealing";
+        default: return "unknown";
+    }
+}
+
+void set_multiplication_kernel(MultiplicationKernel kernel, int sort_columns) {
+    product_kernel = kernel;
+    sort_product_columns = sort_columns;
+}
+
+void set_multiplication_tiling(size_t panel_cols) {
+    tile_panel_cols = panel_cols;
+    tuned_tile.A = NULL;
+    tuned_tile.B = NULL;
+}
+
+size_t get_last_panel_cols(void) {
+    return last_panel_cols;
+}
+
+const char* get_kernel_name(MultiplicationKernel kernel) {
+    switch (kernel) {
+        case KERNEL_MARKER: return "marker";
+        case KERNEL_GUSTAVSON: return "gustavson";
+        case KERNEL_HASH: return "hash";
+        case KERNEL_AUTO: return "auto";
+        default: return "unknown";
+    }
+}
+
+// Loops over rows use schedule(runtime), so load the selected schedule into OpenMP before each one
+static void apply_omp_schedule(void) {
+    switch (omp_schedule_type) {
+        case SCHEDULE_STATIC: omp_set_schedule(omp_sched_static, omp_chunk_size); break;
+        case SCHEDULE_GUIDED: omp_set_schedule(omp_sched_guided, omp_chunk_size); break;
+        case SCHEDULE_AUTO: omp_set_schedule(omp_sched_auto, omp_chunk_size); break;
+        default: omp_set_schedule(omp_sched_dynamic, omp_chunk_size); break;
+    }
+}
+
+// Rows of the balanced and work-stealing schedules; costs stays NULL for OpenMP's own schedules
+typedef struct {
+    const size_t* costs;
+    WorkQueue* queue;
+    size_t* estimate;  // costs when they were estimated for this schedule, freed with it
+} RowSchedule;
+
+// Deals rows by the prefix sums costs for the schedules that need them, falling back to the runtime
+// schedule if costs is NULL or the queue cannot be allocated. estimate is freed with the schedule.
+static void prepare_schedule_from_costs(RowSchedule* schedule, const size_t rows, const size_t* costs, size_t* estimate, const int threads) {
+    schedule->costs = costs;
+    schedule->queue = NULL;
+    schedule->estimate = estimate;
+    if (costs && omp_schedule_type == SCHEDULE_WORK_STEALING) {
+        // The chunk size doubles as the grain of stolen blocks
+        schedule->queue = create_work_queue(rows, (size_t)omp_chunk_size, threads, costs);
+        if (!schedule->queue) {
+            schedule->costs = NULL;
+        }
+    }
+}
+
+static int schedule_needs_costs(void) {
+    return omp_schedule_type == SCHEDULE_WORK_STEALING || omp_schedule_type == SCHEDULE_BALANCED;
+}
+
+// Estimates row costs of A * B for the schedules that need them
+static void prepare_row_schedule(RowSchedule* schedule, const CompressedMatrix* A, const CompressedMatrix* B, const int threads) {
+    size_t* costs = schedule_needs_costs() ? estimate_row_costs(A, B) : NULL;
+    prepare_schedule_from_costs(schedule, A->num_rows, costs, costs, threads);
+}
+
+static void free_row_schedule(RowSchedule* schedule) {
+    free_work_queue(schedule->queue);
+    matrix_free(schedule->estimate);
+}
+
+// Next rows [begin, end) of the calling thread: a block from the work queue, or on the first call
+// its one balanced range
+static int next_rows(const RowSchedule* schedule, const size_t rows, int* first, size_t* begin, size_t* end) {
+    if (schedule->queue) {
+        return next_row_block(schedule->queue, omp_get_thread_num(), begin, end);
+    }
+    if (!*first) {
+        return 0;
+    }
+    *first = 0;
+    partition_range(schedule->costs, rows, omp_get_thread_num(), omp_get_num_threads(), begin, end);
+    return 1;
+}
+
+// Rows [begin, end) the calling thread is first dealt: its balanced range, or its block of an even split
+// as schedule(static) makes it. Dynamic schedules have no fixed owner and are placed like static ones.
+static void owned_rows(const RowSchedule* schedule, const size_t rows, size_t* begin, size_t* end) {
+    const size_t thread = (size_t)omp_get_thread_num();
+    const size_t threads = (size_t)omp_get_num_threads();
+    if (schedule->costs) {
+        partition_range(schedule->costs, rows, (int)thread, (int)threads, begin, end);
+        return;
+    }
+    const size_t share = rows / threads;
+    const size_t extra = rows % threads;
+    *begin = thread * share + (thread < extra ? thread : extra);
+    *end = *begin + share + (thread < extra);
+}
+
+// Zeroes the heap rows of result with the threads the schedule deals them to, so on NUMA machines each
+// row's pages are placed on the node of the thread that accumulates into them. Mapped buffers are
+// already zero and first touched by the kernel itself.
+static void first_touch_rows(DenseMatrix* result, const RowSchedule* schedule, const int parallel) {
+    if (result->mapped) {
+        return;
+    }
+    #pragma omp parallel if(parallel)
+    {
+        size_t begin, end;
+        owned_rows(schedule, result->rows, &begin, &end);
+        for (size_t i = begin; i < end; i++) {
+            memset(DENSE_ROW(result, i), 0, result->stride * sizeof(int));
+        }
+    }
+}
+
+// Accumulates row i of A * B into out_row, which the calling thread owns exclusively
+static void multiply_row_dense(const CompressedMatrix* A, const CompressedMatrix* B, const size_t i, int* out_row) {
+    for (size_t k = A->row_ptr[i]; k < A->row_ptr[i + 1]; k++) {
+        const int a_val = A->values[k];
+        const size_t a_col = A->col_idx[k];
+        PROFILE_COUNT(PROFILE_MULTIPLY_ADDS, B->row_ptr[a_col + 1] - B->row_ptr[a_col]);
+        for (size_t j = B->row_ptr[a_col]; j < B->row_ptr[a_col + 1]; j++) {
+            out_row[B->col_idx[j]] += a_val * B->values[j];
+        }
+    }
+}
+
+// Tiled products keep half of L2 for the panel's B elements and one output slice per thread,
+// the rest is left to the stream of A
+#define TILE_DEFAULT_L2_BYTES ((size_t)1 << 20)
+#define TILE_ALIGN 16  // Panel widths are whole cache lines of output
+// Auto-tuning times candidate widths on every TILE_SAMPLE_STRIDE-th row of A, at least TILE_SAMPLE_MIN rows
+#define TILE_SAMPLE_STRIDE 64
+#define TILE_SAMPLE_MIN 256
+
+
+static size_t l2_cache_bytes(void) {
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    const long bytes = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (bytes > 0) {
+        return (size_t)bytes;
+    }
+#endif
+    return TILE_DEFAULT_L2_BYTES;
+}
+
+static int compare_entries(const void* a, const void* b) {
+    const uint64_t x = *(const uint64_t*)a;
+    const uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Returns B if its rows are sorted by column, otherwise a copy with sorted rows; NULL on failure
+static const CompressedMatrix* sorted_rows(const CompressedMatrix* B) {
+    int sorted = 1;
+    #pragma omp parallel for schedule(static) reduction(&&:sorted)
+    for (size_t r = 0; r < B->num_rows; r++) {
+        for (size_t j = B->row_ptr[r] + 1; j < B->row_ptr[r + 1]; j++) {
+            sorted = sorted && B->col_idx[j - 1] <= B->col_idx[j];
+        }
+    }
+    if (sorted) {
+        return B;
+    }
+
+    CompressedMatrix* copy = allocate_compressed_matrix(B->num_rows, B->num_cols);
+    if (!copy || allocate_compressed_storage(copy, B->nnz) != 0) {
+        free_compressed_matrix(copy);
+        return NULL;
+    }
+    memcpy(copy->row_ptr, B->row_ptr, (B->num_rows + 1) * sizeof(size_t));
+
+    // Column in the high half and value in the low half, so sorting the packed entries sorts by column
+    int failed = 0;
+    #pragma omp parallel
+    {
+        size_t capacity = 0;
+        uint64_t* entries = NULL;
+        #pragma omp for schedule(dynamic, 64)
+        for (size_t r = 0; r < B->num_rows; r++) {
+            const size_t count = ROW_SIZE(B, r);
+            if (count > capacity) {
+                free(entries);
+                capacity = count;
+                entries = malloc(capacity * sizeof(uint64_t));
+            }
+            if (!entries) {
+                capacity = 0;
+                #pragma omp atomic write
+                failed = 1;
+                continue;
+            }
+            const size_t base = B->row_ptr[r];
+            for (size_t k = 0; k < count; k++) {
+                entries[k] = (uint64_t)(uint32_t)B->col_idx[base + k] << 32 | (uint32_t)B->values[base + k];
+            }
+            qsort(entries, count, sizeof(uint64_t), compare_entries);
+            for (size_t k = 0; k < count; k++) {
+                copy->col_idx[base + k] = (int)(entries[k] >> 32);
+                copy->values[base + k] = (int)(uint32_t)entries[k];
+            }
+        }
+        free(entries);
+    }
+    if (failed) {
+        free_compressed_matrix(copy);
+        return NULL;
+    }
+    return copy;
+}
+
+// Moves the end of row r's panel past every element before column limit, starting from the panel's start
+static inline void find_panel_end(const CompressedMatrix* B, const size_t* start, size_t* end, const size_t r, const int limit) {
+    size_t j = start[r];
+    while (j < B->row_ptr[r + 1] && B->col_idx[j] < limit) {
+        j++;
+    }
+    end[r] = j;
+}
+
+// Accumulates the part of row i of A * B in one column panel: elements [start[c], end[c]) of each sorted row c of B
+static void multiply_row_panel(const CompressedMatrix* A, const CompressedMatrix* B, const size_t* start, const size_t* end,
+                               const size_t i, int* out_row) {
+    for (size_t k = A->row_ptr[i]; k < A->row_ptr[i + 1]; k++) {
+        const int a_val = A->values[k];
+        const size_t a_col = A->col_idx[k];
+        PROFILE_COUNT(PROFILE_MULTIPLY_ADDS, end[a_col] - start[a_col]);
+        for (size_t j = start[a_col]; j < end[a_col]; j++) {
+            out_row[B->col_idx[j]] += a_val * B->values[j];
+        }
+    }
+}
+
+// Estimated seconds of the whole product at panel width panel_cols: every panel's bounds are found in
+// full, rows are only multiplied for the sample and scaled up. out_row is zeroed scratch as wide as B,
+// each sampled row's slice is cleared again after it, as the product starts every row from zero.
+static double time_panel_width(const CompressedMatrix* A, const CompressedMatrix* B, const size_t panel_cols,
+                               const size_t stride, size_t* start, size_t* end, int* out_row) {
+    const double begin = omp_get_wtime();
+    double sampled = 0.0;
+    for (size_t r = 0; r < B->num_rows; r++) {
+        start[r] = B->row_ptr[r];
+    }
+    for (size_t c = 0; c < B->num_cols; c += panel_cols) {
+        const int limit = (int)(c + panel_cols < B->num_cols ? c + panel_cols : B->num_cols);
+        for (size_t r = 0; r < B->num_rows; r++) {
+            find_panel_end(B, start, end, r, limit);
+        }
+        const double rows_begin = omp_get_wtime();
+        for (size_t i = 0; i < A->num_rows; i += stride) {
+            multiply_row_panel(A, B, start, end, i, out_row);
+            memset(out_row + c, 0, ((size_t)limit - c) * sizeof(int));
+        }
+        sampled += omp_get_wtime() - rows_begin;
+        size_t* next = start;
+        start = end;
+        end = next;
+    }
+    const double total = omp_get_wtime() - begin;
+    return total - sampled + sampled * (double)stride;
+}
+
+// Panel width for A * B: the widest whose B elements and output slice fill half of L2, checked on a
+// sample of rows against half, double and whole rows. sorted is B with its rows sorted.
+static size_t tune_panel_cols(const CompressedMatrix* A, const CompressedMatrix* B, const CompressedMatrix* sorted) {
+    if (tuned_tile.A == A && tuned_tile.B == B && tuned_tile.a_nnz == A->nnz && tuned_tile.b_nnz == B->nnz
+        && tuned_tile.a_rows == A->num_rows && tuned_tile.a_cols == A->num_cols && tuned_tile.b_cols == B->num_cols) {
+        return tuned_tile.panel_cols;
+    }
+
+    const double bytes_per_col = sizeof(int) + (double)B->nnz / (B->num_cols > 0 ? B->num_cols : 1) * 2 * sizeof(int);
+    size_t model = (size_t)(l2_cache_bytes() / 2 / bytes_per_col) / TILE_ALIGN * TILE_ALIGN;
+    model = model > TILE_ALIGN ? model : TILE_ALIGN;
+
+    size_t best = B->num_cols;
+    if (model < B->num_cols && A->num_rows > 0) {
+        size_t* bounds = malloc(2 * B->num_rows * sizeof(size_t));
+        int* out_row = calloc(B->num_cols, sizeof(int));
+        if (bounds && out_row) {
+            const size_t sample = A->num_rows / TILE_SAMPLE_STRIDE > TILE_SAMPLE_MIN ? A->num_rows / TILE_SAMPLE_STRIDE : TILE_SAMPLE_MIN;
+            const size_t stride = A->num_rows / sample > 1 ? A->num_rows / sample : 1;
+            const size_t candidates[] = {B->num_cols, model / 2, model, 2 * model};
+            double best_time = 0.0;
+            for (size_t c = 0; c < sizeof(candidates) / sizeof(candidates[0]); c++) {
+                if (candidates[c] < TILE_ALIGN || candidates[c] > B->num_cols) {
+                    continue;
+                }
+                const double seconds = time_panel_width(A, sorted, candidates[c], stride, bounds, bounds + B->num_rows, out_row);
+                if (c == 0 || seconds < best_time) {
+                    best = candidates[c];
+                    best_time = seconds;
+                }
+            }
+        }
+        free(bounds);
+        free(out_row);
+    }
+
+    tuned_tile.A = A;
+    tuned_tile.B = B;
+    tuned_tile.a_nnz = A->nnz;
+    tuned_tile.b_nnz = B->nnz;
+    tuned_tile.a_rows = A->num_rows;
+    tuned_tile.a_cols = A->num_cols;
+    tuned_tile.b_cols = B->num_cols;
+    tuned_tile.panel_cols = best;
+    return best;
+}
+
+// Multiplies into a zeroed result one column panel of B at a time: all of A passes over a panel, whose
+// rows of B and slice of each output row stay in cache, before the next one. Every B row keeps the
+// bounds of its elements in the current panel, which are found by walking on from the previous panel.
+// Rows are dealt by schedule, which the caller prepares and frees.
+// Returns -1 without touching result if the workspace cannot be allocated.
+static int multiply_tiled(const CompressedMatrix* A, const CompressedMatrix* B, const size_t panel_cols,
+                          DenseMatrix* result, RowSchedule* schedule, const int parallel) {
+    size_t* start = matrix_alloc((B->num_rows + 1) * sizeof(size_t));
+    size_t* end = matrix_alloc((B->num_rows + 1) * sizeof(size_t));
+    if (!start || !end) {
+        matrix_free(start);
+        matrix_free(end);
+        return -1;
+    }
+    apply_omp_schedule();
+
+    #pragma omp parallel if(parallel)
+    {
+        #pragma omp for schedule(static)
+        for (size_t r = 0; r < B->num_rows; r++) {
+            start[r] = B->row_ptr[r];
+        }
+
+        for (size_t c = 0; c < B->num_cols; c += panel_cols) {
+            const int limit = (int)(c + panel_cols < B->num_cols ? c + panel_cols : B->num_cols);
+            #pragma omp for schedule(static)
+            for (size_t r = 0; r < B->num_rows; r++) {
+                find_panel_end(B, start, end, r, limit);
+            }
+
+            if (schedule->costs) {
+                size_t begin, stop;
+                int first = 1;
+                while (next_rows(schedule, A->num_rows, &first, &begin, &stop)) {
+                    for (size_t i = begin; i < stop; i++) {
+                        multiply_row_panel(A, B, start, end, i, DENSE_ROW(result, i));
+                    }
+                }
+                #pragma omp barrier
+            } else {
+                #pragma omp for schedule(runtime)
+                for (size_t i = 0; i < A->num_rows; i++) {
+                    multiply_row_panel(A, B, start, end, i, DENSE_ROW(result, i));
+                }
+            }
+
+            // This panel's ends are where the next one starts
+            #pragma omp single
+            {
+                size_t* next = start;
+                start = end;
+                end = next;
+                if (schedule->queue) {
+                    reset_work_queue(schedule->queue);
+                }
+            }
+        }
+    }
+
+    matrix_free(start);
+    matrix_free(end);
+    return 0;
+}
 
 DenseMatrix* multiply_matrices(const CompressedMatrix* A, const CompressedMatrix* B, parallelisation_type parallelisation_type) {
+    // MPI computes a compressed product across ranks and only the root expands it
+    if (parallelisation_type == MULT_MPI || parallelisation_type == MULT_HYBRID) {
+        CompressedMatrix* product = multiply_matrices_sparse(A, B, parallelisation_type);
+        DenseMatrix* result = product ? compressed_to_dense(product) : NULL;
+        free_compressed_matrix(product);
+        return result;
+    }
+
     if (A->num_cols != B->num_rows) {
         fprintf(stderr, "Error: Incompatible matrix dimensions for multiplication\n");
         return NULL;
     }
 
-    DenseMatrix* result = malloc(sizeof(DenseMatrix));
-    result->rows = A->num_rows;
-    result->cols = B->num_cols;
-    result->data = malloc(result->rows * sizeof(int*));
+    PROFILE_BEGIN("multiply_dense");
+    // The schedule is known before the result exists, so its rows are placed with the threads that fill them
+    RowSchedule schedule = {NULL, NULL, NULL};
+    if (parallelisation_type == MULT_OMP) {
+        prepare_row_schedule(&schedule, A, B, omp_get_max_threads());
+    }
+    PROFILE_BEGIN("dense_allocate");
+    DenseMatrix* result = allocate_dense_matrix(A->num_rows, B->num_cols, 0);
+    if (result) {
+        first_touch_rows(result, &schedule, parallelisation_type == MULT_OMP);
+    }
+    PROFILE_END("dense_allocate");
+    if (!result) {
+        free_row_schedule(&schedule);
+        PROFILE_END("multiply_dense");
+        return NULL;
+    }
 
-    for (size_t i = 0; i < result->rows; i++) {
-        result->data[i] = calloc(result->cols, sizeof(int));
-    }
-
-    // Start timing
-    TICK(multiply_time);
-
-    // Perform matrix multiplication with Sequential, OMP or MPI multiplication
-    switch (parallelisation_type) {
-        case MULT_SEQUENTIAL:for (size_t i = 0; i < A->num_rows; i++) {
-                for (size_t k = 0; k < A->row_sizes[i]; k++) {
-                    int a_val = A->B[i][k];
-                    size_t a_col = A->C[i][k];
-                    for (size_t j = 0; j < B->row_sizes[a_col]; j++) {
-                        size_t b_col = B->C[a_col][j];
-                        int b_val = B->B[a_col][j];
-                        result->data[i][b_col] += a_val * b_val;
-                    }
+    PROFILE_COUNT(PROFILE_NNZ, A->nnz);
+
+    // Tiling needs B's rows sorted by column so each panel is a contiguous run of every row
+    const CompressedMatrix* sorted = NULL;
+    size_t panel_cols = tile_panel_cols;
+    if (panel_cols != TILE_NONE) {
+        PROFILE_BEGIN("dense_tile_prepare");
+        sorted = sorted_rows(B);
+        if (sorted && panel_cols == TILE_AUTO) {
+            panel_cols = tune_panel_cols(A, B, sorted);
+        }
+        PROFILE_END("dense_tile_prepare");
+    }
+
+    PROFILE_BEGIN("dense_compute");
+    const int tiled = sorted && panel_cols < B->num_cols
+                      && multiply_tiled(A, sorted, panel_cols, result, &schedule, parallelisation_type == MULT_OMP) == 0;
+    last_panel_cols = tiled ? panel_cols : 0;
+
+    if (!tiled) {
+        // Perform matrix multiplication with Sequential, OMP or MPI multiplication
+        switch (parallelisation_type) {
+            case MULT_SEQUENTIAL:
+                for (size_t i = 0; i < A->num_rows; i++) {
+                    multiply_row_dense(A, B, i, DENSE_ROW(result, i));
                 }
-            }
-            break;
+                break;
 
-        case MULT_OMP:
-            #pragma omp parallel for schedule(dynamic)
-            for (size_t i = 0; i < A->num_rows; i++) {
-                for (size_t k = 0; k < A->row_sizes[i]; k++) {
-                    int a_val = A->B[i][k];
-                    size_t a_col = A->C[i][k];
-                    for (size_t j = 0; j < B->row_sizes[a_col]; j++) {
-                        size_t b_col = B->C[a_col][j];
-                        int b_val = B->B[a_col][j];
-                        #pragma omp atomic
-                        result->data[i][b_col] += a_val * b_val;
+            case MULT_OMP:
+                // Each row of the result is written by exactly one thread, so no atomics are needed
+                if (schedule.costs) {
+                    #pragma omp parallel
+                    {
+                        size_t begin, end;
+                        int first = 1;
+                        while (next_rows(&schedule, A->num_rows, &first, &begin, &end)) {
+                            for (size_t i = begin; i < end; i++) {
+                                multiply_row_dense(A, B, i, DENSE_ROW(result, i));
+                            }
+                        }
+                    }
+                } else {
+                    apply_omp_schedule();
+                    #pragma omp parallel for schedule(runtime)
+                    for (size_t i = 0; i < A->num_rows; i++) {
+                        multiply_row_dense(A, B, i, DENSE_ROW(result, i));
                     }
                 }
-            }
-            break;
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    PROFILE_END("dense_compute");
+    free_row_schedule(&schedule);
+    if (sorted != B) {
+        free_compressed_matrix((CompressedMatrix*)sorted);
+    }
+    PROFILE_END("multiply_dense");
+    return result;
+}
 
-        case MULT_MPI: {
-            int rank, size;
-            MPI_Comm_rank(MPI_COMM_WORLD, &rank);
-            MPI_Comm_size(MPI_COMM_WORLD, &size);
+// The automatic kernel hashes rows whose output is under 1/AUTO_HASH_RATIO of B's width,
+// once B is too wide for its dense accumulator to stay in L2
+#define AUTO_HASH_RATIO 16
+#define AUTO_DENSE_BYTES ((size_t)256 << 10)
 
-            // Debug output for initial state
-            printf("[Process %d] Starting MPI multiplication\n", rank);
-            printf("[Process %d] Matrix A: %zu x %zu, Matrix B: %zu x %zu\n",
-                   rank, A->num_rows, A->num_cols, B->num_rows, B->num_cols);
+// Empty hash table slot
+#define HASH_EMPTY -1
 
-            // Validate input matrices
-            if (A == NULL || B == NULL) {
-                fprintf(stderr, "[Process %d] Error: NULL matrix pointer\n", rank);
-                MPI_Abort(MPI_COMM_WORLD, 1);
-                return NULL;
+// Per-thread sparse accumulator: marker[c] records the last row that touched column c, so nothing
+// has to be cleared between rows. The marker kernel keeps in slot[c] where that row stored column c,
+// the Gustavson kernel sums column c in dense[c]. The hash kernel needs no arrays as wide as B,
+// its open addressing table is sized for one row at a time and only grows.
+typedef struct {
+    size_t* marker;
+    size_t* slot;
+    int* dense;
+    int* hash_keys;
+    int* hash_values;
+    size_t hash_capacity;
+    int hash_bits;  // log2 of the slots the current row uses, which may be fewer than hash_capacity
+} SparseAccumulator;
+
+static int init_sparse_accumulator(SparseAccumulator* acc, const size_t cols, const MultiplicationKernel kernel) {
+    const int use_marker = kernel != KERNEL_HASH;
+    const int use_dense = kernel == KERNEL_GUSTAVSON || kernel == KERNEL_AUTO;
+    acc->marker = use_marker ? matrix_alloc(cols * sizeof(size_t)) : NULL;
+    acc->slot = kernel == KERNEL_MARKER ? matrix_alloc(cols * sizeof(size_t)) : NULL;
+    acc->dense = use_dense ? matrix_alloc(cols * sizeof(int)) : NULL;
+    acc->hash_keys = NULL;
+    acc->hash_values = NULL;
+    acc->hash_capacity = 0;
+    acc->hash_bits = 0;
+    if ((use_marker && !acc->marker) || (kernel == KERNEL_MARKER && !acc->slot) || (use_dense && !acc->dense)) {
+        matrix_free(acc->marker);
+        matrix_free(acc->slot);
+        matrix_free(acc->dense);
+        return -1;
+    }
+    if (use_marker) {
+        for (size_t c = 0; c < cols; c++) {
+            acc->marker[c] = SIZE_MAX;
+        }
+    }
+    return 0;
+}
+
+static void free_sparse_accumulator(SparseAccumulator* acc) {
+    matrix_free(acc->marker);
+    matrix_free(acc->slot);
+    matrix_free(acc->dense);
+    matrix_free(acc->hash_keys);
+    matrix_free(acc->hash_values);
+}
+
+// Upper bound on the output of row i: its multiply-adds, capped by the width of B
+static size_t row_output_bound(const CompressedMatrix* A, const CompressedMatrix* B, const size_t i) {
+    size_t bound = 0;
+    for (size_t k = A->row_ptr[i]; k < A->row_ptr[i + 1]; k++) {
+        if (A->values[k] != 0) {
+            bound += ROW_SIZE(B, (size_t)A->col_idx[k]);
+        }
+    }
+    return bound < B->num_cols ? bound : B->num_cols;
+}
+
+// Whether a row with about estimated_nnz outputs goes through the hash table
+static int use_hash_for_row(const size_t estimated_nnz, const size_t cols) {
+    switch (product_kernel) {
+        case KERNEL_HASH: return 1;
+        case KERNEL_AUTO:
+            return cols * (sizeof(size_t) + sizeof(int)) > AUTO_DENSE_BYTES && estimated_nnz * AUTO_HASH_RATIO < cols;
+        default: return 0;
+    }
+}
+
+// Clears a table of at least twice entries slots for the next row and returns its size, 0 if it
+// cannot grow. Only the slots this row uses are cleared, so the cost follows the row, not the largest table.
+static size_t prepare_hash_table(SparseAccumulator* acc, const size_t entries) {
+    size_t capacity = 16;
+    int bits = 4;
+    while (capacity < 2 * entries) {
+        capacity <<= 1;
+        bits++;
+    }
+    if (capacity > acc->hash_capacity) {
+        // Nothing in the table outlives a row, so a larger one is allocated rather than grown
+        matrix_free(acc->hash_keys);
+        matrix_free(acc->hash_values);
+        acc->hash_keys = matrix_alloc(capacity * sizeof(int));
+        acc->hash_values = matrix_alloc(capacity * sizeof(int));
+        acc->hash_capacity = acc->hash_keys && acc->hash_values ? capacity : 0;
+        if (!acc->hash_capacity) {
+            return 0;
+        }
+    }
+    for (size_t h = 0; h < capacity; h++) {
+        acc->hash_keys[h] = HASH_EMPTY;
+    }
+    acc->hash_bits = bits;
+    return capacity;
+}
+
+// Multiplicative hash into a table of 2^bits slots. The top bits of the product depend on every bit of
+// col, so columns sharing their low bits, as strided, banded and block patterns do, still spread out.
+static inline size_t hash_column(const int col, const int bits) {
+    return (size_t)(((uint64_t)(uint32_t)col * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+}
+
+// Slot holding col, or the empty slot where it belongs
+static inline size_t probe_column(const int* keys, const int col, const size_t mask, const int bits) {
+    size_t h = hash_column(col, bits);
+    while (keys[h] != HASH_EMPTY && keys[h] != col) {
+        h = (h + 1) & mask;
+    }
+    return h;
+}
+
+// Symbolic phase: number of distinct output columns of row i, written to row_ptr[i + 1]
+static size_t count_product_row(const CompressedMatrix* A, const CompressedMatrix* B, const size_t i, SparseAccumulator* acc) {
+    size_t count = 0;
+    for (size_t k = A->row_ptr[i]; k < A->row_ptr[i + 1]; k++) {
+        // Zero entries only come from empty-row padding and contribute nothing, nor do B's padded rows
+        if (A->values[k] == 0) continue;
+        const size_t a_col = A->col_idx[k];
+        if (IS_EMPTY_ROW(B, a_col)) continue;
+        for (size_t j = B->row_ptr[a_col]; j < B->row_ptr[a_col + 1]; j++) {
+            const size_t b_col = B->col_idx[j];
+            if (acc->marker[b_col] != i) {
+                acc->marker[b_col] = i;
+                count++;
             }
+        }
+    }
+    return count;
+}
+
+// Numeric phase: writes row i of the product into its preallocated slice,
+// columns appear in the order they are first produced
+static void compute_product_row(const CompressedMatrix* A, const CompressedMatrix* B, const size_t i,
+                                SparseAccumulator* acc, CompressedMatrix* result) {
+    int* values = result->values;
+    int* col_idx = result->col_idx;
+    const size_t row_start = result->row_ptr[i];
+    size_t pos = row_start;
 
-            // Validate matrix structures
-            if (A->B == NULL || A->C == NULL || B->B == NULL || B->C == NULL) {
-                fprintf(stderr, "[Process %d] Error: NULL matrix data pointers\n", rank);
-                MPI_Abort(MPI_COMM_WORLD, 1);
-                return NULL;
+    for (size_t k = A->row_ptr[i]; k < A->row_ptr[i + 1]; k++) {
+        const int a_val = A->values[k];
+        if (a_val == 0) continue;
+        const size_t a_col = A->col_idx[k];
+        if (IS_EMPTY_ROW(B, a_col)) continue;
+        PROFILE_COUNT(PROFILE_MULTIPLY_ADDS, B->row_ptr[a_col + 1] - B->row_ptr[a_col]);
+        for (size_t j = B->row_ptr[a_col]; j < B->row_ptr[a_col + 1]; j++) {
+            const size_t b_col = B->col_idx[j];
+            const int product = a_val * B->values[j];
+            if (acc->marker[b_col] != i) {
+                acc->marker[b_col] = i;
+                acc->slot[b_col] = pos;
+                col_idx[pos] = (int)b_col;
+                values[pos] = product;
+                pos++;
+            } else {
+                values[acc->slot[b_col]] += product;
             }
+        }
+    }
 
-            // Debug: Print row sizes for first few rows
-            printf("[Process %d] First row sizes - A: %zu, B: %zu\n",
-                   rank, A->row_sizes[0], B->row_sizes[0]);
+    // If the product row is empty, store two 0s
+    if (pos == row_start) {
+        store_empty_row(values + row_start, col_idx + row_start);
+    }
+}
 
-            // Calculate work distribution
-            size_t rows_per_proc = A->num_rows / size;
-            size_t remainder = A->num_rows % size;
-            size_t start_row = rank * rows_per_proc + (rank < remainder ? rank : remainder);
-            size_t num_rows = rows_per_proc + (rank < remainder ? 1 : 0);
-            size_t end_row = start_row + num_rows;
+// Quicksort with inline comparisons, leaving short ranges to insertion sort;
+// most product rows are short and qsort's per-comparison call dominates them
+static void sort_columns(int* cols, size_t count) {
+    while (count > 24) {
+        // Median of three pivot, recurse into the smaller side to bound the stack
+        const int a = cols[0], b = cols[count / 2], c = cols[count - 1];
+        const int pivot = a < b ? (b < c ? b : (a < c ? c : a)) : (a < c ? a : (b < c ? c : b));
+        size_t lo = 0, hi = count - 1;
+        for (;;) {
+            while (cols[lo] < pivot) lo++;
+            while (cols[hi] > pivot) hi--;
+            if (lo >= hi) break;
+            const int tmp = cols[lo];
+            cols[lo++] = cols[hi];
+            cols[hi--] = tmp;
+        }
+        const size_t left = hi + 1;
+        if (left < count - left) {
+            sort_columns(cols, left);
+            cols += left;
+            count -= left;
+        } else {
+            sort_columns(cols + left, count - left);
+            count = left;
+        }
+    }
+    for (size_t k = 1; k < count; k++) {
+        const int col = cols[k];
+        size_t pos = k;
+        while (pos > 0 && cols[pos - 1] > col) {
+            cols[pos] = cols[pos - 1];
+            pos--;
+        }
+        cols[pos] = col;
+    }
+}
 
-            printf("[Process %d] Work distribution: rows %zu to %zu (total: %zu)\n",
-                    rank, start_row, end_row - 1, num_rows);
+// Numeric phase of the Gustavson kernel: sums row i in the dense accumulator while the row's
+// col_idx slice records the touched columns, then gathers the sums in that (optionally sorted) order.
+// Work is proportional to the row's multiply-adds, never to the width of B.
+static void compute_product_row_gustavson(const CompressedMatrix* A, const CompressedMatrix* B, const size_t i,
+                                          SparseAccumulator* acc, CompressedMatrix* result) {
+    int* values = result->values + result->row_ptr[i];
+    int* touched = result->col_idx + result->row_ptr[i];
+    int* dense = acc->dense;
+    size_t count = 0;
 
-            // Allocate temporary buffer for local results
-            printf("[Process %d] Allocating local result buffer for %zu rows\n", rank, num_rows);
-            int** local_result = malloc(num_rows * sizeof(int*));
-            if (local_result == NULL) {
-                fprintf(stderr, "[Process %d] Failed to allocate local result rows\n", rank);
-                MPI_Abort(MPI_COMM_WORLD, 1);
-                return NULL;
+    for (size_t k = A->row_ptr[i]; k < A->row_ptr[i + 1]; k++) {
+        const int a_val = A->values[k];
+        if (a_val == 0) continue;
+        const size_t a_col = A->col_idx[k];
+        if (IS_EMPTY_ROW(B, a_col)) continue;
+        PROFILE_COUNT(PROFILE_MULTIPLY_ADDS, B->row_ptr[a_col + 1] - B->row_ptr[a_col]);
+        for (size_t j = B->row_ptr[a_col]; j < B->row_ptr[a_col + 1]; j++) {
+            const size_t b_col = B->col_idx[j];
+            const int product = a_val * B->values[j];
+            if (acc->marker[b_col] != i) {
+                acc->marker[b_col] = i;
+                dense[b_col] = product;
+                touched[count++] = (int)b_col;
+            } else {
+                dense[b_col] += product;
             }
+        }
+    }
+
+    // If the product row is empty, store two 0s
+    if (count == 0) {
+        store_empty_row(values, touched);
+        return;
+    }
 
-            for (size_t i = 0; i < num_rows; i++) {
-                local_result[i] = calloc(result->cols, sizeof(int));
-                if (local_result[i] == NULL) {
-                    fprintf(stderr, "[Process %d] Failed to allocate local result columns\n", rank);
-                    MPI_Abort(MPI_COMM_WORLD, 1);
-                    return NULL;
+    if (sort_product_columns) {
+        if (count * 16 > B->num_cols) {
+            // Dense rows are cheaper to order by sweeping the marker than by sorting
+            size_t pos = 0;
+            for (size_t c = 0; c < B->num_cols; c++) {
+                if (acc->marker[c] == i) {
+                    touched[pos++] = (int)c;
                 }
             }
+        } else {
+            sort_columns(touched, count);
+        }
+    }
+    for (size_t k = 0; k < count; k++) {
+        values[k] = dense[touched[k]];
+    }
+}
 
-            // Perform local computation
-            printf("[Process %d] Starting local computation\n", rank);
-            for (size_t i = start_row; i < end_row; i++) {
-                size_t local_i = i - start_row;
+// Symbolic phase of the hash kernel, with the table sized from the row's output bound;
+// returns SIZE_MAX if the table cannot grow
+static size_t count_product_row_hash(const CompressedMatrix* A, const CompressedMatrix* B, const size_t i,
+                                     SparseAccumulator* acc, const size_t bound) {
+    const size_t capacity = prepare_hash_table(acc, bound);
+    if (capacity == 0) {
+        return SIZE_MAX;
+    }
+    const size_t mask = capacity - 1;
+    int* keys = acc->hash_keys;
+    size_t count = 0;
 
-                // Debug: Periodically print progress
-                if (i % 1000 == 0) {
-                    printf("[Process %d] Processing row %zu\n", rank, i);
-                }
+    for (size_t k = A->row_ptr[i]; k < A->row_ptr[i + 1]; k++) {
+        if (A->values[k] == 0) continue;
+        const size_t a_col = A->col_idx[k];
+        if (IS_EMPTY_ROW(B, a_col)) continue;
+        for (size_t j = B->row_ptr[a_col]; j < B->row_ptr[a_col + 1]; j++) {
+            const int b_col = B->col_idx[j];
+            const size_t h = probe_column(keys, b_col, mask, acc->hash_bits);
+            if (keys[h] == HASH_EMPTY) {
+                keys[h] = b_col;
+                count++;
+            }
+        }
+    }
+    return count;
+}
 
-                if (i >= A->num_rows) {
-                    fprintf(stderr, "[Process %d] Error: Row index %zu exceeds matrix dimensions\n",
-                            rank, i);
-                    continue;
-                }
+// Numeric phase of the hash kernel: sums row i in a table sized from its exact output size and,
+// like the Gustavson kernel, uses the row's col_idx slice as the list of touched columns.
+// Returns -1 if the table cannot grow.
+static int compute_product_row_hash(const CompressedMatrix* A, const CompressedMatrix* B, const size_t i,
+                                    SparseAccumulator* acc, CompressedMatrix* result) {
+    int* values = result->values + result->row_ptr[i];
+    int* touched = result->col_idx + result->row_ptr[i];
+    const size_t capacity = prepare_hash_table(acc, ROW_SIZE(result, i));
+    if (capacity == 0) {
+        return -1;
+    }
+    const size_t mask = capacity - 1;
+    int* keys = acc->hash_keys;
+    int* sums = acc->hash_values;
+    size_t count = 0;
 
-                for (size_t k = 0; k < A->row_sizes[i]; k++) {
-                    int a_val = A->B[i][k];
-                    size_t a_col = A->C[i][k];
+    for (size_t k = A->row_ptr[i]; k < A->row_ptr[i + 1]; k++) {
+        const int a_val = A->values[k];
+        if (a_val == 0) continue;
+        const size_t a_col = A->col_idx[k];
+        if (IS_EMPTY_ROW(B, a_col)) continue;
+        PROFILE_COUNT(PROFILE_MULTIPLY_ADDS, B->row_ptr[a_col + 1] - B->row_ptr[a_col]);
+        for (size_t j = B->row_ptr[a_col]; j < B->row_ptr[a_col + 1]; j++) {
+            const int b_col = B->col_idx[j];
+            const int product = a_val * B->values[j];
+            const size_t h = probe_column(keys, b_col, mask, acc->hash_bits);
+            if (keys[h] == HASH_EMPTY) {
+                keys[h] = b_col;
+                sums[h] = product;
+                touched[count++] = b_col;
+            } else {
+                sums[h] += product;
+            }
+        }
+    }
 
-                    if (a_col >= B->num_rows) {
-                        fprintf(stderr, "[Process %d] Error: Invalid column index %zu in matrix A\n",
-                                rank, a_col);
-                        continue;
-                    }
+    // If the product row is empty, store two 0s
+    if (count == 0) {
+        store_empty_row(values, touched);
+        return 0;
+    }
+
+    if (sort_product_columns) {
+        sort_columns(touched, count);
+    }
+    for (size_t k = 0; k < count; k++) {
+        values[k] = sums[probe_column(keys, touched[k], mask, acc->hash_bits)];
+    }
+    return 0;
+}
+
+// Symbolic phase with the selected kernel, SIZE_MAX on failure
+static size_t count_row(const CompressedMatrix* A, const CompressedMatrix* B, const size_t i, SparseAccumulator* acc) {
+    if (product_kernel == KERNEL_HASH || product_kernel == KERNEL_AUTO) {
+        const size_t bound = row_output_bound(A, B, i);
+        if (use_hash_for_row(bound, B->num_cols)) {
+            return count_product_row_hash(A, B, i, acc, bound);
+        }
+    }
+    return count_product_row(A, B, i, acc);
+}
+
+// Numeric phase with the selected kernel; the automatic kernel decides again from the exact row size
+static int compute_row(const CompressedMatrix* A, const CompressedMatrix* B, const size_t i,
+                       SparseAccumulator* acc, CompressedMatrix* result) {
+    if (use_hash_for_row(ROW_SIZE(result, i), B->num_cols)) {
+        return compute_product_row_hash(A, B, i, acc, result);
+    }
+    if (product_kernel == KERNEL_GUSTAVSON || product_kernel == KERNEL_AUTO) {
+        compute_product_row_gustavson(A, B, i, acc, result);
+    } else {
+        compute_product_row(A, B, i, acc, result);
+    }
+    return 0;
+}
 
-                    for (size_t j = 0; j < B->row_sizes[a_col]; j++) {
-                        size_t b_col = B->C[a_col][j];
+CompressedMatrix* multiply_matrices_sparse(const CompressedMatrix* A, const CompressedMatrix* B, parallelisation_type parallelisation_type) {
+    if (parallelisation_type == MULT_MPI) {
+        return multiply_matrices_mpi(A, B, MULT_SEQUENTIAL);
+    }
+    if (parallelisation_type == MULT_HYBRID) {
+        return multiply_matrices_mpi(A, B, MULT_OMP);
+    }
 
-                        if (b_col >= result->cols) {
-                            fprintf(stderr, "[Process %d] Error: Invalid column index %zu in matrix B\n",
-                                    rank, b_col);
-                            continue;
+    if (A->num_cols != B->num_rows) {
+        fprintf(stderr, "Error: Incompatible matrix dimensions for multiplication\n");
+        return NULL;
+    }
+
+    CompressedMatrix* result = allocate_compressed_matrix(A->num_rows, B->num_cols);
+    if (!result) {
+        return NULL;
+    }
+
+    PROFILE_BEGIN("multiply_sparse");
+    PROFILE_COUNT(PROFILE_NNZ, A->nnz);
+    const int parallel = parallelisation_type == MULT_OMP;
+    RowSchedule schedule = {NULL, NULL, NULL};
+    if (parallel) {
+        prepare_row_schedule(&schedule, A, B, omp_get_max_threads());
+    }
+    int failed = 0;
+    int numeric_failed = 0;  // Kept apart from failed, which threads read to agree on the phases they enter
+    apply_omp_schedule();
+
+    #pragma omp parallel if(parallel)
+    {
+        size_t begin, end;
+        int first = 1;
+        SparseAccumulator acc;
+        const int have_acc = init_sparse_accumulator(&acc, B->num_cols, product_kernel) == 0;
+        if (!have_acc) {
+            #pragma omp atomic write
+            failed = 1;
+        }
+        #pragma omp barrier
+
+        if (!failed) {
+            // Symbolic phase sizes every output row
+            PROFILE_BEGIN("sparse_symbolic");
+            if (schedule.costs) {
+                while (next_rows(&schedule, A->num_rows, &first, &begin, &end)) {
+                    for (size_t i = begin; i < end; i++) {
+                        const size_t count = count_row(A, B, i, &acc);
+                        if (count == SIZE_MAX) {
+                            #pragma omp atomic write
+                            failed = 1;
                         }
+                        result->row_ptr[i + 1] = count > 0 && count != SIZE_MAX ? count : EMPTY_ROW_SIZE;
+                    }
+                }
+            } else {
+                #pragma omp for schedule(runtime)
+                for (size_t i = 0; i < A->num_rows; i++) {
+                    const size_t count = count_row(A, B, i, &acc);
+                    if (count == SIZE_MAX) {
+                        #pragma omp atomic write
+                        failed = 1;
+                    }
+                    result->row_ptr[i + 1] = count > 0 && count != SIZE_MAX ? count : EMPTY_ROW_SIZE;
+                }
+            }
+            PROFILE_END("sparse_symbolic");
 
-                        int b_val = B->B[a_col][j];
-                        result->data[i][b_col] += a_val * b_val;
+            #pragma omp barrier
+            #pragma omp single
+            {
+                PROFILE_BEGIN("sparse_allocate");
+                if (!failed) {
+                    const size_t nnz = scan_row_sizes(result->row_ptr, result->num_rows);
+                    failed = allocate_compressed_storage(result, nnz) != 0;
+                }
+                if (schedule.queue) {
+                    reset_work_queue(schedule.queue);
+                }
+                PROFILE_END("sparse_allocate");
+            }
+
+            // Numeric phase fills the rows; the marker still holds symbolic row stamps, so reset it
+            if (!failed) {
+                PROFILE_BEGIN("sparse_numeric");
+                for (size_t c = 0; acc.marker && c < B->num_cols; c++) {
+                    acc.marker[c] = SIZE_MAX;
+                }
+
+                if (schedule.costs) {
+                    first = 1;
+                    while (next_rows(&schedule, A->num_rows, &first, &begin, &end)) {
+                        for (size_t i = begin; i < end; i++) {
+                            if (compute_row(A, B, i, &acc, result) != 0) {
+                                #pragma omp atomic write
+                                numeric_failed = 1;
+                            }
+                        }
+                    }
+                } else {
+                    #pragma omp for schedule(runtime)
+                    for (size_t i = 0; i < A->num_rows; i++) {
+                        if (compute_row(A, B, i, &acc, result) != 0) {
+                            #pragma omp atomic write
+                            numeric_failed = 1;
+                        }
                     }
                 }
+                PROFILE_END("sparse_numeric");
             }
+        }
 
-            printf("[Process %d] Local computation completed\n", rank);
+        if (have_acc) {
+            free_sparse_accumulator(&acc);
+        }
+    }
+
+    free_row_schedule(&schedule);
+    PROFILE_END("multiply_sparse");
+    if (failed || numeric_failed) {
+        fprintf(stderr, "Error: Failed to allocate sparse multiplication workspace\n");
+        free_compressed_matrix(result);
+        return NULL;
+    }
+    return result;
+}
 
-            // Gather results
-            printf("[Process %d] Starting result gathering\n", rank);
-            for (size_t i = 0; i < num_rows; i++) {
-                size_t global_row = start_row + i;
-                printf("[Process %d] Reducing row %zu\n", rank, global_row);
+// Product structure, row split and workspaces of A * B, kept for repeated products of inputs with the
+// same patterns. MPI plans keep all of it per rank in distributed instead.
+struct MultiplicationPlan {
+    DistributedPlan* distributed;
+    int parallel;
+    int threads;  // Threads the schedule and accumulators were made for
+    size_t a_rows, a_cols, a_nnz, b_cols, b_nnz;  // Shape the inputs of every execution must have
+    CompressedMatrix* product;  // Structure fixed at creation, values rewritten by every execution
+    RowSchedule schedule;
+    int** accumulators;  // Dense accumulator as wide as B for each thread
+};
 
-                MPI_Reduce(local_result[i], result->data[global_row],
-                          result->cols, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+// Copy of A with every stored element set to 1 apart from the padding of empty rows, so its product
+// reaches every column A's pattern can reach, including through elements that hold 0 for now
+static CompressedMatrix* pattern_of(const CompressedMatrix* A) {
+    CompressedMatrix* pattern = allocate_compressed_matrix(A->num_rows, A->num_cols);
+    if (!pattern || allocate_compressed_storage(pattern, A->nnz) != 0) {
+        free_compressed_matrix(pattern);
+        return NULL;
+    }
+    memcpy(pattern->row_ptr, A->row_ptr, (A->num_rows + 1) * sizeof(size_t));
+    memcpy(pattern->col_idx, A->col_idx, A->nnz * sizeof(int));
+
+    // Padding keeps its 0s, so kernels still skip it like B's padded rows
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < A->num_rows; i++) {
+        const int padding = IS_EMPTY_ROW(A, i);
+        for (size_t k = A->row_ptr[i]; k < A->row_ptr[i + 1]; k++) {
+            pattern->values[k] = !padding;
+        }
+    }
+    return pattern;
+}
+
+static MultiplicationPlan* build_multiplication_plan(const CompressedMatrix* A, const CompressedMatrix* B, parallelisation_type parallelisation_type) {
+    MultiplicationPlan* plan = calloc(1, sizeof(MultiplicationPlan));
+    if (!plan) {
+        fprintf(stderr, "Failed to allocate memory for multiplication plan\n");
+        return NULL;
+    }
+    if (parallelisation_type == MULT_MPI || parallelisation_type == MULT_HYBRID) {
+        plan->distributed = create_distributed_plan(A, B, parallelisation_type == MULT_HYBRID ? MULT_OMP : MULT_SEQUENTIAL);
+        if (!plan->distributed) {
+            free(plan);
+            return NULL;
+        }
+        return plan;
+    }
+
+    // The symbolic phase of an ordinary product of A's pattern gives the structure, in the selected kernel's
+    // column order. Columns only reached through elements of A that are 0 now stay in it for later values.
+    PROFILE_BEGIN("plan_create");
+    CompressedMatrix* pattern = pattern_of(A);
+    plan->product = pattern ? multiply_matrices_sparse(pattern, B, parallelisation_type) : NULL;
+    free_compressed_matrix(pattern);
+    if (!plan->product) {
+        PROFILE_END("plan_create");
+        free(plan);
+        return NULL;
+    }
+    plan->parallel = parallelisation_type == MULT_OMP;
+    plan->threads = plan->parallel ? omp_get_max_threads() : 1;
+    plan->a_rows = A->num_rows;
+    plan->a_cols = A->num_cols;
+    plan->a_nnz = A->nnz;
+    plan->b_cols = B->num_cols;
+    plan->b_nnz = B->nnz;
+    if (plan->parallel) {
+        prepare_row_schedule(&plan->schedule, A, B, plan->threads);
+    }
+
+    // Each thread allocates and first touches its own accumulator
+    int failed = 0;
+    plan->accumulators = calloc((size_t)plan->threads, sizeof(int*));
+    if (plan->accumulators) {
+        #pragma omp parallel num_threads(plan->threads) if(plan->parallel)
+        {
+            #pragma omp for schedule(static, 1)
+            for (int t = 0; t < plan->threads; t++) {
+                plan->accumulators[t] = calloc(B->num_cols > 0 ? B->num_cols : 1, sizeof(int));
+                if (!plan->accumulators[t]) {
+                    #pragma omp atomic write
+                    failed = 1;
+                }
             }
+        }
+    }
+    PROFILE_END("plan_create");
+    if (!plan->accumulators || failed) {
+        fprintf(stderr, "Error: Failed to allocate multiplication plan workspace\n");
+        free_multiplication_plan(plan);
+        return NULL;
+    }
+    // The pattern's product has the right structure but not A's values
+    execute_multiplication_plan(plan, A, B);
+    return plan;
+}
+
+MultiplicationPlan* create_multiplication_plan(const CompressedMatrix* A, const CompressedMatrix* B, parallelisation_type parallelisation_type) {
+    // Plans outlive arena resets, so the matrix arena is set aside while one is made
+    Arena* arena = get_matrix_arena();
+    set_matrix_arena(NULL);
+    MultiplicationPlan* plan = build_multiplication_plan(A, B, parallelisation_type);
+    set_matrix_arena(arena);
+    return plan;
+}
+
+// Numeric phase of a planned row: only the row's known output columns are cleared in the accumulator
+// and gathered from it, so nothing is searched, marked or counted
+static void compute_planned_row(const CompressedMatrix* A, const CompressedMatrix* B, const size_t i, int* dense, CompressedMatrix* product) {
+    const size_t row_start = product->row_ptr[i];
+    const size_t row_end = product->row_ptr[i + 1];
+    for (size_t k = row_start; k < row_end; k++) {
+        dense[product->col_idx[k]] = 0;
+    }
+    for (size_t k = A->row_ptr[i]; k < A->row_ptr[i + 1]; k++) {
+        const int a_val = A->values[k];
+        if (a_val == 0) continue;
+        const size_t a_col = A->col_idx[k];
+        if (IS_EMPTY_ROW(B, a_col)) continue;
+        PROFILE_COUNT(PROFILE_MULTIPLY_ADDS, B->row_ptr[a_col + 1] - B->row_ptr[a_col]);
+        for (size_t j = B->row_ptr[a_col]; j < B->row_ptr[a_col + 1]; j++) {
+            dense[B->col_idx[j]] += a_val * B->values[j];
+        }
+    }
+    // Empty rows store column 0 twice, which nothing reached and which was just cleared
+    for (size_t k = row_start; k < row_end; k++) {
+        product->values[k] = dense[product->col_idx[k]];
+    }
+}
 
-            printf("[Process %d] Result gathering completed\n", rank);
+const CompressedMatrix* execute_multiplication_plan(MultiplicationPlan* plan, const CompressedMatrix* A, const CompressedMatrix* B) {
+    if (plan->distributed) {
+        return execute_distributed_plan(plan->distributed, A, B);
+    }
+    if (A->num_rows != plan->a_rows || A->num_cols != plan->a_cols || A->nnz != plan->a_nnz
+        || B->num_rows != plan->a_cols || B->num_cols != plan->b_cols || B->nnz != plan->b_nnz) {
+        fprintf(stderr, "Error: Inputs do not have the patterns the multiplication plan was created for\n");
+        return NULL;
+    }
+
+    PROFILE_BEGIN("plan_execute");
+    PROFILE_COUNT(PROFILE_NNZ, A->nnz);
+    CompressedMatrix* product = plan->product;
+    const RowSchedule* schedule = &plan->schedule;
+    apply_omp_schedule();
 
-            // Clean up local memory
-            printf("[Process %d] Cleaning up local memory\n", rank);
-            for (size_t i = 0; i < num_rows; i++) {
-                free(local_result[i]);
+    #pragma omp parallel num_threads(plan->threads) if(plan->parallel)
+    {
+        int* dense = plan->accumulators[omp_get_thread_num()];
+        if (schedule->costs) {
+            size_t begin, end;
+            int first = 1;
+            while (next_rows(schedule, A->num_rows, &first, &begin, &end)) {
+                for (size_t i = begin; i < end; i++) {
+                    compute_planned_row(A, B, i, dense, product);
+                }
             }
-            free(local_result);
+        } else {
+            #pragma omp for schedule(runtime)
+            for (size_t i = 0; i < A->num_rows; i++) {
+                compute_planned_row(A, B, i, dense, product);
+            }
+        }
+    }
+
+    if (schedule->queue) {
+        reset_work_queue(schedule->queue);
+    }
+    PROFILE_END("plan_execute");
+    return product;
+}
+
+const CompressedMatrix* get_plan_product(const MultiplicationPlan* plan) {
+    return plan->distributed ? get_distributed_plan_product(plan->distributed) : plan->product;
+}
 
-            // Synchronize all processes
-            MPI_Barrier(MPI_COMM_WORLD);
-            printf("[Process %d] MPI multiplication completed\n", rank);
-            break;
+void free_multiplication_plan(MultiplicationPlan* plan) {
+    if (!plan) {
+        return;
+    }
+    free_distributed_plan(plan->distributed);
+    for (int t = 0; plan->accumulators && t < plan->threads; t++) {
+        free(plan->accumulators[t]);
+    }
+    free(plan->accumulators);
+    free_row_schedule(&plan->schedule);
+    free_compressed_matrix(plan->product);
+    free(plan);
+}
+
+// Writes row i of A * X to y_row. A single vector is a dot product gathering its elements, wider
+// blocks add the rows of X picked by the row's columns across all of X's columns at once.
+static void multiply_row_vectors(const CompressedMatrix* A, const DenseMatrix* X, const size_t i, int* y_row) {
+    const size_t begin = A->row_ptr[i];
+    const size_t count = A->row_ptr[i + 1] - begin;
+    PROFILE_COUNT(PROFILE_MULTIPLY_ADDS, count * X->cols);
+    if (X->cols == 1) {
+        y_row[0] = gather_dot(A->values + begin, A->col_idx + begin, count, X->data, X->stride);
+    } else {
+        sum_scaled_rows(y_row, X->data, X->stride, A->values + begin, A->col_idx + begin, count, X->cols);
+    }
+}
+
+int multiply_matrix_dense(const CompressedMatrix* A, const DenseMatrix* X, DenseMatrix* Y, parallelisation_type parallelisation_type) {
+    if (parallelisation_type == MULT_MPI) {
+        return multiply_matrix_dense_mpi(A, X, Y, MULT_SEQUENTIAL);
+    }
+    if (parallelisation_type == MULT_HYBRID) {
+        return multiply_matrix_dense_mpi(A, X, Y, MULT_OMP);
+    }
+
+    if (A->num_cols != X->rows || A->num_rows != Y->rows || X->cols != Y->cols) {
+        fprintf(stderr, "Error: Incompatible matrix dimensions for multiplication\n");
+        return -1;
+    }
+
+    PROFILE_BEGIN("multiply_vectors");
+    PROFILE_COUNT(PROFILE_NNZ, A->nnz);
+    // Every row costs one multiply-add per stored element and column of X, so A's row offsets
+    // already are the prefix sums the balanced schedules split
+    const int parallel = parallelisation_type == MULT_OMP;
+    RowSchedule schedule = {NULL, NULL, NULL};
+    if (parallel) {
+        prepare_schedule_from_costs(&schedule, A->num_rows, schedule_needs_costs() ? A->row_ptr : NULL, NULL, omp_get_max_threads());
+    }
+    apply_omp_schedule();
+
+    #pragma omp parallel if(parallel)
+    {
+        if (schedule.costs) {
+            size_t begin, end;
+            int first = 1;
+            while (next_rows(&schedule, A->num_rows, &first, &begin, &end)) {
+                for (size_t i = begin; i < end; i++) {
+                    multiply_row_vectors(A, X, i, DENSE_ROW(Y, i));
+                }
+            }
+        } else {
+            #pragma omp for schedule(runtime)
+            for (size_t i = 0; i < A->num_rows; i++) {
+                multiply_row_vectors(A, X, i, DENSE_ROW(Y, i));
+            }
         }
     }
 
-    TOCK(multiply_time);
-    return result;
+    free_row_schedule(&schedule);
+    PROFILE_END("multiply_vectors");
+    return 0;
 }
 
-void free_dense_matrix(DenseMatrix* matrix) {
-    for (size_t i = 0; i < matrix->rows; i++) {
-        free(matrix->data[i]);
+int multiply_matrix_vector(const CompressedMatrix* A, const int* x, int* y, parallelisation_type parallelisation_type) {
+    // Single column views of x and y, only read on rank 0 by the MPI variants
+    const DenseMatrix x_view = {(int*)x, A ? A->num_cols : 0, 1, 1, (A ? A->num_cols : 0) * sizeof(int), 0};
+    DenseMatrix y_view = {y, A ? A->num_rows : 0, 1, 1, (A ? A->num_rows : 0) * sizeof(int), 0};
+    return multiply_matrix_dense(A, &x_view, &y_view, parallelisation_type);
+}
+
+CompressedMatrix* place_matrix_rows(const CompressedMatrix* A, const CompressedMatrix* B) {
+    if (A->num_cols != B->num_rows) {
+        fprintf(stderr, "Error: Incompatible matrix dimensions for multiplication\n");
+        return NULL;
+    }
+
+    // Only the first range of each thread matters, so no work queue is needed for stealing
+    size_t* costs = schedule_needs_costs() ? estimate_row_costs(A, B) : NULL;
+    const RowSchedule schedule = {costs, NULL, costs};
+    CompressedMatrix* placed = allocate_compressed_matrix(A->num_rows, A->num_cols);
+    if (!placed || allocate_compressed_storage(placed, A->nnz) != 0) {
+        free_compressed_matrix(placed);
+        matrix_free(costs);
+        return NULL;
+    }
+
+    #pragma omp parallel
+    {
+        size_t begin, end;
+        owned_rows(&schedule, A->num_rows, &begin, &end);
+        const size_t first = A->row_ptr[begin];
+        memcpy(placed->values + first, A->values + first, (A->row_ptr[end] - first) * sizeof(int));
+        memcpy(placed->col_idx + first, A->col_idx + first, (A->row_ptr[end] - first) * sizeof(int));
+        for (size_t i = begin; i < end; i++) {
+            placed->row_ptr[i + 1] = A->row_ptr[i + 1];
+        }
+    }
+    matrix_free(costs);
+    return placed;
+}
+
+void measure_row_placement(const CompressedMatrix* A, const CompressedMatrix* B, const DenseMatrix* result,
+                           PagePlacement* placement) {
+    size_t* costs = schedule_needs_costs() ? estimate_row_costs(A, B) : NULL;
+    const RowSchedule schedule = {costs, NULL, costs};
+    PagePlacement total = {0, 0, 0};
+
+    #pragma omp parallel
+    {
+        size_t begin, end;
+        owned_rows(&schedule, A->num_rows, &begin, &end);
+        const int node = get_current_numa_node();
+        const size_t first = A->row_ptr[begin];
+        PagePlacement mine = {0, 0, 0};
+        count_page_placement(A->values + first, (A->row_ptr[end] - first) * sizeof(int), node, &mine);
+        count_page_placement(A->col_idx + first, (A->row_ptr[end] - first) * sizeof(int), node, &mine);
+        if (result && begin < end) {
+            count_page_placement(DENSE_ROW(result, begin), (end - begin) * result->stride * sizeof(int), node, &mine);
+        }
+
+        #pragma omp atomic
+        total.local_pages += mine.local_pages;
+        #pragma omp atomic
+        total.remote_pages += mine.remote_pages;
+        #pragma omp atomic
+        total.unplaced_pages += mine.unplaced_pages;
     }
-    free(matrix->data);
-    free(matrix);
+    matrix_free(costs);
+    *placement = total;
 }
 
-void print_dense_matrix(const DenseMatrix* matrix) {
-    for (size_t i = 0; i < matrix->rows; i++) {
-        for (size_t j = 0; j < matrix->cols; j++) {
-            printf("%2d ", matrix->data[i][j]);
+DenseMatrix* compressed_to_dense(const CompressedMatrix* compressed) {
+    DenseMatrix* result = allocate_dense_matrix(compressed->num_rows, compressed->num_cols, 1);
+    if (!result) {
+        return NULL;
+    }
+
+    PROFILE_BEGIN("expand_dense");
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < result->rows; i++) {
+        int* row = DENSE_ROW(result, i);
+        for (size_t k = compressed->row_ptr[i]; k < compressed->row_ptr[i + 1]; k++) {
+            row[compressed->col_idx[k]] += compressed->values[k];
         }
-        printf("\n");
     }
-}
\ No newline at end of file
+    PROFILE_END("expand_dense");
+    return result;
+}
@@ -0,0 +1,637 @@
+#include <mpi.h>
+#include "matrix_multiplication.h"
+#include "instrumentation.h"
+#include "partition.h"
+#include "arena.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+
+#if SIZE_MAX == UINT64_MAX
+#define MPI_SIZE_T MPI_UINT64_T
+#else
+#define MPI_SIZE_T MPI_UINT32_T
+#endif
+
+// Largest element count sent in one MPI call
+#define MPI_CHUNK ((size_t)1 << 30)
+
+// Dimensions rank 0 shares before any data moves
+enum { DIM_A_ROWS, DIM_A_COLS, DIM_B_ROWS, DIM_B_COLS, DIM_B_NNZ, DIM_ERROR, DIM_COUNT };
+
+// Communicator the multiplication runs over, MPI_COMM_NULL selects MPI_COMM_WORLD
+static MPI_Comm multiplication_comm = MPI_COMM_NULL;
+
+void set_multiplication_communicator(MPI_Comm comm) {
+    multiplication_comm = comm;
+}
+
+static void abort_on_failure(const void* ptr, const int rank, const char* what) {
+    if (ptr == NULL) {
+        fprintf(stderr, "[Process %d] Failed to allocate %s\n", rank, what);
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+}
+
+// Broadcast that splits buffers larger than an int count can describe
+static void broadcast_large(void* buffer, const size_t count, MPI_Datatype type, const size_t type_size, MPI_Comm comm) {
+    char* bytes = buffer;
+    for (size_t offset = 0; offset < count; offset += MPI_CHUNK) {
+        const size_t chunk = count - offset < MPI_CHUNK ? count - offset : MPI_CHUNK;
+        MPI_Bcast(bytes + offset * type_size, (int)chunk, type, 0, comm);
+    }
+}
+
+// Contiguous block of equally many rows for rank, spreading the remainder over the first ranks
+static void rank_row_range(const size_t rows, const int rank, const int size, size_t* start, size_t* count) {
+    const size_t rows_per_proc = rows / size;
+    const size_t remainder = rows % size;
+    *start = rank * rows_per_proc + ((size_t)rank < remainder ? (size_t)rank : remainder);
+    *count = rows_per_proc + ((size_t)rank < remainder ? 1 : 0);
+}
+
+// First row of every rank's block followed by the row count, size + 1 entries on every rank.
+// Rank 0 splits A by estimated multiply-adds of A * B, or by its nnz when B is NULL (dense right-hand
+// sides), falling back to equal row counts if the estimate cannot be allocated.
+static size_t* row_block_bounds(const CompressedMatrix* A, const CompressedMatrix* B, const size_t* dims,
+                                const int rank, const int size, MPI_Comm comm) {
+    // Cleared so the buffer other ranks broadcast into is never read uninitialised
+    size_t* bounds = calloc((size_t)size + 1, sizeof(size_t));
+    abort_on_failure(bounds, rank, "row block bounds");
+
+    if (rank == 0) {
+        size_t* estimate = B ? estimate_row_costs(A, B) : NULL;
+        const size_t* costs = B ? estimate : A->row_ptr;
+        if (costs) {
+            partition_rows(costs, dims[DIM_A_ROWS], size, bounds);
+            matrix_free(estimate);
+        } else {
+            size_t count;
+            for (int r = 0; r < size; r++) {
+                rank_row_range(dims[DIM_A_ROWS], r, size, &bounds[r], &count);
+            }
+            bounds[size] = dims[DIM_A_ROWS];
+        }
+    }
+    MPI_Bcast(bounds, size + 1, MPI_SIZE_T, 0, comm);
+    return bounds;
+}
+
+// Displacements and counts in elements must fit an int for the v-collectives
+static int fits_int_counts(const size_t* counts, const size_t* displs, const int size) {
+    for (int r = 0; r < size; r++) {
+        if (counts[r] > INT_MAX || displs[r] > INT_MAX) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void to_int_counts(const size_t* counts, const size_t* displs, int* int_counts, int* int_displs, const int size) {
+    for (int r = 0; r < size; r++) {
+        int_counts[r] = (int)counts[r];
+        int_displs[r] = (int)displs[r];
+    }
+}
+
+// Rank 0 sends every rank its row block of A in compressed form
+static CompressedMatrix* scatter_row_blocks(const CompressedMatrix* A, const size_t* dims, const size_t* bounds,
+                                            const int rank, const int size, MPI_Comm comm) {
+    const size_t local_rows = bounds[rank + 1] - bounds[rank];
+
+    size_t* row_counts = NULL;
+    size_t* row_displs = NULL;
+    size_t* nnz_counts = NULL;
+    size_t* nnz_displs = NULL;
+    int* counts = NULL;
+    int* displs = NULL;
+    int fits = 1;
+
+    if (rank == 0) {
+        row_counts = malloc(size * sizeof(size_t));
+        row_displs = malloc(size * sizeof(size_t));
+        nnz_counts = malloc(size * sizeof(size_t));
+        nnz_displs = malloc(size * sizeof(size_t));
+        counts = malloc(size * sizeof(int));
+        displs = malloc(size * sizeof(int));
+        if (!row_counts || !row_displs || !nnz_counts || !nnz_displs || !counts || !displs) {
+            abort_on_failure(NULL, rank, "scatter counts");
+        }
+
+        for (int r = 0; r < size; r++) {
+            row_displs[r] = bounds[r];
+            row_counts[r] = bounds[r + 1] - bounds[r];
+            nnz_displs[r] = A->row_ptr[row_displs[r]];
+            nnz_counts[r] = A->row_ptr[row_displs[r] + row_counts[r]] - nnz_displs[r];
+        }
+        fits = fits_int_counts(row_counts, row_displs, size) && fits_int_counts(nnz_counts, nnz_displs, size);
+    }
+
+    MPI_Bcast(&fits, 1, MPI_INT, 0, comm);
+    if (!fits) {
+        if (rank == 0) {
+            fprintf(stderr, "Error: Matrix A is too large to scatter with int counts\n");
+        }
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    size_t local_nnz;
+    MPI_Scatter(nnz_counts, 1, MPI_SIZE_T, &local_nnz, 1, MPI_SIZE_T, 0, comm);
+
+    CompressedMatrix* local = allocate_compressed_matrix(local_rows, dims[DIM_A_COLS]);
+    abort_on_failure(local, rank, "local row block");
+    if (allocate_compressed_storage(local, local_nnz) != 0) {
+        abort_on_failure(NULL, rank, "local row block storage");
+    }
+
+    // Row offsets arrive relative to A and are rebased to the block
+    if (rank == 0) to_int_counts(row_counts, row_displs, counts, displs, size);
+    MPI_Scatterv(rank == 0 ? A->row_ptr : NULL, counts, displs, MPI_SIZE_T,
+                 local->row_ptr, (int)local_rows, MPI_SIZE_T, 0, comm);
+    const size_t base = local_rows > 0 ? local->row_ptr[0] : 0;
+    for (size_t i = 0; i < local_rows; i++) {
+        local->row_ptr[i] -= base;
+    }
+    local->row_ptr[local_rows] = local_nnz;
+
+    if (rank == 0) to_int_counts(nnz_counts, nnz_displs, counts, displs, size);
+    MPI_Scatterv(rank == 0 ? A->values : NULL, counts, displs, MPI_INT,
+                 local->values, (int)local_nnz, MPI_INT, 0, comm);
+    MPI_Scatterv(rank == 0 ? A->col_idx : NULL, counts, displs, MPI_INT,
+                 local->col_idx, (int)local_nnz, MPI_INT, 0, comm);
+
+    // Only data that leaves rank 0 is counted
+    if (rank == 0) {
+        PROFILE_COUNT(PROFILE_BYTES_SENT, (A->num_rows - row_counts[0]) * sizeof(size_t)
+                                          + (A->nnz - nnz_counts[0]) * 2 * sizeof(int));
+    } else {
+        PROFILE_COUNT(PROFILE_BYTES_RECEIVED, local_rows * sizeof(size_t) + local_nnz * 2 * sizeof(int));
+    }
+
+    free(row_counts);
+    free(row_displs);
+    free(nnz_counts);
+    free(nnz_displs);
+    free(counts);
+    free(displs);
+    return local;
+}
+
+// Every rank receives all of B as flat CSR buffers; rank 0 keeps its own copy
+static CompressedMatrix* broadcast_matrix(const CompressedMatrix* B, const size_t* dims, const int rank, const int size, MPI_Comm comm) {
+    (void)size;  // Only counted into the profile, which may be compiled out
+    CompressedMatrix* replica = (CompressedMatrix*)B;
+    if (rank != 0) {
+        replica = allocate_compressed_matrix(dims[DIM_B_ROWS], dims[DIM_B_COLS]);
+        abort_on_failure(replica, rank, "replica of B");
+        if (allocate_compressed_storage(replica, dims[DIM_B_NNZ]) != 0) {
+            abort_on_failure(NULL, rank, "replica of B storage");
+        }
+    }
+
+    broadcast_large(replica->row_ptr, dims[DIM_B_ROWS] + 1, MPI_SIZE_T, sizeof(size_t), comm);
+    broadcast_large(replica->col_idx, dims[DIM_B_NNZ], MPI_INT, sizeof(int), comm);
+    broadcast_large(replica->values, dims[DIM_B_NNZ], MPI_INT, sizeof(int), comm);
+
+    if (rank == 0) {
+        PROFILE_COUNT(PROFILE_BYTES_SENT, (size_t)(size - 1) * ((dims[DIM_B_ROWS] + 1) * sizeof(size_t)
+                                                                + dims[DIM_B_NNZ] * 2 * sizeof(int)));
+    } else {
+        PROFILE_COUNT(PROFILE_BYTES_RECEIVED, (dims[DIM_B_ROWS] + 1) * sizeof(size_t) + dims[DIM_B_NNZ] * 2 * sizeof(int));
+    }
+    return replica;
+}
+
+// Rank 0 collects every block of the product into one compressed matrix
+static CompressedMatrix* gather_row_blocks(const CompressedMatrix* local, const size_t* dims, const size_t* bounds,
+                                           const int rank, const int size, MPI_Comm comm) {
+    const size_t local_rows = bounds[rank + 1] - bounds[rank];
+
+    size_t* nnz_counts = NULL;
+    size_t* nnz_displs = NULL;
+    size_t* row_counts = NULL;
+    size_t* row_displs = NULL;
+    int* counts = NULL;
+    int* displs = NULL;
+    CompressedMatrix* result = NULL;
+    int fits = 1;
+
+    if (rank == 0) {
+        nnz_counts = malloc(size * sizeof(size_t));
+        nnz_displs = malloc(size * sizeof(size_t));
+        row_counts = malloc(size * sizeof(size_t));
+        row_displs = malloc(size * sizeof(size_t));
+        counts = malloc(size * sizeof(int));
+        displs = malloc(size * sizeof(int));
+        if (!nnz_counts || !nnz_displs || !row_counts || !row_displs || !counts || !displs) {
+            abort_on_failure(NULL, rank, "gather counts");
+        }
+    }
+
+    MPI_Gather(&local->nnz, 1, MPI_SIZE_T, nnz_counts, 1, MPI_SIZE_T, 0, comm);
+
+    if (rank == 0) {
+        size_t total = 0;
+        for (int r = 0; r < size; r++) {
+            row_displs[r] = bounds[r];
+            row_counts[r] = bounds[r + 1] - bounds[r];
+            nnz_displs[r] = total;
+            total += nnz_counts[r];
+        }
+        fits = fits_int_counts(row_counts, row_displs, size) && fits_int_counts(nnz_counts, nnz_displs, size);
+
+        result = allocate_compressed_matrix(dims[DIM_A_ROWS], dims[DIM_B_COLS]);
+        abort_on_failure(result, rank, "gathered product");
+        if (fits && allocate_compressed_storage(result, total) != 0) {
+            abort_on_failure(NULL, rank, "gathered product storage");
+        }
+    }
+
+    MPI_Bcast(&fits, 1, MPI_INT, 0, comm);
+    if (!fits) {
+        if (rank == 0) {
+            fprintf(stderr, "Error: Product is too large to gather with int counts\n");
+        }
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    // Each block's offsets start at 0 and are shifted by the nnz of the blocks before it
+    if (rank == 0) to_int_counts(row_counts, row_displs, counts, displs, size);
+    MPI_Gatherv(local->row_ptr, (int)local_rows, MPI_SIZE_T,
+                rank == 0 ? result->row_ptr : NULL, counts, displs, MPI_SIZE_T, 0, comm);
+
+    if (rank == 0) {
+        for (int r = 0; r < size; r++) {
+            for (size_t i = row_displs[r]; i < row_displs[r] + row_counts[r]; i++) {
+                result->row_ptr[i] += nnz_displs[r];
+            }
+        }
+        result->row_ptr[result->num_rows] = result->nnz;
+        to_int_counts(nnz_counts, nnz_displs, counts, displs, size);
+    }
+
+    MPI_Gatherv(local->values, (int)local->nnz, MPI_INT,
+                rank == 0 ? result->values : NULL, counts, displs, MPI_INT, 0, comm);
+    MPI_Gatherv(local->col_idx, (int)local->nnz, MPI_INT,
+                rank == 0 ? result->col_idx : NULL, counts, displs, MPI_INT, 0, comm);
+
+    if (rank == 0) {
+        PROFILE_COUNT(PROFILE_BYTES_RECEIVED, (result->num_rows - row_counts[0]) * sizeof(size_t)
+                                              + (result->nnz - nnz_counts[0]) * 2 * sizeof(int));
+    } else {
+        PROFILE_COUNT(PROFILE_BYTES_SENT, local_rows * sizeof(size_t) + local->nnz * 2 * sizeof(int));
+    }
+
+    free(nnz_counts);
+    free(nnz_displs);
+    free(row_counts);
+    free(row_displs);
+    free(counts);
+    free(displs);
+    return result;
+}
+
+CompressedMatrix* multiply_matrices_mpi(const CompressedMatrix* A, const CompressedMatrix* B, parallelisation_type local_type) {
+    int rank, size;
+    MPI_Comm comm = multiplication_comm == MPI_COMM_NULL ? MPI_COMM_WORLD : multiplication_comm;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    size_t dims[DIM_COUNT] = {0};
+    if (rank == 0) {
+        if (A == NULL || B == NULL) {
+            fprintf(stderr, "[Process %d] Error: NULL matrix pointer\n", rank);
+            dims[DIM_ERROR] = 1;
+        } else if (A->num_cols != B->num_rows) {
+            fprintf(stderr, "Error: Incompatible matrix dimensions for multiplication\n");
+            dims[DIM_ERROR] = 1;
+        } else {
+            dims[DIM_A_ROWS] = A->num_rows;
+            dims[DIM_A_COLS] = A->num_cols;
+            dims[DIM_B_ROWS] = B->num_rows;
+            dims[DIM_B_COLS] = B->num_cols;
+            dims[DIM_B_NNZ] = B->nnz;
+        }
+    }
+
+    MPI_Bcast(dims, DIM_COUNT, MPI_SIZE_T, 0, comm);
+    if (dims[DIM_ERROR]) {
+        return NULL;
+    }
+
+    PROFILE_BEGIN("multiply_mpi");
+    PROFILE_BEGIN("mpi_scatter");
+    size_t* bounds = row_block_bounds(A, B, dims, rank, size, comm);
+    CompressedMatrix* local_a = scatter_row_blocks(A, dims, bounds, rank, size, comm);
+    PROFILE_END("mpi_scatter");
+    PROFILE_BEGIN("mpi_broadcast");
+    CompressedMatrix* replica_b = broadcast_matrix(B, dims, rank, size, comm);
+    PROFILE_END("mpi_broadcast");
+
+    // Each block is multiplied on this rank alone, with OpenMP threads for hybrid runs
+    if (local_type != MULT_OMP) {
+        local_type = MULT_SEQUENTIAL;
+    }
+    PROFILE_BEGIN("mpi_local");
+    CompressedMatrix* local_result = multiply_matrices_sparse(local_a, replica_b, local_type);
+    PROFILE_END("mpi_local");
+    abort_on_failure(local_result, rank, "local product");
+
+    free_compressed_matrix(local_a);
+    if (replica_b != B) {
+        free_compressed_matrix(replica_b);
+    }
+
+    PROFILE_BEGIN("mpi_gather");
+    CompressedMatrix* result = gather_row_blocks(local_result, dims, bounds, rank, size, comm);
+    PROFILE_END("mpi_gather");
+    free_compressed_matrix(local_result);
+    free(bounds);
+    PROFILE_END("multiply_mpi");
+    return result;
+}
+int multiply_matrix_dense_mpi(const CompressedMatrix* A, const DenseMatrix* X, DenseMatrix* Y, parallelisation_type local_type) {
+    int rank, size;
+    MPI_Comm comm = multiplication_comm == MPI_COMM_NULL ? MPI_COMM_WORLD : multiplication_comm;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    // X takes the place of B; the padded strides of X and Y travel with it so every rank lays rows out alike
+    size_t dims[DIM_COUNT] = {0};
+    size_t strides[2] = {0, 0};
+    if (rank == 0) {
+        if (A == NULL || X == NULL || Y == NULL) {
+            fprintf(stderr, "[Process %d] Error: NULL matrix pointer\n", rank);
+            dims[DIM_ERROR] = 1;
+        } else if (A->num_cols != X->rows || A->num_rows != Y->rows || X->cols != Y->cols) {
+            fprintf(stderr, "Error: Incompatible matrix dimensions for multiplication\n");
+            dims[DIM_ERROR] = 1;
+        } else {
+            dims[DIM_A_ROWS] = A->num_rows;
+            dims[DIM_A_COLS] = A->num_cols;
+            dims[DIM_B_ROWS] = X->rows;
+            dims[DIM_B_COLS] = X->cols;
+            dims[DIM_B_NNZ] = X->rows * X->stride;
+            strides[0] = X->stride;
+            strides[1] = Y->stride;
+        }
+    }
+
+    MPI_Bcast(dims, DIM_COUNT, MPI_SIZE_T, 0, comm);
+    if (dims[DIM_ERROR]) {
+        return -1;
+    }
+    MPI_Bcast(strides, 2, MPI_SIZE_T, 0, comm);
+    const size_t stride = strides[1];
+
+    PROFILE_BEGIN("multiply_vectors_mpi");
+    PROFILE_BEGIN("mpi_scatter");
+    size_t* bounds = row_block_bounds(A, NULL, dims, rank, size, comm);
+    CompressedMatrix* local_a = scatter_row_blocks(A, dims, bounds, rank, size, comm);
+    PROFILE_END("mpi_scatter");
+
+    PROFILE_BEGIN("mpi_broadcast");
+    DenseMatrix replica_x = {NULL, dims[DIM_B_ROWS], dims[DIM_B_COLS], strides[0], dims[DIM_B_NNZ] * sizeof(int), 0};
+    replica_x.data = rank == 0 ? X->data : malloc((dims[DIM_B_NNZ] > 0 ? dims[DIM_B_NNZ] : 1) * sizeof(int));
+    abort_on_failure(replica_x.data, rank, "replica of X");
+    broadcast_large(replica_x.data, dims[DIM_B_NNZ], MPI_INT, sizeof(int), comm);
+    if (rank == 0) {
+        PROFILE_COUNT(PROFILE_BYTES_SENT, (size_t)(size - 1) * dims[DIM_B_NNZ] * sizeof(int));
+    } else {
+        PROFILE_COUNT(PROFILE_BYTES_RECEIVED, dims[DIM_B_NNZ] * sizeof(int));
+    }
+    PROFILE_END("mpi_broadcast");
+
+    // Rank 0 writes its block straight into Y, the others into a block of their own
+    const size_t local_rows = bounds[rank + 1] - bounds[rank];
+    const size_t local_elements = local_rows * stride;
+    DenseMatrix local_y = {NULL, local_rows, dims[DIM_B_COLS], stride, local_elements * sizeof(int), 0};
+    local_y.data = rank == 0 ? Y->data : malloc((local_elements > 0 ? local_elements : 1) * sizeof(int));
+    abort_on_failure(local_y.data, rank, "local block of Y");
+
+    if (local_type != MULT_OMP) {
+        local_type = MULT_SEQUENTIAL;
+    }
+    PROFILE_BEGIN("mpi_local");
+    multiply_matrix_dense(local_a, &replica_x, &local_y, local_type);
+    PROFILE_END("mpi_local");
+    free_compressed_matrix(local_a);
+    if (rank != 0) {
+        free(replica_x.data);
+    }
+
+    // Blocks are whole padded rows, so Y's rows arrive in place
+    PROFILE_BEGIN("mpi_gather");
+    size_t* counts = NULL;
+    size_t* displs = NULL;
+    int* int_counts = NULL;
+    int* int_displs = NULL;
+    int fits = 1;
+    if (rank == 0) {
+        counts = malloc(size * sizeof(size_t));
+        displs = malloc(size * sizeof(size_t));
+        int_counts = malloc(size * sizeof(int));
+        int_displs = malloc(size * sizeof(int));
+        if (!counts || !displs || !int_counts || !int_displs) {
+            abort_on_failure(NULL, rank, "gather counts");
+        }
+        for (int r = 0; r < size; r++) {
+            displs[r] = bounds[r] * stride;
+            counts[r] = (bounds[r + 1] - bounds[r]) * stride;
+        }
+        fits = fits_int_counts(counts, displs, size);
+        if (fits) to_int_counts(counts, displs, int_counts, int_displs, size);
+    }
+    MPI_Bcast(&fits, 1, MPI_INT, 0, comm);
+    if (!fits) {
+        if (rank == 0) {
+            fprintf(stderr, "Error: Product is too large to gather with int counts\n");
+        }
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+    MPI_Gatherv(rank == 0 ? MPI_IN_PLACE : local_y.data, (int)local_elements, MPI_INT,
+                rank == 0 ? Y->data : NULL, int_counts, int_displs, MPI_INT, 0, comm);
+    if (rank == 0) {
+        PROFILE_COUNT(PROFILE_BYTES_RECEIVED, (dims[DIM_A_ROWS] - local_rows) * stride * sizeof(int));
+    } else {
+        PROFILE_COUNT(PROFILE_BYTES_SENT, local_elements * sizeof(int));
+        free(local_y.data);
+    }
+    PROFILE_END("mpi_gather");
+
+    free(counts);
+    free(displs);
+    free(int_counts);
+    free(int_displs);
+    free(bounds);
+    PROFILE_END("multiply_vectors_mpi");
+    return 0;
+}
+
+struct DistributedPlan {
+    MPI_Comm comm;  // Duplicate of the multiplication communicator, so plans never match other messages
+    int rank;
+    int size;
+    size_t dims[DIM_COUNT];
+    size_t a_nnz;  // Rank 0 checks every execution's inputs against dims and these
+    size_t* bounds;
+    CompressedMatrix* local_a;  // This rank's row block, its values replaced by every execution
+    CompressedMatrix* replica_b;  // NULL on rank 0, which multiplies by B itself
+    MultiplicationPlan* local;  // Plan of the row block times B
+    CompressedMatrix* product;  // Structure of the whole product, on rank 0 alone
+    int* a_counts;  // Rank 0: elements of A and of the product in every rank's block, and their offsets
+    int* a_displs;
+    int* product_counts;
+    int* product_displs;
+};
+
+static DistributedPlan* build_distributed_plan(const CompressedMatrix* A, const CompressedMatrix* B, parallelisation_type local_type) {
+    MPI_Comm comm = multiplication_comm == MPI_COMM_NULL ? MPI_COMM_WORLD : multiplication_comm;
+    int rank, size;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    size_t dims[DIM_COUNT] = {0};
+    if (rank == 0) {
+        if (A == NULL || B == NULL) {
+            fprintf(stderr, "[Process %d] Error: NULL matrix pointer\n", rank);
+            dims[DIM_ERROR] = 1;
+        } else if (A->num_cols != B->num_rows) {
+            fprintf(stderr, "Error: Incompatible matrix dimensions for multiplication\n");
+            dims[DIM_ERROR] = 1;
+        } else {
+            dims[DIM_A_ROWS] = A->num_rows;
+            dims[DIM_A_COLS] = A->num_cols;
+            dims[DIM_B_ROWS] = B->num_rows;
+            dims[DIM_B_COLS] = B->num_cols;
+            dims[DIM_B_NNZ] = B->nnz;
+        }
+    }
+    MPI_Bcast(dims, DIM_COUNT, MPI_SIZE_T, 0, comm);
+    if (dims[DIM_ERROR]) {
+        return NULL;
+    }
+
+    DistributedPlan* plan = calloc(1, sizeof(DistributedPlan));
+    abort_on_failure(plan, rank, "distributed plan");
+    MPI_Comm_dup(comm, &plan->comm);
+    comm = plan->comm;
+    plan->rank = rank;
+    plan->size = size;
+    for (int d = 0; d < DIM_COUNT; d++) {
+        plan->dims[d] = dims[d];
+    }
+
+    PROFILE_BEGIN("plan_create_mpi");
+    plan->bounds = row_block_bounds(A, B, dims, rank, size, comm);
+    plan->local_a = scatter_row_blocks(A, dims, plan->bounds, rank, size, comm);
+    CompressedMatrix* replica_b = broadcast_matrix(B, dims, rank, size, comm);
+    plan->replica_b = replica_b != B ? replica_b : NULL;
+
+    plan->local = create_multiplication_plan(plan->local_a, replica_b, local_type == MULT_OMP ? MULT_OMP : MULT_SEQUENTIAL);
+    abort_on_failure(plan->local, rank, "local plan");
+    plan->product = gather_row_blocks(get_plan_product(plan->local), dims, plan->bounds, rank, size, comm);
+
+    // Executions move values only, with the counts of this split
+    if (rank == 0) {
+        plan->a_nnz = A->nnz;
+        plan->a_counts = malloc(size * sizeof(int));
+        plan->a_displs = malloc(size * sizeof(int));
+        plan->product_counts = malloc(size * sizeof(int));
+        plan->product_displs = malloc(size * sizeof(int));
+        if (!plan->a_counts || !plan->a_displs || !plan->product_counts || !plan->product_displs) {
+            abort_on_failure(NULL, rank, "plan counts");
+        }
+        // Both were checked to fit int counts when the structure moved
+        for (int r = 0; r < size; r++) {
+            plan->a_displs[r] = (int)A->row_ptr[plan->bounds[r]];
+            plan->a_counts[r] = (int)(A->row_ptr[plan->bounds[r + 1]] - A->row_ptr[plan->bounds[r]]);
+            plan->product_displs[r] = (int)plan->product->row_ptr[plan->bounds[r]];
+            plan->product_counts[r] = (int)(plan->product->row_ptr[plan->bounds[r + 1]] - plan->product->row_ptr[plan->bounds[r]]);
+        }
+    }
+    PROFILE_END("plan_create_mpi");
+    return plan;
+}
+
+DistributedPlan* create_distributed_plan(const CompressedMatrix* A, const CompressedMatrix* B, parallelisation_type local_type) {
+    // The row blocks, B's replica and the gathered structure live as long as the plan, not the arena
+    Arena* arena = get_matrix_arena();
+    set_matrix_arena(NULL);
+    DistributedPlan* plan = build_distributed_plan(A, B, local_type);
+    set_matrix_arena(arena);
+    return plan;
+}
+
+const CompressedMatrix* execute_distributed_plan(DistributedPlan* plan, const CompressedMatrix* A, const CompressedMatrix* B) {
+    const int rank = plan->rank;
+    const size_t* dims = plan->dims;
+
+    // Rank 0 alone sees the inputs, so every rank learns from it whether they fit the plan
+    int mismatch = 0;
+    if (rank == 0) {
+        mismatch = A == NULL || B == NULL || A->num_rows != dims[DIM_A_ROWS] || A->num_cols != dims[DIM_A_COLS]
+                   || A->nnz != plan->a_nnz || B->num_rows != dims[DIM_B_ROWS] || B->num_cols != dims[DIM_B_COLS]
+                   || B->nnz != dims[DIM_B_NNZ];
+        if (mismatch) {
+            fprintf(stderr, "Error: Inputs do not have the patterns the multiplication plan was created for\n");
+        }
+    }
+    MPI_Bcast(&mismatch, 1, MPI_INT, 0, plan->comm);
+    if (mismatch) {
+        return NULL;
+    }
+
+    PROFILE_BEGIN("plan_execute_mpi");
+    PROFILE_BEGIN("mpi_scatter");
+    MPI_Scatterv(rank == 0 ? A->values : NULL, plan->a_counts, plan->a_displs, MPI_INT,
+                 plan->local_a->values, (int)plan->local_a->nnz, MPI_INT, 0, plan->comm);
+    PROFILE_END("mpi_scatter");
+    PROFILE_BEGIN("mpi_broadcast");
+    const CompressedMatrix* local_b = rank == 0 ? B : plan->replica_b;
+    broadcast_large(local_b->values, dims[DIM_B_NNZ], MPI_INT, sizeof(int), plan->comm);
+    if (rank == 0) {
+        PROFILE_COUNT(PROFILE_BYTES_SENT, (A->nnz - (size_t)plan->a_counts[0] + (size_t)(plan->size - 1) * dims[DIM_B_NNZ]) * sizeof(int));
+    } else {
+        PROFILE_COUNT(PROFILE_BYTES_RECEIVED, (plan->local_a->nnz + dims[DIM_B_NNZ]) * sizeof(int));
+    }
+    PROFILE_END("mpi_broadcast");
+
+    PROFILE_BEGIN("mpi_local");
+    const CompressedMatrix* local_product = execute_multiplication_plan(plan->local, plan->local_a, local_b);
+    PROFILE_END("mpi_local");
+
+    PROFILE_BEGIN("mpi_gather");
+    MPI_Gatherv(local_product->values, (int)local_product->nnz, MPI_INT,
+                rank == 0 ? plan->product->values : NULL, plan->product_counts, plan->product_displs, MPI_INT, 0, plan->comm);
+    if (rank == 0) {
+        PROFILE_COUNT(PROFILE_BYTES_RECEIVED, (plan->product->nnz - local_product->nnz) * sizeof(int));
+    } else {
+        PROFILE_COUNT(PROFILE_BYTES_SENT, local_product->nnz * sizeof(int));
+    }
+    PROFILE_END("mpi_gather");
+    PROFILE_END("plan_execute_mpi");
+    return plan->product;
+}
+
+const CompressedMatrix* get_distributed_plan_product(const DistributedPlan* plan) {
+    return plan->product;
+}
+
+void free_distributed_plan(DistributedPlan* plan) {
+    if (!plan) {
+        return;
+    }
+    free_multiplication_plan(plan->local);
+    free_compressed_matrix(plan->local_a);
+    free_compressed_matrix(plan->replica_b);
+    free_compressed_matrix(plan->product);
+    free(plan->bounds);
+    free(plan->a_counts);
+    free(plan->a_displs);
+    free(plan->product_counts);
+    free(plan->product_displs);
+    MPI_Comm_free(&plan->comm);
+    free(plan);
+}
@@ -0,0 +1,348 @@
+#include "out_of_core.h"
+#include "matrix_io.h"
+#include "instrumentation.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+// Bytes moved at a time when the spilled values are copied into place
+#define COPY_BUFFER_BYTES ((size_t)8 << 20)
+
+// Rows [first_row, first_row + rows) of A
+typedef struct {
+    size_t first_row;
+    size_t rows;
+} PanelRange;
+
+// Product file being written; values spill to a second file until nnz fixes where they go
+typedef struct {
+    const char* path;
+    int fd;
+    int values_fd;
+    CompressedFileHeader header;  // Offsets of row_ptr and col_idx, which do not depend on nnz
+} OutputFile;
+
+// I/O the helper thread does while a panel is multiplied
+typedef struct {
+    const char* a_path;
+    int a_fd;
+    const CompressedFileHeader* a_header;
+    const size_t* a_row_ptr;  // Row offsets of all of A
+    CompressedMatrix* panel;  // Buffer the next panel is read into, NULL when there is none
+    PanelRange range;
+    OutputFile* out;
+    CompressedMatrix* product;  // Product of the previous panel, NULL when there is none
+    size_t product_first_row;
+    size_t product_offset;  // Elements of the output written before it
+    int status;
+} IoTask;
+
+static int read_fully(const int fd, void* buffer, size_t bytes, off_t offset) {
+    char* p = buffer;
+    while (bytes > 0) {
+        const ssize_t got = pread(fd, p, bytes, offset);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            // A file shorter than its header claims reads as an I/O error
+            errno = got == 0 ? EIO : errno;
+            return -1;
+        }
+        p += got;
+        bytes -= (size_t)got;
+        offset += got;
+    }
+    return 0;
+}
+
+static int write_fully(const int fd, const void* buffer, size_t bytes, off_t offset) {
+    const char* p = buffer;
+    while (bytes > 0) {
+        const ssize_t put = pwrite(fd, p, bytes, offset);
+        if (put < 0 && errno == EINTR) {
+            continue;
+        }
+        if (put <= 0) {
+            errno = put == 0 ? EIO : errno;
+            return -1;
+        }
+        p += put;
+        bytes -= (size_t)put;
+        offset += put;
+    }
+    return 0;
+}
+
+// One past the last row of the panel starting at first, which grows while it fits in panel_bytes
+static size_t panel_end(const size_t* row_ptr, const size_t rows, const size_t first, const size_t panel_bytes) {
+    size_t end = first + 1;
+    while (end < rows && (end + 1 - first) * sizeof(size_t)
+                         + (row_ptr[end + 1] - row_ptr[first]) * (sizeof(int) + sizeof(int)) <= panel_bytes) {
+        end++;
+    }
+    return end;
+}
+
+// Splits A into panels of consecutive rows holding at most panel_bytes each, at least one row per panel.
+// Returns the number of panels and the largest panel's rows and elements; NULL ranges on failure.
+static size_t plan_panels(const size_t* row_ptr, const size_t rows, const size_t panel_bytes,
+                          PanelRange** ranges, size_t* max_rows, size_t* max_nnz) {
+    *max_rows = 0;
+    *max_nnz = 0;
+
+    // Panels are counted first so the plan holds one entry per panel, not per row
+    size_t count = 0;
+    for (size_t first = 0; first < rows; first = panel_end(row_ptr, rows, first, panel_bytes)) {
+        count++;
+    }
+    *ranges = malloc((count > 0 ? count : 1) * sizeof(PanelRange));
+    if (*ranges == NULL) {
+        fprintf(stderr, "Failed to allocate memory for the panel plan\n");
+        return 0;
+    }
+
+    count = 0;
+    for (size_t first = 0; first < rows;) {
+        const size_t end = panel_end(row_ptr, rows, first, panel_bytes);
+        (*ranges)[count].first_row = first;
+        (*ranges)[count].rows = end - first;
+        count++;
+        if (end - first > *max_rows) *max_rows = end - first;
+        if (row_ptr[end] - row_ptr[first] > *max_nnz) *max_nnz = row_ptr[end] - row_ptr[first];
+        first = end;
+    }
+    return count;
+}
+
+// Reads one panel of A into a buffer sized for the largest panel, rebasing its row offsets to 0
+static int read_panel(const IoTask* task) {
+    PROFILE_BEGIN("out_of_core_read");
+    CompressedMatrix* panel = task->panel;
+    const size_t* row_ptr = task->a_row_ptr + task->range.first_row;
+    const size_t base = row_ptr[0];
+    const size_t nnz = row_ptr[task->range.rows] - base;
+
+    panel->num_rows = task->range.rows;
+    panel->nnz = nnz;
+    for (size_t i = 0; i <= task->range.rows; i++) {
+        panel->row_ptr[i] = row_ptr[i] - base;
+    }
+    const int status = read_fully(task->a_fd, panel->col_idx, nnz * sizeof(int),
+                                  (off_t)(task->a_header->col_idx_offset + base * sizeof(int))) != 0
+                       || read_fully(task->a_fd, panel->values, nnz * sizeof(int),
+                                     (off_t)(task->a_header->values_offset + base * sizeof(int))) != 0 ? -1 : 0;
+    PROFILE_END("out_of_core_read");
+    if (status != 0) {
+        fprintf(stderr, "Error reading rows %zu to %zu of %s: %s\n", task->range.first_row,
+                task->range.first_row + task->range.rows, task->a_path, strerror(errno));
+    }
+    return status;
+}
+
+// Writes a panel's product at its place in the output, shifting its row offsets in place
+static int write_product(OutputFile* out, CompressedMatrix* product, const size_t first_row, const size_t offset) {
+    PROFILE_BEGIN("out_of_core_write");
+    for (size_t i = 0; i <= product->num_rows; i++) {
+        product->row_ptr[i] += offset;
+    }
+    const int status = write_fully(out->fd, product->row_ptr, (product->num_rows + 1) * sizeof(size_t),
+                                   (off_t)(out->header.row_ptr_offset + first_row * sizeof(size_t))) != 0
+                       || write_fully(out->fd, product->col_idx, product->nnz * sizeof(int),
+                                      (off_t)(out->header.col_idx_offset + offset * sizeof(int))) != 0
+                       || write_fully(out->values_fd, product->values, product->nnz * sizeof(int),
+                                      (off_t)(offset * sizeof(int))) != 0 ? -1 : 0;
+    PROFILE_END("out_of_core_write");
+    if (status != 0) {
+        fprintf(stderr, "Error writing product rows to %s: %s\n", out->path, strerror(errno));
+    }
+    return status;
+}
+
+static void* run_io_task(void* arg) {
+    IoTask* task = arg;
+    task->status = 0;
+    if (task->product && write_product(task->out, task->product, task->product_first_row, task->product_offset) != 0) {
+        task->status = -1;
+    }
+    if (task->panel && read_panel(task) != 0) {
+        task->status = -1;
+    }
+    return NULL;
+}
+
+// Moves the spilled values behind col_idx and writes the header now that nnz is known
+static int finish_output(OutputFile* out, const size_t rows, const size_t cols, const size_t nnz) {
+    build_compressed_file_header(rows, cols, nnz, &out->header);
+    char* buffer = malloc(COPY_BUFFER_BYTES);
+    int status = buffer ? 0 : -1;
+    const size_t bytes = nnz * sizeof(int);
+    for (size_t done = 0; status == 0 && done < bytes; done += COPY_BUFFER_BYTES) {
+        const size_t chunk = bytes - done < COPY_BUFFER_BYTES ? bytes - done : COPY_BUFFER_BYTES;
+        status = read_fully(out->values_fd, buffer, chunk, (off_t)done) != 0
+                 || write_fully(out->fd, buffer, chunk, (off_t)(out->header.values_offset + done)) != 0 ? -1 : 0;
+    }
+    const int allocated = buffer != NULL;
+    free(buffer);
+
+    // The last row offset and the header close the file; gaps between sections read back as zeros
+    if (status == 0) {
+        status = write_fully(out->fd, &nnz, sizeof(nnz), (off_t)(out->header.row_ptr_offset + rows * sizeof(size_t))) != 0
+                 || write_fully(out->fd, &out->header, sizeof(out->header), 0) != 0
+                 || ftruncate(out->fd, (off_t)(out->header.values_offset + bytes)) != 0 ? -1 : 0;
+    }
+    if (status != 0) {
+        fprintf(stderr, "Error finishing %s: %s\n", out->path, allocated ? strerror(errno) : "out of memory");
+    }
+    return status;
+}
+
+static int open_output(OutputFile* out, const char* path, const size_t rows, const size_t cols) {
+    out->path = path;
+    out->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (out->fd < 0) {
+        fprintf(stderr, "Error opening %s for writing: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    // The spill file is unlinked straight away so it disappears however the run ends
+    char values_path[4096];
+    snprintf(values_path, sizeof(values_path), "%s.values", path);
+    out->values_fd = open(values_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (out->values_fd < 0) {
+        fprintf(stderr, "Error opening %s for writing: %s\n", values_path, strerror(errno));
+        close(out->fd);
+        return -1;
+    }
+    unlink(values_path);
+    build_compressed_file_header(rows, cols, 0, &out->header);
+    return 0;
+}
+
+int multiply_matrices_out_of_core(const char* a_path, const char* b_path, const char* out_path,
+                                  size_t panel_bytes, const parallelisation_type local_type) {
+    if (local_type != MULT_SEQUENTIAL && local_type != MULT_OMP) {
+        fprintf(stderr, "Error: Out-of-core products run sequentially or with OpenMP only\n");
+        return -1;
+    }
+    if (panel_bytes == 0) {
+        panel_bytes = DEFAULT_PANEL_BYTES;
+    }
+
+    CompressedFileHeader a_header;
+    if (read_compressed_file_header(a_path, &a_header) != 0) {
+        return -1;
+    }
+    // B is read for every panel, so it stays mapped and the page cache keeps it resident
+    CompressedMatrix* B = map_compressed_matrix(b_path);
+    if (!B) {
+        return -1;
+    }
+    if (a_header.num_cols != B->num_rows) {
+        fprintf(stderr, "Error: Incompatible matrix dimensions for multiplication\n");
+        free_compressed_matrix(B);
+        return -1;
+    }
+
+    const size_t rows = a_header.num_rows;
+    const int a_fd = open(a_path, O_RDONLY);
+    size_t* a_row_ptr = malloc((rows + 1) * sizeof(size_t));
+    if (a_fd < 0 || !a_row_ptr
+        || read_fully(a_fd, a_row_ptr, (rows + 1) * sizeof(size_t), (off_t)a_header.row_ptr_offset) != 0) {
+        fprintf(stderr, "Error reading the row offsets of %s\n", a_path);
+        if (a_fd >= 0) close(a_fd);
+        free(a_row_ptr);
+        free_compressed_matrix(B);
+        return -1;
+    }
+
+    PanelRange* ranges;
+    size_t max_rows, max_nnz;
+    const size_t num_panels = plan_panels(a_row_ptr, rows, panel_bytes, &ranges, &max_rows, &max_nnz);
+
+    // Two panel buffers: one is multiplied while the helper fills the other
+    CompressedMatrix* buffers[2] = {NULL, NULL};
+    int status = ranges ? 0 : -1;
+    for (int b = 0; b < 2 && status == 0; b++) {
+        buffers[b] = allocate_compressed_matrix(max_rows, a_header.num_cols);
+        status = buffers[b] && allocate_compressed_storage(buffers[b], max_nnz) == 0 ? 0 : -1;
+    }
+
+    OutputFile out;
+    const int opened = status == 0 && open_output(&out, out_path, rows, B->num_cols) == 0;
+    status = opened ? status : -1;
+
+    PROFILE_BEGIN("out_of_core");
+    IoTask task = {
+        .a_path = a_path,
+        .a_fd = a_fd,
+        .a_header = &a_header,
+        .a_row_ptr = a_row_ptr,
+        .out = &out,
+    };
+    if (status == 0 && num_panels > 0) {
+        task.panel = buffers[0];
+        task.range = ranges[0];
+        run_io_task(&task);
+        status = task.status;
+    }
+
+    CompressedMatrix* previous = NULL;
+    size_t written = 0;
+    for (size_t k = 0; status == 0 && k < num_panels; k++) {
+        // The helper writes the previous product and reads the next panel while this one is multiplied
+        task.panel = k + 1 < num_panels ? buffers[(k + 1) % 2] : NULL;
+        task.range = k + 1 < num_panels ? ranges[k + 1] : ranges[k];
+        pthread_t helper;
+        const int started = pthread_create(&helper, NULL, run_io_task, &task) == 0;
+        if (!started) {
+            run_io_task(&task);
+        }
+
+        CompressedMatrix* product = multiply_matrices_sparse(buffers[k % 2], B, local_type);
+
+        PROFILE_BEGIN("out_of_core_wait");
+        if (started) {
+            pthread_join(helper, NULL);
+        }
+        PROFILE_END("out_of_core_wait");
+        free_compressed_matrix(previous);
+        previous = product;
+        status = task.status != 0 || product == NULL ? -1 : 0;
+
+        if (product) {
+            task.product = product;
+            task.product_first_row = ranges[k].first_row;
+            task.product_offset = written;
+            written += product->nnz;
+        }
+    }
+    if (status == 0 && previous) {
+        status = write_product(&out, previous, task.product_first_row, task.product_offset);
+    }
+    free_compressed_matrix(previous);
+    if (status == 0) {
+        status = finish_output(&out, rows, B->num_cols, written);
+    }
+    PROFILE_END("out_of_core");
+
+    if (opened) {
+        close(out.fd);
+        close(out.values_fd);
+        if (status != 0) {
+            unlink(out_path);
+        }
+    }
+    free_compressed_matrix(buffers[0]);
+    free_compressed_matrix(buffers[1]);
+    free(ranges);
+    free(a_row_ptr);
+    close(a_fd);
+    free_compressed_matrix(B);
+    return status;
+}
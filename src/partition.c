@@ -0,0 +1,72 @@
+#include "partition.h"
+#include "arena.h"
+#include <stdlib.h>
+#include <omp.h>
+
+size_t* estimate_row_costs(const CompressedMatrix* A, const CompressedMatrix* B) {
+    size_t* costs = matrix_alloc((A->num_rows + 1) * sizeof(size_t));
+    if (!costs) {
+        return NULL;
+    }
+
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < A->num_rows; i++) {
+        size_t cost = 1;
+        for (size_t k = A->row_ptr[i]; k < A->row_ptr[i + 1]; k++) {
+            if (A->values[k] != 0) {
+                cost += ROW_SIZE(B, (size_t)A->col_idx[k]);
+            }
+        }
+        costs[i + 1] = cost;
+    }
+    scan_row_sizes(costs, A->num_rows);
+    return costs;
+}
+
+// Row boundary closest to target, the first row whose prefix reaches it or the one before
+static size_t find_boundary(const size_t* costs, const size_t rows, const size_t target) {
+    size_t lo = 0, hi = rows;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (costs[mid] < target) lo = mid + 1; else hi = mid;
+    }
+    if (lo > 0 && target - costs[lo - 1] < costs[lo] - target) {
+        lo--;
+    }
+    return lo;
+}
+
+// First row of part p, cutting the total cost at p / parts
+static size_t part_boundary(const size_t* costs, const size_t rows, const int p, const int parts) {
+    if (p >= parts) {
+        return rows;
+    }
+    // total * p / parts without overflowing
+    const size_t total = costs[rows];
+    const size_t target = total / parts * p + total % parts * p / parts;
+    return p > 0 ? find_boundary(costs, rows, target) : 0;
+}
+
+void partition_rows(const size_t* costs, const size_t rows, const int parts, size_t* bounds) {
+    for (int p = 0; p <= parts; p++) {
+        bounds[p] = part_boundary(costs, rows, p, parts);
+    }
+}
+
+void partition_range(const size_t* costs, const size_t rows, const int part, const int parts, size_t* begin, size_t* end) {
+    *begin = part_boundary(costs, rows, part, parts);
+    *end = part_boundary(costs, rows, part + 1, parts);
+}
+
+double partition_imbalance(const size_t* costs, const size_t* bounds, const int parts) {
+    const size_t total = costs[bounds[parts]] - costs[bounds[0]];
+    if (total == 0) {
+        return 1.0;
+    }
+    size_t max_cost = 0;
+    for (int p = 0; p < parts; p++) {
+        const size_t cost = costs[bounds[p + 1]] - costs[bounds[p]];
+        if (cost > max_cost) max_cost = cost;
+    }
+    return (double)max_cost * parts / (double)total;
+}
@@ -0,0 +1,312 @@
+#include "simd_kernels.h"
+#include <stdint.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define SIMD_X86
+#include <immintrin.h>
+#define TARGET_AVX2 __attribute__((target("avx2,popcnt")))
+#define TARGET_AVX512 __attribute__((target("avx512f,popcnt")))
+#endif
+
+// Level the CPU supports, -1 until detected; the cap is set between multiplications like the schedule
+static int detected_level = -1;
+static int level_cap = SIMD_AVX512;
+
+static int detect_level(void) {
+#ifdef SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("popcnt")) {
+        return SIMD_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        return SIMD_AVX2;
+    }
+#endif
+    return SIMD_SCALAR;
+}
+
+static int active_level(void) {
+    int level;
+    #pragma omp atomic read
+    level = detected_level;
+    if (level < 0) {
+        // Every thread detects the same level, so racing writes agree
+        level = detect_level();
+        #pragma omp atomic write
+        detected_level = level;
+    }
+    return level < level_cap ? level : level_cap;
+}
+
+void set_simd_level(SimdLevel level) {
+    level_cap = level;
+}
+
+SimdLevel get_simd_level(void) {
+    return (SimdLevel)active_level();
+}
+
+const char* get_simd_level_name(SimdLevel level) {
+    switch (level) {
+        case SIMD_SCALAR: return "scalar";
+        case SIMD_AVX2: return "avx2";
+        case SIMD_AVX512: return "avx512";
+        default: return "unknown";
+    }
+}
+
+static size_t count_nonzeros_scalar(const int* row, const size_t cols) {
+    size_t count = 0;
+    for (size_t j = 0; j < cols; j++) {
+        count += row[j] != 0;
+    }
+    return count;
+}
+
+static size_t extract_nonzeros_scalar(const int* row, const size_t cols, size_t j, int* values, int* col_idx, size_t pos) {
+    for (; j < cols; j++) {
+        if (row[j] != 0) {
+            values[pos] = row[j];
+            col_idx[pos] = (int)j;
+            pos++;
+        }
+    }
+    return pos;
+}
+
+static int gather_dot_scalar(const int* values, const int* cols, const size_t count, const int* x, const size_t stride) {
+    int sum = 0;
+    for (size_t j = 0; j < count; j++) {
+        sum += values[j] * x[(size_t)cols[j] * stride];
+    }
+    return sum;
+}
+
+// Columns [c, k) of sum_scaled_rows
+static void sum_scaled_rows_scalar(int* y, const int* x, const size_t stride, const int* values, const int* cols,
+                                   const size_t count, size_t c, const size_t k) {
+    for (; c < k; c++) {
+        int sum = 0;
+        for (size_t j = 0; j < count; j++) {
+            sum += values[j] * x[(size_t)cols[j] * stride + c];
+        }
+        y[c] = sum;
+    }
+}
+
+#ifdef SIMD_X86
+
+// pshufb masks moving the 32-bit lanes selected by a 4-bit mask to the front, in order
+static const uint8_t compress_shuffles[16][16] = {
+    {0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0x00, 0x01, 0x02, 0x03, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0x04, 0x05, 0x06, 0x07, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0x08, 0x09, 0x0a, 0x0b, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0x00, 0x01, 0x02, 0x03, 0x08, 0x09, 0x0a, 0x0b, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x80, 0x80, 0x80, 0x80},
+    {0x0c, 0x0d, 0x0e, 0x0f, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0x00, 0x01, 0x02, 0x03, 0x0c, 0x0d, 0x0e, 0x0f, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0x04, 0x05, 0x06, 0x07, 0x0c, 0x0d, 0x0e, 0x0f, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x0c, 0x0d, 0x0e, 0x0f, 0x80, 0x80, 0x80, 0x80},
+    {0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80},
+    {0x00, 0x01, 0x02, 0x03, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x80, 0x80, 0x80, 0x80},
+    {0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x80, 0x80, 0x80, 0x80},
+    {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f},
+};
+
+// Stores the lanes of x selected by mask to dst, writing only the first popcount(mask) elements
+TARGET_AVX2 static inline void store_compressed4(int* dst, const __m128i x, const unsigned mask, const int n) {
+    const __m128i packed = _mm_shuffle_epi8(x, _mm_loadu_si128((const __m128i*)compress_shuffles[mask]));
+    const __m128i lanes = _mm_cmpgt_epi32(_mm_set1_epi32(n), _mm_setr_epi32(0, 1, 2, 3));
+    _mm_maskstore_epi32(dst, lanes, packed);
+}
+
+// Mask of the non-zero lanes among 8
+TARGET_AVX2 static inline unsigned nonzero_mask8(const __m256i v) {
+    const __m256i zero = _mm256_cmpeq_epi32(v, _mm256_setzero_si256());
+    return ~(unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(zero)) & 0xFFu;
+}
+
+TARGET_AVX2 static size_t count_nonzeros_avx2(const int* row, const size_t cols) {
+    size_t count = 0, j = 0;
+    for (; j + 8 <= cols; j += 8) {
+        count += (size_t)__builtin_popcount(nonzero_mask8(_mm256_loadu_si256((const __m256i*)(row + j))));
+    }
+    return count + count_nonzeros_scalar(row + j, cols - j);
+}
+
+TARGET_AVX2 static size_t extract_nonzeros_avx2(const int* row, const size_t cols, int* values, int* col_idx) {
+    size_t pos = 0, j = 0;
+    const __m256i lane_offsets = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    for (; j + 8 <= cols; j += 8) {
+        const __m256i v = _mm256_loadu_si256((const __m256i*)(row + j));
+        const unsigned mask = nonzero_mask8(v);
+        if (mask == 0) continue;
+        const __m256i columns = _mm256_add_epi32(_mm256_set1_epi32((int)j), lane_offsets);
+
+        // AVX2 has no compress, so each 128-bit half is packed with pshufb
+        const unsigned low = mask & 0xFu, high = mask >> 4;
+        const int n_low = __builtin_popcount(low), n_high = __builtin_popcount(high);
+        store_compressed4(values + pos, _mm256_castsi256_si128(v), low, n_low);
+        store_compressed4(col_idx + pos, _mm256_castsi256_si128(columns), low, n_low);
+        pos += (size_t)n_low;
+        store_compressed4(values + pos, _mm256_extracti128_si256(v, 1), high, n_high);
+        store_compressed4(col_idx + pos, _mm256_extracti128_si256(columns, 1), high, n_high);
+        pos += (size_t)n_high;
+    }
+    return extract_nonzeros_scalar(row, cols, j, values, col_idx, pos);
+}
+
+TARGET_AVX512 static size_t count_nonzeros_avx512(const int* row, const size_t cols) {
+    size_t count = 0, j = 0;
+    for (; j + 16 <= cols; j += 16) {
+        const __m512i v = _mm512_loadu_si512(row + j);
+        count += (size_t)__builtin_popcount(_mm512_test_epi32_mask(v, v));
+    }
+    if (j < cols) {
+        const __m512i v = _mm512_maskz_loadu_epi32((__mmask16)((1u << (cols - j)) - 1), row + j);
+        count += (size_t)__builtin_popcount(_mm512_test_epi32_mask(v, v));
+    }
+    return count;
+}
+
+TARGET_AVX512 static size_t extract_nonzeros_avx512(const int* row, const size_t cols, int* values, int* col_idx) {
+    size_t pos = 0;
+    const __m512i lane_offsets = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    for (size_t j = 0; j < cols; j += 16) {
+        // The last block loads only the columns left, masked lanes read as zero
+        const __mmask16 in_row = cols - j >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (cols - j)) - 1);
+        const __m512i v = _mm512_maskz_loadu_epi32(in_row, row + j);
+        const __mmask16 mask = _mm512_test_epi32_mask(v, v);
+        if (mask == 0) continue;
+        const __m512i columns = _mm512_add_epi32(_mm512_set1_epi32((int)j), lane_offsets);
+        _mm512_mask_compressstoreu_epi32(values + pos, mask, v);
+        _mm512_mask_compressstoreu_epi32(col_idx + pos, mask, columns);
+        pos += (size_t)__builtin_popcount(mask);
+    }
+    return pos;
+}
+
+// Horizontal sum of the 8 lanes
+TARGET_AVX2 static inline int sum_lanes8(const __m256i v) {
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(sum);
+}
+
+TARGET_AVX2 static int gather_dot_avx2(const int* values, const int* cols, const size_t count, const int* x, const size_t stride) {
+    __m256i sum = _mm256_setzero_si256();
+    size_t j = 0;
+    if (stride == 1) {
+        for (; j + 8 <= count; j += 8) {
+            const __m256i idx = _mm256_loadu_si256((const __m256i*)(cols + j));
+            const __m256i v = _mm256_loadu_si256((const __m256i*)(values + j));
+            sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(v, _mm256_i32gather_epi32(x, idx, 4)));
+        }
+    }
+    return sum_lanes8(sum) + gather_dot_scalar(values + j, cols + j, count - j, x, stride);
+}
+
+TARGET_AVX2 static void sum_scaled_rows_avx2(int* y, const int* x, const size_t stride, const int* values, const int* cols,
+                                             const size_t count, const size_t k) {
+    size_t c = 0;
+    // Two vectors of y per pass over the row list, then one
+    for (; c + 16 <= k; c += 16) {
+        __m256i low = _mm256_setzero_si256(), high = _mm256_setzero_si256();
+        for (size_t j = 0; j < count; j++) {
+            const __m256i a = _mm256_set1_epi32(values[j]);
+            const int* row = x + (size_t)cols[j] * stride + c;
+            low = _mm256_add_epi32(low, _mm256_mullo_epi32(a, _mm256_loadu_si256((const __m256i*)row)));
+            high = _mm256_add_epi32(high, _mm256_mullo_epi32(a, _mm256_loadu_si256((const __m256i*)(row + 8))));
+        }
+        _mm256_storeu_si256((__m256i*)(y + c), low);
+        _mm256_storeu_si256((__m256i*)(y + c + 8), high);
+    }
+    for (; c + 8 <= k; c += 8) {
+        __m256i sum = _mm256_setzero_si256();
+        for (size_t j = 0; j < count; j++) {
+            const __m256i row = _mm256_loadu_si256((const __m256i*)(x + (size_t)cols[j] * stride + c));
+            sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(_mm256_set1_epi32(values[j]), row));
+        }
+        _mm256_storeu_si256((__m256i*)(y + c), sum);
+    }
+    sum_scaled_rows_scalar(y, x, stride, values, cols, count, c, k);
+}
+
+TARGET_AVX512 static int gather_dot_avx512(const int* values, const int* cols, const size_t count, const int* x, const size_t stride) {
+    if (stride != 1) {
+        return gather_dot_scalar(values, cols, count, x, stride);
+    }
+    __m512i sum = _mm512_setzero_si512();
+    for (size_t j = 0; j < count; j += 16) {
+        // The last block gathers only the elements left, masked lanes stay zero
+        const __mmask16 in_row = count - j >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (count - j)) - 1);
+        const __m512i idx = _mm512_maskz_loadu_epi32(in_row, cols + j);
+        const __m512i v = _mm512_maskz_loadu_epi32(in_row, values + j);
+        const __m512i gathered = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), in_row, idx, x, 4);
+        sum = _mm512_add_epi32(sum, _mm512_mullo_epi32(v, gathered));
+    }
+    return _mm512_reduce_add_epi32(sum);
+}
+
+TARGET_AVX512 static void sum_scaled_rows_avx512(int* y, const int* x, const size_t stride, const int* values, const int* cols,
+                                                 const size_t count, const size_t k) {
+    for (size_t c = 0; c < k; c += 16) {
+        const __mmask16 in_row = k - c >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << (k - c)) - 1);
+        __m512i sum = _mm512_setzero_si512();
+        for (size_t j = 0; j < count; j++) {
+            const __m512i row = _mm512_maskz_loadu_epi32(in_row, x + (size_t)cols[j] * stride + c);
+            sum = _mm512_add_epi32(sum, _mm512_mullo_epi32(_mm512_set1_epi32(values[j]), row));
+        }
+        _mm512_mask_storeu_epi32(y + c, in_row, sum);
+    }
+}
+
+#endif // SIMD_X86
+
+size_t count_nonzeros(const int* row, const size_t cols) {
+#ifdef SIMD_X86
+    switch (active_level()) {
+        case SIMD_AVX512: return count_nonzeros_avx512(row, cols);
+        case SIMD_AVX2: return count_nonzeros_avx2(row, cols);
+        default: break;
+    }
+#endif
+    return count_nonzeros_scalar(row, cols);
+}
+
+size_t extract_nonzeros(const int* row, const size_t cols, int* values, int* col_idx) {
+#ifdef SIMD_X86
+    switch (active_level()) {
+        case SIMD_AVX512: return extract_nonzeros_avx512(row, cols, values, col_idx);
+        case SIMD_AVX2: return extract_nonzeros_avx2(row, cols, values, col_idx);
+        default: break;
+    }
+#endif
+    return extract_nonzeros_scalar(row, cols, 0, values, col_idx, 0);
+}
+
+int gather_dot(const int* values, const int* cols, const size_t count, const int* x, const size_t stride) {
+#ifdef SIMD_X86
+    switch (active_level()) {
+        case SIMD_AVX512: return gather_dot_avx512(values, cols, count, x, stride);
+        case SIMD_AVX2: return gather_dot_avx2(values, cols, count, x, stride);
+        default: break;
+    }
+#endif
+    return gather_dot_scalar(values, cols, count, x, stride);
+}
+
+void sum_scaled_rows(int* y, const int* x, const size_t stride, const int* values, const int* cols, const size_t count, const size_t k) {
+#ifdef SIMD_X86
+    switch (active_level()) {
+        case SIMD_AVX512: sum_scaled_rows_avx512(y, x, stride, values, cols, count, k); return;
+        case SIMD_AVX2: sum_scaled_rows_avx2(y, x, stride, values, cols, count, k); return;
+        default: break;
+    }
+#endif
+    sum_scaled_rows_scalar(y, x, stride, values, cols, count, 0, k);
+}
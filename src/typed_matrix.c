@@ -0,0 +1,329 @@
+#include "typed_matrix.h"
+#include "instrumentation.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#include <omp.h>
+
+// Rows handed out at once; typed products have no schedule setting of their own
+#define TYPED_CHUNK 64
+
+// Writes the two 0s of an empty row of a variant, as store_empty_row does for int storage
+#define CSR_VARIANT_EMPTY_ROW(NAME, LABEL, VALUE, INDEX, PRODUCT) \
+static inline void csr_##NAME##_store_empty_row(VALUE* values, INDEX* cols) { \
+    for (size_t k = 0; k < EMPTY_ROW_SIZE; k++) { \
+        values[k] = 0; \
+        cols[k] = 0; \
+    } \
+}
+
+CSR_VARIANTS(CSR_VARIANT_EMPTY_ROW)
+
+// Functions of one variant. Products run the two passes of multiply_matrices_sparse with a per-thread
+// marker and a dense accumulator of the product's value type, as in the Gustavson kernel.
+#define CSR_VARIANT_DEFINITIONS(NAME, LABEL, VALUE, INDEX, PRODUCT) \
+Csr##NAME* csr_##NAME##_allocate(const size_t rows, const size_t cols, const size_t nnz) { \
+    Csr##NAME* matrix = malloc(sizeof(Csr##NAME)); \
+    if (!matrix) { \
+        fprintf(stderr, "Failed to allocate memory for Csr" #NAME "\n"); \
+        return NULL; \
+    } \
+    const size_t capacity = nnz > 0 ? nnz : 1; \
+    matrix->num_rows = rows; \
+    matrix->num_cols = cols; \
+    matrix->nnz = nnz; \
+    matrix->row_ptr = calloc(rows + 1, sizeof(size_t)); \
+    matrix->values = capacity <= PTRDIFF_MAX / sizeof(VALUE) ? malloc(capacity * sizeof(VALUE)) : NULL; \
+    matrix->col_idx = capacity <= PTRDIFF_MAX / sizeof(INDEX) ? malloc(capacity * sizeof(INDEX)) : NULL; \
+    if (!matrix->row_ptr || !matrix->values || !matrix->col_idx) { \
+        fprintf(stderr, "Failed to allocate memory for %zu " LABEL " elements\n", nnz); \
+        csr_##NAME##_free(matrix); \
+        return NULL; \
+    } \
+    return matrix; \
+} \
+\
+void csr_##NAME##_free(Csr##NAME* matrix) { \
+    if (!matrix) { \
+        return; \
+    } \
+    free(matrix->values); \
+    free(matrix->col_idx); \
+    free(matrix->row_ptr); \
+    free(matrix); \
+} \
+\
+Csr##NAME* csr_##NAME##_from_compressed(const CompressedMatrix* compressed) { \
+    if (compressed->num_cols > 0 && (size_t)(INDEX)(compressed->num_cols - 1) != compressed->num_cols - 1) { \
+        fprintf(stderr, "Error: %zu columns do not fit " LABEL " indices\n", compressed->num_cols); \
+        return NULL; \
+    } \
+    Csr##NAME* matrix = csr_##NAME##_allocate(compressed->num_rows, compressed->num_cols, compressed->nnz); \
+    if (!matrix) { \
+        return NULL; \
+    } \
+    memcpy(matrix->row_ptr, compressed->row_ptr, (compressed->num_rows + 1) * sizeof(size_t)); \
+    int fits = 1; \
+    _Pragma("omp parallel for schedule(static) reduction(&&:fits)") \
+    for (size_t k = 0; k < compressed->nnz; k++) { \
+        matrix->values[k] = (VALUE)compressed->values[k]; \
+        matrix->col_idx[k] = (INDEX)compressed->col_idx[k]; \
+        fits = fits && (int)matrix->values[k] == compressed->values[k]; \
+    } \
+    if (!fits) { \
+        fprintf(stderr, "Error: Values do not fit " LABEL " storage\n"); \
+        csr_##NAME##_free(matrix); \
+        return NULL; \
+    } \
+    return matrix; \
+} \
+\
+CompressedMatrix* csr_##NAME##_to_compressed(const Csr##NAME* matrix) { \
+    CompressedMatrix* compressed = allocate_compressed_matrix(matrix->num_rows, matrix->num_cols); \
+    if (!compressed) { \
+        return NULL; \
+    } \
+    if (allocate_compressed_storage(compressed, matrix->nnz) != 0) { \
+        free_compressed_matrix(compressed); \
+        return NULL; \
+    } \
+    memcpy(compressed->row_ptr, matrix->row_ptr, (matrix->num_rows + 1) * sizeof(size_t)); \
+    int fits = 1; \
+    _Pragma("omp parallel for schedule(static) reduction(&&:fits)") \
+    for (size_t k = 0; k < matrix->nnz; k++) { \
+        const VALUE value = matrix->values[k]; \
+        fits = fits && (double)value >= INT_MIN && (double)value <= INT_MAX; \
+        compressed->values[k] = fits ? (int)value : 0; \
+        compressed->col_idx[k] = (int)matrix->col_idx[k]; \
+    } \
+    if (!fits) { \
+        fprintf(stderr, "Error: " LABEL " values do not fit int storage\n"); \
+        free_compressed_matrix(compressed); \
+        return NULL; \
+    } \
+    return compressed; \
+} \
+\
+Csr##PRODUCT* csr_##NAME##_multiply(const Csr##NAME* A, const Csr##NAME* B, parallelisation_type parallelisation_type) { \
+    if (A->num_cols != B->num_rows) { \
+        fprintf(stderr, "Error: Incompatible matrix dimensions for multiplication\n"); \
+        return NULL; \
+    } \
+    if (parallelisation_type != MULT_SEQUENTIAL && parallelisation_type != MULT_OMP) { \
+        fprintf(stderr, "Error: " LABEL " products run sequentially or with OpenMP only\n"); \
+        return NULL; \
+    } \
+    Csr##PRODUCT* result = csr_##PRODUCT##_allocate(A->num_rows, B->num_cols, 0); \
+    if (!result) { \
+        return NULL; \
+    } \
+    \
+    PROFILE_BEGIN("multiply_typed"); \
+    PROFILE_COUNT(PROFILE_NNZ, A->nnz); \
+    const size_t cols = B->num_cols; \
+    int failed = 0; \
+    _Pragma("omp parallel if(parallelisation_type == MULT_OMP)") \
+    { \
+        size_t* marker = malloc((cols > 0 ? cols : 1) * sizeof(size_t)); \
+        Csr##PRODUCT##Value* dense = malloc((cols > 0 ? cols : 1) * sizeof(Csr##PRODUCT##Value)); \
+        if (!marker || !dense) { \
+            _Pragma("omp atomic write") \
+            failed = 1; \
+        } \
+        _Pragma("omp barrier") \
+        \
+        if (!failed) { \
+            /* Symbolic phase sizes every output row */ \
+            for (size_t c = 0; c < cols; c++) { \
+                marker[c] = SIZE_MAX; \
+            } \
+            _Pragma("omp for schedule(dynamic, TYPED_CHUNK)") \
+            for (size_t i = 0; i < A->num_rows; i++) { \
+                size_t count = 0; \
+                for (size_t k = A->row_ptr[i]; k < A->row_ptr[i + 1]; k++) { \
+                    if (A->values[k] == 0) continue; \
+                    const size_t a_col = (size_t)A->col_idx[k]; \
+                    if (IS_EMPTY_ROW(B, a_col)) continue; \
+                    for (size_t j = B->row_ptr[a_col]; j < B->row_ptr[a_col + 1]; j++) { \
+                        const size_t b_col = (size_t)B->col_idx[j]; \
+                        if (marker[b_col] != i) { \
+                            marker[b_col] = i; \
+                            count++; \
+                        } \
+                    } \
+                } \
+                result->row_ptr[i + 1] = count > 0 ? count : EMPTY_ROW_SIZE; \
+            } \
+            \
+            _Pragma("omp single") \
+            { \
+                result->nnz = scan_row_sizes(result->row_ptr, result->num_rows); \
+                const size_t capacity = result->nnz > 0 ? result->nnz : 1; \
+                free(result->values); \
+                free(result->col_idx); \
+                result->values = malloc(capacity * sizeof(Csr##PRODUCT##Value)); \
+                result->col_idx = malloc(capacity * sizeof(Csr##PRODUCT##Index)); \
+                failed = !result->values || !result->col_idx; \
+            } \
+            \
+            /* Numeric phase accumulates in the product's wider type; the marker holds symbolic stamps */ \
+            if (!failed) { \
+                for (size_t c = 0; c < cols; c++) { \
+                    marker[c] = SIZE_MAX; \
+                } \
+                _Pragma("omp for schedule(dynamic, TYPED_CHUNK)") \
+                for (size_t i = 0; i < A->num_rows; i++) { \
+                    Csr##PRODUCT##Value* values = result->values + result->row_ptr[i]; \
+                    Csr##PRODUCT##Index* touched = result->col_idx + result->row_ptr[i]; \
+                    size_t count = 0; \
+                    for (size_t k = A->row_ptr[i]; k < A->row_ptr[i + 1]; k++) { \
+                        const Csr##PRODUCT##Value a_val = (Csr##PRODUCT##Value)A->values[k]; \
+                        if (a_val == 0) continue; \
+                        const size_t a_col = (size_t)A->col_idx[k]; \
+                        if (IS_EMPTY_ROW(B, a_col)) continue; \
+                        PROFILE_COUNT(PROFILE_MULTIPLY_ADDS, B->row_ptr[a_col + 1] - B->row_ptr[a_col]); \
+                        for (size_t j = B->row_ptr[a_col]; j < B->row_ptr[a_col + 1]; j++) { \
+                            const size_t b_col = (size_t)B->col_idx[j]; \
+                            const Csr##PRODUCT##Value product = a_val * (Csr##PRODUCT##Value)B->values[j]; \
+                            if (marker[b_col] != i) { \
+                                marker[b_col] = i; \
+                                dense[b_col] = product; \
+                                touched[count++] = (Csr##PRODUCT##Index)b_col; \
+                            } else { \
+                                dense[b_col] += product; \
+                            } \
+                        } \
+                    } \
+                    if (count == 0) { \
+                        /* If the product row is empty, store two 0s */ \
+                        csr_##PRODUCT##_store_empty_row(values, touched); \
+                    } \
+                    for (size_t k = 0; k < count; k++) { \
+                        values[k] = dense[touched[k]]; \
+                    } \
+                } \
+            } \
+        } \
+        free(marker); \
+        free(dense); \
+    } \
+    PROFILE_END("multiply_typed"); \
+    \
+    if (failed) { \
+        fprintf(stderr, "Error: Failed to allocate " LABEL " multiplication workspace\n"); \
+        csr_##PRODUCT##_free(result); \
+        return NULL; \
+    } \
+    return result; \
+}
+
+CSR_VARIANTS(CSR_VARIANT_DEFINITIONS)
+
+#define CSR_VARIANT_LABEL(NAME, LABEL, VALUE, INDEX, PRODUCT) [CSR_##NAME] = LABEL,
+static const char* variant_names[CSR_VARIANT_COUNT] = {
+    CSR_VARIANTS(CSR_VARIANT_LABEL)
+};
+
+// Variant each product is stored as
+#define CSR_VARIANT_PRODUCT(NAME, LABEL, VALUE, INDEX, PRODUCT) [CSR_##NAME] = CSR_##PRODUCT,
+static const CsrVariant product_variants[CSR_VARIANT_COUNT] = {
+    CSR_VARIANTS(CSR_VARIANT_PRODUCT)
+};
+
+const char* get_csr_variant_name(CsrVariant variant) {
+    return variant >= 0 && variant < CSR_VARIANT_COUNT ? variant_names[variant] : "unknown";
+}
+
+int parse_csr_variant(const char* name, CsrVariant* variant) {
+    for (int v = 0; v < CSR_VARIANT_COUNT; v++) {
+        if (strcmp(name, variant_names[v]) == 0) {
+            *variant = (CsrVariant)v;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void free_variant(const CsrVariant variant, void* matrix) {
+    switch (variant) {
+#define CSR_VARIANT_FREE(NAME, LABEL, VALUE, INDEX, PRODUCT) \
+        case CSR_##NAME: csr_##NAME##_free(matrix); break;
+        CSR_VARIANTS(CSR_VARIANT_FREE)
+        default: break;
+    }
+}
+
+// Takes ownership of matrix, freeing it if the handle cannot be allocated
+static TypedMatrix* wrap_typed(const CsrVariant variant, void* matrix) {
+    if (!matrix) {
+        return NULL;
+    }
+    TypedMatrix* typed = malloc(sizeof(TypedMatrix));
+    if (!typed) {
+        fprintf(stderr, "Failed to allocate memory for TypedMatrix\n");
+        free_variant(variant, matrix);
+        return NULL;
+    }
+    typed->variant = variant;
+    typed->matrix = matrix;
+    return typed;
+}
+
+TypedMatrix* typed_from_compressed(const CompressedMatrix* compressed, const CsrVariant variant) {
+    void* matrix = NULL;
+    switch (variant) {
+#define CSR_VARIANT_FROM(NAME, LABEL, VALUE, INDEX, PRODUCT) \
+        case CSR_##NAME: matrix = csr_##NAME##_from_compressed(compressed); break;
+        CSR_VARIANTS(CSR_VARIANT_FROM)
+        default: break;
+    }
+    return wrap_typed(variant, matrix);
+}
+
+TypedMatrix* typed_multiply(const TypedMatrix* A, const TypedMatrix* B, parallelisation_type parallelisation_type) {
+    if (A->variant != B->variant) {
+        fprintf(stderr, "Error: Cannot multiply %s by %s storage\n",
+                get_csr_variant_name(A->variant), get_csr_variant_name(B->variant));
+        return NULL;
+    }
+    void* matrix = NULL;
+    switch (A->variant) {
+#define CSR_VARIANT_MULTIPLY(NAME, LABEL, VALUE, INDEX, PRODUCT) \
+        case CSR_##NAME: matrix = csr_##NAME##_multiply(A->matrix, B->matrix, parallelisation_type); break;
+        CSR_VARIANTS(CSR_VARIANT_MULTIPLY)
+        default: break;
+    }
+    const CsrVariant variant = product_variants[A->variant];
+    return wrap_typed(variant, matrix);
+}
+
+CompressedMatrix* typed_to_compressed(const TypedMatrix* typed) {
+    switch (typed->variant) {
+#define CSR_VARIANT_TO(NAME, LABEL, VALUE, INDEX, PRODUCT) \
+        case CSR_##NAME: return csr_##NAME##_to_compressed(typed->matrix);
+        CSR_VARIANTS(CSR_VARIANT_TO)
+        default: return NULL;
+    }
+}
+
+size_t typed_bytes(const TypedMatrix* typed) {
+    switch (typed->variant) {
+#define CSR_VARIANT_BYTES(NAME, LABEL, VALUE, INDEX, PRODUCT) \
+        case CSR_##NAME: { \
+            const Csr##NAME* matrix = typed->matrix; \
+            return (matrix->num_rows + 1) * sizeof(size_t) + matrix->nnz * (sizeof(VALUE) + sizeof(INDEX)); \
+        }
+        CSR_VARIANTS(CSR_VARIANT_BYTES)
+        default: return 0;
+    }
+}
+
+void free_typed_matrix(TypedMatrix* typed) {
+    if (!typed) {
+        return;
+    }
+    free_variant(typed->variant, typed->matrix);
+    free(typed);
+}
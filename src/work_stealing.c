@@ -0,0 +1,121 @@
+#include "work_stealing.h"
+#include "partition.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <omp.h>
+
+// Default grain leaves about this many blocks per thread to steal from
+#define BLOCKS_PER_THREAD 64
+#define CACHE_LINE 64
+
+// Remaining rows [begin, end) of one thread, a cache line each so owners do not share one
+typedef struct {
+    _Alignas(CACHE_LINE) omp_lock_t lock;
+    size_t begin;
+    size_t end;
+} RowDeque;
+
+struct WorkQueue {
+    RowDeque* deques;
+    int threads;
+    size_t rows;
+    size_t grain;
+    const size_t* costs;
+};
+
+WorkQueue* create_work_queue(const size_t rows, const size_t grain, const int threads, const size_t* costs) {
+    WorkQueue* queue = malloc(sizeof(WorkQueue));
+    if (!queue) {
+        fprintf(stderr, "Failed to allocate memory for WorkQueue\n");
+        return NULL;
+    }
+    queue->threads = threads > 0 ? threads : 1;
+    queue->deques = aligned_alloc(CACHE_LINE, (size_t)queue->threads * sizeof(RowDeque));
+    if (!queue->deques) {
+        fprintf(stderr, "Failed to allocate memory for %d work deques\n", queue->threads);
+        free(queue);
+        return NULL;
+    }
+
+    queue->rows = rows;
+    queue->costs = costs;
+    queue->grain = grain > 0 ? grain : rows / ((size_t)queue->threads * BLOCKS_PER_THREAD);
+    if (queue->grain == 0) {
+        queue->grain = 1;
+    }
+    for (int t = 0; t < queue->threads; t++) {
+        omp_init_lock(&queue->deques[t].lock);
+    }
+    reset_work_queue(queue);
+    return queue;
+}
+
+void free_work_queue(WorkQueue* queue) {
+    if (!queue) {
+        return;
+    }
+    for (int t = 0; t < queue->threads; t++) {
+        omp_destroy_lock(&queue->deques[t].lock);
+    }
+    free(queue->deques);
+    free(queue);
+}
+
+void reset_work_queue(WorkQueue* queue) {
+    const size_t rows = queue->rows;
+    const int threads = queue->threads;
+    for (int t = 0; t < threads; t++) {
+        RowDeque* deque = &queue->deques[t];
+        if (queue->costs) {
+            partition_range(queue->costs, rows, t, threads, &deque->begin, &deque->end);
+        } else {
+            deque->begin = rows / threads * t + rows % threads * t / threads;
+            deque->end = rows / threads * (t + 1) + rows % threads * (t + 1) / threads;
+        }
+    }
+}
+
+// Takes up to grain rows off the front of a locked deque
+static int take_front(RowDeque* deque, const size_t grain, size_t* begin, size_t* end) {
+    if (deque->begin == deque->end) {
+        return 0;
+    }
+    *begin = deque->begin;
+    *end = deque->end - deque->begin > grain ? deque->begin + grain : deque->end;
+    deque->begin = *end;
+    return 1;
+}
+
+int next_row_block(WorkQueue* queue, const int thread, size_t* begin, size_t* end) {
+    RowDeque* own = &queue->deques[thread];
+    omp_set_lock(&own->lock);
+    const int found = take_front(own, queue->grain, begin, end);
+    omp_unset_lock(&own->lock);
+    if (found) {
+        return 1;
+    }
+
+    // Rows only ever move between deques, so one sweep finding them all empty means the pass is done
+    for (int offset = 1; offset < queue->threads; offset++) {
+        RowDeque* victim = &queue->deques[(thread + offset) % queue->threads];
+        omp_set_lock(&victim->lock);
+        const size_t remaining = victim->end - victim->begin;
+        if (remaining == 0) {
+            omp_unset_lock(&victim->lock);
+            continue;
+        }
+        // Steal half, or everything once less than a block is left
+        const size_t stolen_end = victim->end;
+        victim->end -= remaining > queue->grain ? remaining / 2 : remaining;
+        const size_t stolen_begin = victim->end;
+        omp_unset_lock(&victim->lock);
+
+        omp_set_lock(&own->lock);
+        own->begin = stolen_begin;
+        own->end = stolen_end;
+        take_front(own, queue->grain, begin, end);
+        omp_unset_lock(&own->lock);
+        return 1;
+    }
+    return 0;
+}
@@ -9,6 +9,7 @@
 #include "matrix_generation.h"
 #include "matrix_compression.h"
 #include "matrix_multiplication.h"
+#include "matrix_io.h"
 #include "timing.h"
 
 
@@ -42,42 +43,11 @@ char* generate_unique_directory(const char* base_path) {
     return unique_dir;
 }
 
-// Function to generate a random dense matrix
-int** generate_random_matrix(int rows, int cols, float density) {
-    int** matrix = allocateMatrix(rows, cols);
-    initialiseMatrix(matrix, rows, cols, density);
-    return matrix;
-}
-
-CompressedMatrix* compress_matrix_and_write(int** matrix, size_t rows, size_t cols, float density, const char* dir_path) {
-    CompressedMatrix* compressed = compress_matrix(matrix, rows, cols, density);
-
-    char b_file_path[256];
-    char c_file_path[256];
-    snprintf(b_file_path, sizeof(b_file_path), "%s/B.txt", dir_path);
-    snprintf(c_file_path, sizeof(c_file_path), "%s/C.txt", dir_path);
-
-    FILE* b_file = fopen(b_file_path, "w");
-    FILE* c_file = fopen(c_file_path, "w");
-
-    if (b_file == NULL || c_file == NULL) {
-        fprintf(stderr, "Error opening files for writing compressed matrices\n");
-        exit(1);
-    }
-
-    for (size_t i = 0; i < rows; i++) {
-        for (size_t j = 0; j < compressed->row_sizes[i]; j++) {
-            fprintf(b_file, "%d ", compressed->B[i][j]);
-            fprintf(c_file, "%d ", compressed->C[i][j]);
-        }
-        fprintf(b_file, "\n");
-        fprintf(c_file, "\n");
-    }
-
-    fclose(b_file);
-    fclose(c_file);
-
-    return compressed;
+// Binary files are written in a few large writes and can be mapped straight back in
+int write_compressed_matrix(const CompressedMatrix* compressed, const char* dir_path) {
+    char file_path[512];
+    snprintf(file_path, sizeof(file_path), "%s/matrix.csr", dir_path);
+    return write_compressed_matrix_binary(compressed, file_path);
 }
 
 // Function to test parallel matrix multiplication with logging
@@ -101,17 +71,19 @@ void test_parallel_matrix_multiplication(int rows_a, int cols_a, int cols_b, flo
 
     printf("Generating and compressing matrices for density %.2f...\n", density);
 
-    // Generate and compress matrices
-    int** dense_a = generate_random_matrix(rows_a, cols_a, density);
-    CompressedMatrix* compressed_a = compress_matrix_and_write(dense_a, rows_a, cols_a, density, matrix_a_dir);
-    freeMatrix(dense_a, rows_a);
-
-    int** dense_b = generate_random_matrix(cols_a, cols_b, density);
-    CompressedMatrix* compressed_b = compress_matrix_and_write(dense_b, cols_a, cols_b, density, matrix_b_dir);
-    freeMatrix(dense_b, cols_a);
+    // Generate matrices directly in compressed form
+    const unsigned long long seed = (unsigned long long)time(NULL);
+    CompressedMatrix* compressed_a = generateSparseMatrix(rows_a, cols_a, density, seed);
+    CompressedMatrix* compressed_b = generateSparseMatrix(cols_a, cols_b, density, seed + 1);
+    if (!compressed_a || !compressed_b
+        || write_compressed_matrix(compressed_a, matrix_a_dir) != 0
+        || write_compressed_matrix(compressed_b, matrix_b_dir) != 0) {
+        fprintf(stderr, "Error generating compressed matrices\n");
+        exit(1);
+    }
 
-    const char* schedule_names[] = {"static", "dynamic", "guided", "auto"};
-    ScheduleType schedule_types[] = {SCHEDULE_STATIC, SCHEDULE_DYNAMIC, SCHEDULE_GUIDED, SCHEDULE_AUTO};
+    const char* schedule_names[] = {"static", "dynamic", "guided", "auto", "balanced", "stealing"};
+    ScheduleType schedule_types[] = {SCHEDULE_STATIC, SCHEDULE_DYNAMIC, SCHEDULE_GUIDED, SCHEDULE_AUTO, SCHEDULE_BALANCED, SCHEDULE_WORK_STEALING};
     int num_schedule_types = sizeof(schedule_types) / sizeof(schedule_types[0]);
 
     // Get maximum number of threads
@@ -153,9 +125,12 @@ void test_parallel_matrix_multiplication(int rows_a, int cols_a, int cols_b, flo
                 }
             }
 
+            set_multiplication_schedule(schedule_types[s], 0);
+
             TICK(multiply_time);
-            DenseMatrix* result = multiply_matrices(compressed_a, compressed_b, schedule_types[s]);
+            DenseMatrix* result = multiply_matrices(compressed_a, compressed_b, MULT_OMP);
             TOCK(multiply_time);
+            printf("CPU Time: %f seconds\nWall Clock Time: %f seconds\n", multiply_time.cpu_time, multiply_time.wall_time);
 
             // Log results in CSV format
             fprintf(perf_file, "%.6f,%.6f\n", multiply_time.cpu_time, multiply_time.wall_time);
@@ -181,8 +156,6 @@ void test_parallel_matrix_multiplication(int rows_a, int cols_a, int cols_b, flo
 
 int main() {
 
-    srand(time(NULL));  // Seed the random number generator
-
     printf("Starting matrix multiplication test...\n");
 
     // Get the path to the project root directory (parent of build)
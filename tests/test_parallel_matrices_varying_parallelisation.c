@@ -6,16 +6,70 @@
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include "matrix_generation.h"
 #include "matrix_compression.h"
 #include "matrix_multiplication.h"
-#include "timing.h"
+#include "matrix_io.h"
+#include "partition.h"
+#include "simd_kernels.h"
+#include "typed_matrix.h"
+#include "out_of_core.h"
+#include "instrumentation.h"
+#include "arena.h"
 
+// A configuration stops repeating once its timed runs exceed this budget
 #define MAX_TIME_SECONDS 650
-#define NUM_RUNS 1
 #define DEFAULT_DENSITY 0.05
 #define DEFAULT_SIZE 5000
+#define DEFAULT_WARMUP 1
+#define DEFAULT_REPS 5
+#define MAX_SWEEP 32
+
+typedef enum {
+    FORMAT_CSV,
+    FORMAT_JSON,
+} ResultFormat;
+
+// Everything a sweep iterates over, identical on every rank
+typedef struct {
+    int sizes[MAX_SWEEP];
+    int num_sizes;
+    float densities[MAX_SWEEP];
+    int num_densities;
+    SparsityPattern patterns[MAX_SWEEP];
+    int num_patterns;
+    parallelisation_type modes[MAX_SWEEP];
+    int num_modes;
+    int threads[MAX_SWEEP];
+    int num_threads;
+    int ranks[MAX_SWEEP];
+    int num_ranks;
+    int warmup;
+    int reps;
+    int sparse_output;  // Time multiply_matrices_sparse instead of the dense multiply_matrices
+    size_t rhs_cols;  // Time A times a dense block of this many vectors instead of A * B, 0 for A * B
+    int planned;  // Time executions of a plan made once per configuration, which give a compressed product
+    int numa;  // Pin threads and give OpenMP runs a copy of A first touched by the threads that multiply it
+    int write_inputs;  // Keep generated inputs as binary files for later -L runs
+    size_t panel_bytes;  // Also time the out-of-core product with panels of A this large, 0 to skip it
+    size_t panel_cols;  // Column panel width of tiled dense products, TILE_NONE or TILE_AUTO
+    size_t arena_bytes;  // Carve products and workspaces from an arena this large, reset after each run, 0 for the heap
+    ScheduleType schedule_type;
+    MultiplicationKernel kernel;
+    int sort_columns;
+    int typed;  // Multiply copies of the inputs in value_variant storage instead of int storage
+    CsrVariant value_variant;
+    ResultFormat format;
+} BenchmarkConfig;
+
+// Results file shared by every configuration of the run, only open on rank 0
+typedef struct {
+    FILE* file;
+    ResultFormat format;
+    int entries;
+} ResultWriter;
 
 // Function to get parallelisation type name
 const char* get_parallelisation_name(parallelisation_type type) {
@@ -23,10 +77,128 @@ const char* get_parallelisation_name(parallelisation_type type) {
         case MULT_SEQUENTIAL: return "sequential";
         case MULT_OMP: return "openmp";
         case MULT_MPI: return "mpi";
+        case MULT_HYBRID: return "hybrid";
         default: return "unknown";
     }
 }
 
+// Function to parse a parallelisation type name, returns -1 if unknown
+int parse_parallelisation(const char* name, parallelisation_type* type) {
+    const parallelisation_type types[] = {MULT_SEQUENTIAL, MULT_OMP, MULT_MPI, MULT_HYBRID};
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        if (strcmp(name, get_parallelisation_name(types[i])) == 0) {
+            *type = types[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Function to parse an instruction set cap, returns -1 if unknown
+int parse_simd_level(const char* name, SimdLevel* level) {
+    const SimdLevel levels[] = {SIMD_SCALAR, SIMD_AVX2, SIMD_AVX512};
+    for (size_t i = 0; i < sizeof(levels) / sizeof(levels[0]); i++) {
+        if (strcmp(name, get_simd_level_name(levels[i])) == 0) {
+            *level = levels[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Function to parse an OpenMP schedule name, returns -1 if unknown
+int parse_schedule(const char* name, ScheduleType* schedule_type) {
+    const ScheduleType types[] = {SCHEDULE_STATIC, SCHEDULE_DYNAMIC, SCHEDULE_GUIDED, SCHEDULE_AUTO, SCHEDULE_BALANCED, SCHEDULE_WORK_STEALING};
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        if (strcmp(name, get_schedule_name(types[i])) == 0) {
+            *schedule_type = types[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Function to parse a thread binding name, returns -1 if unknown
+int parse_binding(const char* name, ThreadBinding* binding) {
+    const ThreadBinding bindings[] = {BIND_NONE, BIND_CLOSE, BIND_SPREAD};
+    for (size_t i = 0; i < sizeof(bindings) / sizeof(bindings[0]); i++) {
+        if (strcmp(name, get_thread_binding_name(bindings[i])) == 0) {
+            *binding = bindings[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Function to parse a kernel name, returns -1 if unknown
+int parse_kernel(const char* name, MultiplicationKernel* kernel) {
+    const MultiplicationKernel kernels[] = {KERNEL_MARKER, KERNEL_GUSTAVSON, KERNEL_HASH, KERNEL_AUTO};
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        if (strcmp(name, get_kernel_name(kernels[i])) == 0) {
+            *kernel = kernels[i];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Functions to parse comma separated lists, return the number of entries or -1 on bad input
+int parse_int_list(const char* list, int* out, int max_entries) {
+    int count = 0;
+    const char* p = list;
+    while (*p != '\0') {
+        char* end;
+        const long value = strtol(p, &end, 10);
+        if (end == p || value < 0 || count == max_entries || (*end != ',' && *end != '\0')) {
+            return -1;
+        }
+        out[count++] = (int)value;
+        p = *end == ',' ? end + 1 : end;
+    }
+    return count > 0 ? count : -1;
+}
+
+int parse_float_list(const char* list, float* out, int max_entries) {
+    int count = 0;
+    const char* p = list;
+    while (*p != '\0') {
+        char* end;
+        const float value = strtof(p, &end);
+        if (end == p || value < 0.0f || value > 1.0f || count == max_entries || (*end != ',' && *end != '\0')) {
+            return -1;
+        }
+        out[count++] = value;
+        p = *end == ',' ? end + 1 : end;
+    }
+    return count > 0 ? count : -1;
+}
+
+int parse_pattern_list(const char* list, SparsityPattern* out, int max_entries) {
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "%s", list);
+    int count = 0;
+    for (char* name = strtok(buffer, ","); name != NULL; name = strtok(NULL, ",")) {
+        if (count == max_entries || parsePattern(name, &out[count]) != 0) {
+            return -1;
+        }
+        count++;
+    }
+    return count > 0 ? count : -1;
+}
+
+int parse_mode_list(const char* list, parallelisation_type* out, int max_entries) {
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "%s", list);
+    int count = 0;
+    for (char* name = strtok(buffer, ","); name != NULL; name = strtok(NULL, ",")) {
+        if (count == max_entries || parse_parallelisation(name, &out[count]) != 0) {
+            return -1;
+        }
+        count++;
+    }
+    return count > 0 ? count : -1;
+}
+
 // Function to create directories with logging
 int create_directory(const char* path) {
     struct stat st = {0};
@@ -57,143 +229,600 @@ char* generate_unique_directory(const char* base_path) {
     return unique_dir;
 }
 
-int** generate_random_matrix(int rows, int cols, float density) {
-    int** matrix = allocateMatrix(rows, cols);
-    initialiseMatrix(matrix, rows, cols, density);
-    return matrix;
+// Binary files can be mapped straight back in by later runs
+int write_compressed_matrix(const CompressedMatrix* compressed, const char* dir_path) {
+    char file_path[512];
+    snprintf(file_path, sizeof(file_path), "%s/matrix.csr", dir_path);
+    return write_compressed_matrix_binary(compressed, file_path);
 }
 
-CompressedMatrix* compress_matrix_and_write(int** matrix, size_t rows, size_t cols, float density, const char* dir_path) {
-    CompressedMatrix* compressed = compress_matrix(matrix, rows, cols, density);
+CompressedMatrix* load_compressed_matrix(const char* dir_path) {
+    char file_path[512];
+    snprintf(file_path, sizeof(file_path), "%s/matrix.csr", dir_path);
+    return map_compressed_matrix(file_path);
+}
 
-    char b_file_path[256];
-    char c_file_path[256];
-    snprintf(b_file_path, sizeof(b_file_path), "%s/B.txt", dir_path);
-    snprintf(c_file_path, sizeof(c_file_path), "%s/C.txt", dir_path);
+// Bytes a compressed matrix occupies in memory
+size_t compressed_bytes(const CompressedMatrix* compressed) {
+    return (compressed->num_rows + 1) * sizeof(size_t) + compressed->nnz * (sizeof(int) + sizeof(int));
+}
 
-    FILE* b_file = fopen(b_file_path, "w");
-    FILE* c_file = fopen(c_file_path, "w");
+// Multiply-adds the kernels perform: every stored, non-zero entry of A meets each entry of one row of B
+size_t count_multiply_adds(const CompressedMatrix* A, const CompressedMatrix* B) {
+    size_t total = 0;
+    #pragma omp parallel for schedule(static) reduction(+:total)
+    for (size_t k = 0; k < A->nnz; k++) {
+        if (A->values[k] != 0) {
+            total += ROW_SIZE(B, (size_t)A->col_idx[k]);
+        }
+    }
+    return total;
+}
 
-    if (b_file == NULL || c_file == NULL) {
-        fprintf(stderr, "Error opening files for writing compressed matrices\n");
-        exit(1);
+static int compare_doubles(const void* a, const void* b) {
+    const double x = *(const double*)a;
+    const double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentile of sorted times
+double percentile(const double* sorted, int count, double fraction) {
+    int index = (int)(fraction * count + 0.999999) - 1;
+    if (index < 0) index = 0;
+    if (index >= count) index = count - 1;
+    return sorted[index];
+}
+
+int open_results(ResultWriter* writer, const char* run_dir_path, ResultFormat format) {
+    char results_file[1100];
+    snprintf(results_file, sizeof(results_file), "%s/results.%s", run_dir_path, format == FORMAT_JSON ? "json" : "csv");
+    writer->file = fopen(results_file, "w");
+    writer->format = format;
+    writer->entries = 0;
+    if (writer->file == NULL) {
+        fprintf(stderr, "Error opening results file %s: %s\n", results_file, strerror(errno));
+        return -1;
     }
 
-    for (size_t i = 0; i < rows; i++) {
-        for (size_t j = 0; j < compressed->row_sizes[i]; j++) {
-            fprintf(b_file, "%d ", compressed->B[i][j]);
-            fprintf(c_file, "%d ", compressed->C[i][j]);
-        }
-        fprintf(b_file, "\n");
-        fprintf(c_file, "\n");
+    if (format == FORMAT_JSON) {
+        fprintf(writer->file, "[\n");
+    } else {
+        fprintf(writer->file, "mode,output,kernel,values,schedule,panel_cols,ranks,threads,rows_a,cols_a,cols_b,pattern,density,nnz_a,nnz_b,"
+                              "multiply_adds,bytes,warmup,reps,min_s,median_s,p95_s,mean_s,"
+                              "multiply_adds_per_s,bytes_per_s,row_imbalance,flop_imbalance,over_limit\n");
     }
+    printf("Results will be written to %s\n", results_file);
+    return 0;
+}
+
+void close_results(ResultWriter* writer) {
+    if (writer->file == NULL) {
+        return;
+    }
+    if (writer->format == FORMAT_JSON) {
+        fprintf(writer->file, "\n]\n");
+    }
+    fclose(writer->file);
+    writer->file = NULL;
+}
 
-    fclose(b_file);
-    fclose(c_file);
+typedef struct {
+    parallelisation_type mode;
+    int sparse_output;
+    int out_of_core;  // Streamed from and to files rather than multiplied in memory
+    size_t rhs_cols;  // Columns of the dense block A was multiplied by in place of B, 0 for A * B
+    int planned;  // Timed executions of a plan, its creation left out
+    MultiplicationKernel kernel;
+    int sort_columns;
+    const char* values;  // Storage of the inputs' values
+    ScheduleType schedule_type;
+    size_t panel_cols;  // Column panel width of a tiled dense product, 0 if untiled
+    int ranks;
+    int threads;
+    const CompressedMatrix* A;
+    const CompressedMatrix* B;
+    const char* pattern;  // Sparsity pattern the inputs were generated with, "file" when loaded
+    float density;
+    size_t multiply_adds;
+    size_t bytes;
+    int warmup;
+    int reps;
+    double min, median, p95, mean;
+    double row_imbalance;  // Estimated costliest part over the average one, rows split evenly
+    double flop_imbalance;  // The same with rows split by estimated multiply-adds
+    int over_limit;
+} BenchmarkResult;
 
-    return compressed;
+// Function to fill in the time statistics of a result, sorting times
+void summarise_times(double* times, int reps, BenchmarkResult* result) {
+    result->mean = 0.0;
+    for (int i = 0; i < reps; i++) {
+        result->mean += times[i] / reps;
+    }
+    qsort(times, (size_t)reps, sizeof(double), compare_doubles);
+    result->min = times[0];
+    result->median = reps % 2 ? times[reps / 2] : (times[reps / 2 - 1] + times[reps / 2]) / 2.0;
+    result->p95 = percentile(times, reps, 0.95);
+    result->over_limit = result->min > MAX_TIME_SECONDS;
 }
 
-void test_parallel_matrix_multiplication(int rows_a, int cols_a, int cols_b, float density,
-                                      const char* base_dir, parallelisation_type parallel_type,
-                                      MPI_Comm comm) {
+void write_result(ResultWriter* writer, const BenchmarkResult* r) {
+    const char* mode = get_parallelisation_name(r->mode);
+    const int typed = strcmp(r->values, "int") != 0;
+    const char* output = r->out_of_core ? "file" : r->sparse_output || typed ? "sparse" : "dense";
+    // Dense products only go through a sparse kernel when MPI is involved, typed storage has a kernel of its own
+    const int uses_kernel = !typed && !r->rhs_cols && (r->sparse_output || r->out_of_core || r->mode == MULT_MPI || r->mode == MULT_HYBRID);
+    char kernel[64];
+    snprintf(kernel, sizeof(kernel), "%s%s%s", typed ? "typed" : r->rhs_cols ? (r->rhs_cols == 1 ? "spmv" : "spmm")
+                                               : uses_kernel ? get_kernel_name(r->kernel) : "none",
+             uses_kernel && r->sort_columns ? "-sorted" : "", r->planned ? "-planned" : "");
+    // A dense block in place of B counts every one of its elements
+    const size_t cols_b = r->rhs_cols ? r->rhs_cols : r->B->num_cols;
+    const size_t nnz_b = r->rhs_cols ? r->A->num_cols * r->rhs_cols : r->B->nnz;
+    const char* schedule = r->mode == MULT_OMP || r->mode == MULT_HYBRID ? get_schedule_name(r->schedule_type) : "none";
+    const double madds_per_s = r->min > 0.0 ? (double)r->multiply_adds / r->min : 0.0;
+    const double bytes_per_s = r->min > 0.0 ? (double)r->bytes / r->min : 0.0;
 
+    if (writer->format == FORMAT_JSON) {
+        fprintf(writer->file, "%s  {\"mode\": \"%s\", \"output\": \"%s\", \"kernel\": \"%s\", \"values\": \"%s\", \"schedule\": \"%s\", \"panel_cols\": %zu, \"ranks\": %d, \"threads\": %d, "
+                              "\"rows_a\": %zu, \"cols_a\": %zu, \"cols_b\": %zu, \"pattern\": \"%s\", \"density\": %.6g, \"nnz_a\": %zu, \"nnz_b\": %zu, "
+                              "\"multiply_adds\": %zu, \"bytes\": %zu, \"warmup\": %d, \"reps\": %d, "
+                              "\"min_s\": %.9f, \"median_s\": %.9f, \"p95_s\": %.9f, \"mean_s\": %.9f, "
+                              "\"multiply_adds_per_s\": %.6e, \"bytes_per_s\": %.6e, \"row_imbalance\": %.4f, \"flop_imbalance\": %.4f, "
+                              "\"over_limit\": %s}",
+                writer->entries > 0 ? ",\n" : "", mode, output, kernel, r->values, schedule, r->panel_cols, r->ranks, r->threads,
+                r->A->num_rows, r->A->num_cols, cols_b, r->pattern, r->density, r->A->nnz, nnz_b,
+                r->multiply_adds, r->bytes, r->warmup, r->reps, r->min, r->median, r->p95, r->mean,
+                madds_per_s, bytes_per_s, r->row_imbalance, r->flop_imbalance, r->over_limit ? "true" : "false");
+    } else {
+        fprintf(writer->file, "%s,%s,%s,%s,%s,%zu,%d,%d,%zu,%zu,%zu,%s,%.6g,%zu,%zu,%zu,%zu,%d,%d,%.9f,%.9f,%.9f,%.9f,%.6e,%.6e,%.4f,%.4f,%d\n",
+                mode, output, kernel, r->values, schedule, r->panel_cols, r->ranks, r->threads,
+                r->A->num_rows, r->A->num_cols, cols_b, r->pattern, r->density, r->A->nnz, nnz_b,
+                r->multiply_adds, r->bytes, r->warmup, r->reps, r->min, r->median, r->p95, r->mean,
+                madds_per_s, bytes_per_s, r->row_imbalance, r->flop_imbalance, r->over_limit);
+    }
+    // Flush every configuration so a sweep cut short still leaves its results behind
+    fflush(writer->file);
+    writer->entries++;
+}
+
+// Function to estimate how unevenly parts threads or ranks share the work, splitting rows evenly and
+// by estimated multiply-adds; both stay 1.0 without a cost estimate
+void estimate_imbalance(const size_t* costs, size_t rows, int parts, double* row_imbalance, double* flop_imbalance) {
+    *row_imbalance = 1.0;
+    *flop_imbalance = 1.0;
+    size_t* bounds = costs ? malloc((size_t)(parts + 1) * sizeof(size_t)) : NULL;
+    if (bounds == NULL) {
+        return;
+    }
+    for (int p = 0; p <= parts; p++) {
+        bounds[p] = rows / parts * p + rows % parts * p / parts;
+    }
+    *row_imbalance = partition_imbalance(costs, bounds, parts);
+    partition_rows(costs, rows, parts, bounds);
+    *flop_imbalance = partition_imbalance(costs, bounds, parts);
+    free(bounds);
+}
+
+// Runs one multiplication and returns the size of its output, only meaningful on the root.
+// Typed copies of the inputs, when given, are multiplied instead and always give a compressed product.
+// With dense right-hand sides A * X is written to Y in place of A * B, X and Y only exist on the root.
+// With a plan only its numeric phase runs.
+size_t run_multiplication(const CompressedMatrix* A, const CompressedMatrix* B, const TypedMatrix* typed_a,
+                          const TypedMatrix* typed_b, const DenseMatrix* X, DenseMatrix* Y, MultiplicationPlan* plan,
+                          parallelisation_type mode, const BenchmarkConfig* config) {
+    size_t output_bytes = 0;
+    if (plan) {
+        const CompressedMatrix* product = execute_multiplication_plan(plan, A, B);
+        if (product) {
+            output_bytes = compressed_bytes(product);
+        }
+    } else if (config->rhs_cols > 0) {
+        if (multiply_matrix_dense(A, X, Y, mode) == 0 && Y) {
+            output_bytes = Y->rows * Y->cols * sizeof(int);
+        }
+    } else if (typed_a) {
+        TypedMatrix* product = typed_multiply(typed_a, typed_b, mode);
+        if (product) {
+            output_bytes = typed_bytes(product);
+        }
+        free_typed_matrix(product);
+    } else if (config->sparse_output) {
+        CompressedMatrix* product = multiply_matrices_sparse(A, B, mode);
+        if (product) {
+            output_bytes = compressed_bytes(product);
+        }
+        free_compressed_matrix(product);
+    } else {
+        DenseMatrix* product = multiply_matrices(A, B, mode);
+        if (product) {
+            output_bytes = product->bytes;
+        }
+        free_dense_matrix(product);
+    }
+    return output_bytes;
+}
+
+// Function to time one configuration. Every rank of comm takes part; A and B are only read on its rank 0.
+// Warm-up runs are discarded, then up to reps runs are timed, the slowest rank setting each time.
+int benchmark_configuration(const BenchmarkConfig* config, const CompressedMatrix* A, const CompressedMatrix* B,
+                            size_t multiply_adds, const size_t* costs, const char* pattern, float density, parallelisation_type mode,
+                            int threads, MPI_Comm comm, ResultWriter* writer) {
     int rank, size;
     MPI_Comm_rank(comm, &rank);
     MPI_Comm_size(comm, &size);
 
-    printf("[Process %d] began testing with size: %d\n", rank, size);
+    if (threads > 0) {
+        omp_set_num_threads(threads);
+    }
+    // Threads the runtime adds for a larger team start where the master runs, so pin every team again
+    const int pinned = config->numa ? bind_openmp_threads() : 0;
+    // Typed storage has no MPI path, those modes only run on the root's single-rank communicator
+    TypedMatrix* typed_a = NULL;
+    TypedMatrix* typed_b = NULL;
+    if (config->typed) {
+        if (mode != MULT_SEQUENTIAL && mode != MULT_OMP) {
+            if (rank == 0) {
+                fprintf(stderr, "Skipping %s, %s storage runs sequentially or with OpenMP only\n",
+                        get_parallelisation_name(mode), get_csr_variant_name(config->value_variant));
+            }
+            return 0;
+        }
+        typed_a = typed_from_compressed(A, config->value_variant);
+        typed_b = typed_a ? typed_from_compressed(B, config->value_variant) : NULL;
+        if (typed_b == NULL) {
+            free_typed_matrix(typed_a);
+            return -1;
+        }
+    }
+    // The dense block A is multiplied by is filled once, outside every timed run
+    DenseMatrix* X = NULL;
+    DenseMatrix* Y = NULL;
+    if (config->rhs_cols > 0 && rank == 0) {
+        X = allocate_dense_matrix(A->num_cols, config->rhs_cols, 0);
+        Y = X ? allocate_dense_matrix(A->num_rows, config->rhs_cols, 0) : NULL;
+        if (Y == NULL) {
+            fprintf(stderr, "Failed to allocate the dense right-hand side\n");
+            MPI_Abort(MPI_COMM_WORLD, 1);
+        }
+        for (size_t i = 0; i < X->rows; i++) {
+            for (size_t j = 0; j < X->cols; j++) {
+                DENSE_ROW(X, i)[j] = (int)((i + j) % 10) + 1;
+            }
+        }
+    }
+    set_multiplication_communicator(comm);
 
-    // Get parallelisation name for logging
-    const char* parallel_name = get_parallelisation_name(parallel_type);
+    if (rank == 0) {
+        printf("Benchmarking %s (%s output) on %zux%zux%zu, %s density %.4f, %d rank(s) x %d thread(s)...\n",
+               get_parallelisation_name(mode), config->sparse_output || config->planned || typed_a ? "sparse" : "dense",
+               A->num_rows, A->num_cols, config->rhs_cols ? config->rhs_cols : B->num_cols, pattern, density, size, threads);
+    }
 
-    // get the logging directories (only visible to root node)
-    char log_dir[512];
-    char matrix_a_dir[512], matrix_b_dir[512];
-    CompressedMatrix* compressed_a;
-    CompressedMatrix* compressed_b;
-    if( rank == 0 ) {
-        snprintf(log_dir, sizeof(log_dir), "%s/matrix_multiplication_%dx%dx%d_%.2f_%s",
-             base_dir, rows_a, cols_a, cols_b, density, parallel_name);
+    if (rank == 0 && pinned > 0) {
+        printf("  %d thread(s) pinned %s over %d NUMA node(s)\n", pinned, get_thread_binding_name(get_thread_binding()),
+               get_numa_node_count());
+    }
 
-        if (create_directory(log_dir) != 0) {
-            fprintf(stderr, "Error creating log directory %s\n", log_dir);
-            return;
+    // OpenMP runs multiply a copy of A whose rows were first touched by the threads they are dealt to.
+    // Ranks of distributed modes build their row blocks themselves, the MPI binding places those.
+    CompressedMatrix* placed = NULL;
+    if (config->numa && mode == MULT_OMP && !typed_a && config->rhs_cols == 0) {
+        placed = place_matrix_rows(A, B);
+        if (placed == NULL) {
+            MPI_Abort(MPI_COMM_WORLD, 1);
         }
+        A = placed;
+    }
 
-        snprintf(matrix_a_dir, sizeof(matrix_a_dir), "%s/matrix_a", log_dir);
-        snprintf(matrix_b_dir, sizeof(matrix_b_dir), "%s/matrix_b", log_dir);
+    // The plan's symbolic work is done once, outside the timed runs, and reported on its own
+    MultiplicationPlan* plan = NULL;
+    if (config->planned) {
+        MPI_Barrier(comm);
+        const double start = MPI_Wtime();
+        plan = create_multiplication_plan(A, B, mode);
+        const double elapsed = MPI_Wtime() - start;
+        if (plan == NULL) {
+            set_multiplication_communicator(MPI_COMM_NULL);
+            free_compressed_matrix(placed);
+            return -1;
+        }
+        if (rank == 0) {
+            printf("  plan created in %.6f s\n", elapsed);
+        }
+    }
 
-        if (create_directory(matrix_a_dir) != 0 || create_directory(matrix_b_dir) != 0) {
-            fprintf(stderr, "Error creating matrix directories\n");
+    // Everything made before this point outlives the runs, so only the runs allocate from the arena
+    Arena* arena = NULL;
+    const size_t fallbacks = get_arena_fallbacks();
+    if (config->arena_bytes > 0) {
+        arena = create_arena(config->arena_bytes);
+        if (arena == NULL) {
             MPI_Abort(MPI_COMM_WORLD, 1);
-            return;
         }
+        set_matrix_arena(arena);
+    }
+
+    for (int i = 0; i < config->warmup; i++) {
+        run_multiplication(A, B, typed_a, typed_b, X, Y, plan, mode, config);
+        if (arena) {
+            arena_reset(arena);
+        }
+    }
+
+    double* times = malloc((size_t)(config->reps > 0 ? config->reps : 1) * sizeof(double));
+    if (times == NULL) {
+        fprintf(stderr, "Failed to allocate timing buffer\n");
+        MPI_Abort(MPI_COMM_WORLD, 1);
+    }
+
+    int reps = 0;
+    double total = 0.0;
+    size_t output_bytes = 0;
+    while (reps < config->reps) {
+        MPI_Barrier(comm);
+        const double start = MPI_Wtime();
+        output_bytes = run_multiplication(A, B, typed_a, typed_b, X, Y, plan, mode, config);
+        const double local_time = MPI_Wtime() - start;
+        if (arena) {
+            arena_reset(arena);
+        }
+
+        double elapsed;
+        MPI_Reduce(&local_time, &elapsed, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+        int stop = 0;
+        if (rank == 0) {
+            times[reps] = elapsed;
+            total += elapsed;
+            stop = total > MAX_TIME_SECONDS;
+        }
+        reps++;
 
-        printf("Generating and compressing matrices for density %.2f using %s...\n", density, parallel_name);
+        // Stopping early has to be agreed on, every rank takes part in every run
+        MPI_Bcast(&stop, 1, MPI_INT, 0, comm);
+        if (stop) {
+            break;
+        }
+    }
 
-        // Generate and compress matrices
-        int** dense_a = generate_random_matrix(rows_a, cols_a, density);
-        compressed_a = compress_matrix_and_write(dense_a, rows_a, cols_a, density, matrix_a_dir);
-        freeMatrix(dense_a, rows_a);
+    if (rank == 0 && reps > 0) {
+        BenchmarkResult result = {
+            .mode = mode,
+            .sparse_output = config->sparse_output || config->planned,
+            .rhs_cols = config->rhs_cols,
+            .planned = config->planned,
+            .kernel = config->kernel,
+            .sort_columns = config->sort_columns,
+            .values = typed_a ? get_csr_variant_name(config->value_variant) : "int",
+            .schedule_type = config->schedule_type,
+            .panel_cols = typed_a || config->sparse_output || config->rhs_cols || config->planned || mode == MULT_MPI || mode == MULT_HYBRID ? 0 : get_last_panel_cols(),
+            .ranks = size,
+            .threads = threads,
+            .A = A,
+            .B = B,
+            .pattern = pattern,
+            .density = density,
+            .multiply_adds = multiply_adds,
+            .bytes = (typed_a ? typed_bytes(typed_a) + typed_bytes(typed_b)
+                      : compressed_bytes(A) + (X ? X->rows * X->cols * sizeof(int) : compressed_bytes(B))) + output_bytes,
+            .warmup = config->warmup,
+            .reps = reps,
+        };
+
+        summarise_times(times, reps, &result);
+        // Ranks own the row blocks of distributed modes, threads those of OpenMP
+        const int parts = mode == MULT_MPI || mode == MULT_HYBRID ? size : mode == MULT_OMP ? threads : 1;
+        estimate_imbalance(costs, A->num_rows, parts > 0 ? parts : 1, &result.row_imbalance, &result.flop_imbalance);
+
+        write_result(writer, &result);
+        printf("  min %.6f s, median %.6f s, p95 %.6f s over %d run(s), %.3e multiply-adds/s\n",
+               result.min, result.median, result.p95, reps, result.min > 0.0 ? multiply_adds / result.min : 0.0);
+        if (parts > 1) {
+            printf("  estimated imbalance %.3f with rows split by multiply-adds, %.3f split evenly\n",
+                   result.flop_imbalance, result.row_imbalance);
+        }
+    }
 
-        int** dense_b = generate_random_matrix(cols_a, cols_b, density);
-        compressed_b = compress_matrix_and_write(dense_b, cols_a, cols_b, density, matrix_b_dir);
-        freeMatrix(dense_b, cols_a);
+    if (arena) {
+        set_matrix_arena(NULL);
+        unsigned long long peak = arena_peak(arena);
+        unsigned long long spilled = get_arena_fallbacks() - fallbacks;
+        MPI_Allreduce(MPI_IN_PLACE, &peak, 1, MPI_UNSIGNED_LONG_LONG, MPI_MAX, comm);
+        MPI_Allreduce(MPI_IN_PLACE, &spilled, 1, MPI_UNSIGNED_LONG_LONG, MPI_SUM, comm);
+        if (rank == 0) {
+            printf("  arena peak %.1f MiB of %zu MiB per rank, %llu allocation(s) fell back to the heap\n",
+                   peak / 1048576.0, config->arena_bytes >> 20, spilled);
+        }
+        free_arena(arena);
     }
 
-    // Get maximum number of threads for OpenMP
-    const int max_threads = omp_get_max_threads();
-    if (parallel_type != MULT_SEQUENTIAL) {
-        printf("Maximum number of threads available: %d\n", max_threads);
+    // Placement is read back from one more product, outside the timed runs
+    if (placed) {
+        DenseMatrix* product = config->sparse_output || config->planned ? NULL : multiply_matrices(placed, B, mode);
+        PagePlacement placement;
+        measure_row_placement(placed, B, product, &placement);
+        printf("  pages of A%s rows: %zu on their thread's NUMA node, %zu remote, %zu not placed\n",
+               product ? " and product" : "", placement.local_pages, placement.remote_pages, placement.unplaced_pages);
+        free_dense_matrix(product);
     }
-    char performance_file[512];
-    snprintf(performance_file, sizeof(performance_file), "%s/performance_%dx%dx%d_%.2f_%s.csv",
-             log_dir, rows_a, cols_a, cols_b, density, parallel_name);
 
-    FILE* perf_file = fopen(performance_file, "w");
-    if (perf_file == NULL) {
-        fprintf(stderr, "Error opening performance file %s: %s\n", performance_file, strerror(errno));
+    free(times);
+    free_typed_matrix(typed_a);
+    free_typed_matrix(typed_b);
+    free_dense_matrix(X);
+    free_dense_matrix(Y);
+    free_multiplication_plan(plan);
+    free_compressed_matrix(placed);
+    set_multiplication_communicator(MPI_COMM_NULL);
+    return 0;
+}
+
+// Function to sweep every mode, rank count and thread count over one pair of inputs.
+// Collective over MPI_COMM_WORLD; A and B are only read on rank 0.
+void benchmark_inputs(const BenchmarkConfig* config, const CompressedMatrix* A, const CompressedMatrix* B,
+                      const char* pattern, float density, ResultWriter* writer) {
+    int world_rank, world_size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &world_rank);
+    MPI_Comm_size(MPI_COMM_WORLD, &world_size);
+
+    // Inputs are validated before any rank commits to a collective multiplication
+    int valid = 1;
+    size_t multiply_adds = 0;
+    size_t* estimate = NULL;
+    const size_t* costs = NULL;
+    if (world_rank == 0) {
+        valid = A != NULL && (config->rhs_cols > 0 || (B != NULL && A->num_cols == B->num_rows));
+        if (!valid) {
+            fprintf(stderr, "Error: Incompatible matrix dimensions for multiplication\n");
+        } else if (config->rhs_cols > 0) {
+            // Every stored element of A meets every column of the dense block, A's row offsets are the costs
+            multiply_adds = A->nnz * config->rhs_cols;
+            costs = A->row_ptr;
+        } else {
+            multiply_adds = count_multiply_adds(A, B);
+            estimate = estimate_row_costs(A, B);
+            costs = estimate;
+        }
+    }
+    MPI_Bcast(&valid, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (!valid) {
         return;
     }
 
-    // Write header information
-    fprintf(perf_file, "Matrix A: %d x %d\n", rows_a, cols_a);
-    fprintf(perf_file, "Matrix B: %d x %d\n", cols_a, cols_b);
-    fprintf(perf_file, "Density: %.2f\n", density);
-    fprintf(perf_file, "Parallelisation: %s\n\n", parallel_name);
-    fprintf(perf_file, "CPU Time (s),Wall Clock Time (s)\n");
-
-    // Set thread count for OpenMP
-    if (parallel_type == MULT_OMP) {
-        omp_set_num_threads(max_threads);
-        #pragma omp parallel
-        {
-            #pragma omp single
-            {
-                printf("Using %d thread(s) for density %.2f with %s...\n",
-                       omp_get_num_threads(), density, parallel_name);
+    for (int m = 0; m < config->num_modes; m++) {
+        const parallelisation_type mode = config->modes[m];
+        const int distributed = mode == MULT_MPI || mode == MULT_HYBRID;
+        const int threaded = mode == MULT_OMP || mode == MULT_HYBRID;
+        const int num_rank_counts = distributed ? config->num_ranks : 1;
+        const int num_thread_counts = threaded ? config->num_threads : 1;
+
+        for (int r = 0; r < num_rank_counts; r++) {
+            const int ranks = distributed ? config->ranks[r] : 1;
+            if (ranks < 1 || ranks > world_size) {
+                if (world_rank == 0) {
+                    fprintf(stderr, "Skipping %d rank(s), the job only has %d\n", ranks, world_size);
+                }
+                continue;
+            }
+
+            // Ranks past the requested count sit this configuration out
+            MPI_Comm comm;
+            MPI_Comm_split(MPI_COMM_WORLD, world_rank < ranks ? 0 : MPI_UNDEFINED, world_rank, &comm);
+
+            for (int t = 0; t < num_thread_counts; t++) {
+                const int threads = threaded ? config->threads[t] : 1;
+                if (comm != MPI_COMM_NULL) {
+                    benchmark_configuration(config, A, B, multiply_adds, costs, pattern, density, mode, threads, comm, writer);
+                }
+                MPI_Barrier(MPI_COMM_WORLD);
+            }
+
+            if (comm != MPI_COMM_NULL) {
+                MPI_Comm_free(&comm);
             }
         }
     }
+    matrix_free(estimate);
+}
+
+// Function to flush a file and drop it from the page cache, so the next read comes from disk
+void drop_cached_file(const char* path) {
+    const int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+size_t file_bytes(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (size_t)st.st_size : 0;
+}
 
-    // Perform multiplication and timing
-    TICK(multiply_time);
-    DenseMatrix* result = multiply_matrices(compressed_a, compressed_b, parallel_type);
-    TOCK(multiply_time);
+// Function to time the out-of-core product of one pair of inputs on rank 0 alone, for each sequential
+// and OpenMP configuration of the sweep. The inputs are written under the run directory and every run
+// starts with them, and the previous product, out of the page cache.
+void benchmark_out_of_core(const BenchmarkConfig* config, const CompressedMatrix* A, const CompressedMatrix* B,
+                           const char* pattern, float density, size_t multiply_adds, const char* run_dir_path,
+                           ResultWriter* writer) {
+    char dir[1100], a_path[1200], b_path[1200], out_path[1200];
+    snprintf(dir, sizeof(dir), "%s/out_of_core", run_dir_path);
+    snprintf(a_path, sizeof(a_path), "%s/matrix_a.csr", dir);
+    snprintf(b_path, sizeof(b_path), "%s/matrix_b.csr", dir);
+    snprintf(out_path, sizeof(out_path), "%s/product.csr", dir);
+    if (create_directory(dir) != 0 || write_compressed_matrix_binary(A, a_path) != 0
+        || write_compressed_matrix_binary(B, b_path) != 0) {
+        fprintf(stderr, "Skipping the out-of-core product, its inputs could not be written\n");
+        return;
+    }
 
-    // Log timing results
-    fprintf(perf_file, "%.6f,%.6f\n", multiply_time.cpu_time, multiply_time.wall_time);
+    double* times = malloc((size_t)config->reps * sizeof(double));
+    for (int m = 0; times && m < config->num_modes; m++) {
+        const parallelisation_type mode = config->modes[m];
+        if (mode != MULT_SEQUENTIAL && mode != MULT_OMP) {
+            continue;
+        }
+        for (int t = 0; t < (mode == MULT_OMP ? config->num_threads : 1); t++) {
+            const int threads = mode == MULT_OMP ? config->threads[t] : 1;
+            omp_set_num_threads(threads);
+            printf("Benchmarking %s out-of-core on %zux%zux%zu with %zu MiB panels, %d thread(s)...\n",
+                   get_parallelisation_name(mode), A->num_rows, A->num_cols, B->num_cols, config->panel_bytes >> 20, threads);
 
-    // Clean up
-    free_dense_matrix(result);
-    fclose(perf_file);
-    free_compressed_matrix(compressed_a);
-    free_compressed_matrix(compressed_b);
+            int reps = 0;
+            double total = 0.0;
+            for (int i = 0; i < config->warmup + config->reps && total <= MAX_TIME_SECONDS; i++) {
+                drop_cached_file(a_path);
+                drop_cached_file(b_path);
+                const double start = MPI_Wtime();
+                const int status = multiply_matrices_out_of_core(a_path, b_path, out_path, config->panel_bytes, mode);
+                const double elapsed = MPI_Wtime() - start;
+                if (status != 0) {
+                    reps = 0;
+                    break;
+                }
+                drop_cached_file(out_path);
+                if (i >= config->warmup) {
+                    times[reps++] = elapsed;
+                    total += elapsed;
+                }
+            }
+            if (reps == 0) {
+                continue;
+            }
 
-    printf("Test completed for matrix size %dx%dx%d with density %.2f using %s\n",
-           rows_a, cols_a, cols_b, density, parallel_name);
-    printf("Performance data written to %s\n", performance_file);
+            BenchmarkResult result = {
+                .mode = mode,
+                .sparse_output = 1,
+                .out_of_core = 1,
+                .kernel = config->kernel,
+                .sort_columns = config->sort_columns,
+                .values = "int",
+                .schedule_type = config->schedule_type,
+                .ranks = 1,
+                .threads = threads,
+                .A = A,
+                .B = B,
+                .pattern = pattern,
+                .density = density,
+                .multiply_adds = multiply_adds,
+                .bytes = file_bytes(a_path) + file_bytes(b_path) + file_bytes(out_path),
+                .warmup = config->warmup,
+                .reps = reps,
+                .row_imbalance = 1.0,
+                .flop_imbalance = 1.0,
+            };
+            summarise_times(times, reps, &result);
+            write_result(writer, &result);
+            printf("  min %.6f s, median %.6f s, p95 %.6f s over %d run(s), %.3e bytes/s from and to disk\n",
+                   result.min, result.median, result.p95, reps, result.min > 0.0 ? result.bytes / result.min : 0.0);
+        }
+    }
+    free(times);
+    unlink(a_path);
+    unlink(b_path);
+    unlink(out_path);
+    rmdir(dir);
 }
 
 char* setup_dir_path() {
@@ -223,11 +852,12 @@ char* setup_dir_path() {
         return "";
     }
 
-    char run_dir_path[1024];
+    // Static so the path outlives this call
+    static char run_dir_path[1024];
     snprintf(run_dir_path, sizeof(run_dir_path), "%s/%s", logs_dir, run_dir_name);
+    free(run_dir_name);
     if (create_directory(run_dir_path) != 0) {
         fprintf(stderr, "Failed to create run directory\n");
-        free(run_dir_name);
         return "";
     }
 
@@ -236,80 +866,400 @@ char* setup_dir_path() {
 
 }
 
+// Function to write generated inputs under the run directory so -L can reuse them
+int write_inputs(const CompressedMatrix* A, const CompressedMatrix* B, const char* run_dir_path, int size, float density,
+                 SparsityPattern pattern) {
+    char input_dir[1100], matrix_a_dir[1200], matrix_b_dir[1200];
+    snprintf(input_dir, sizeof(input_dir), "%s/inputs_%d_%.4f%s%s", run_dir_path, size, density,
+             pattern == PATTERN_UNIFORM ? "" : "_", pattern == PATTERN_UNIFORM ? "" : getPatternName(pattern));
+    snprintf(matrix_a_dir, sizeof(matrix_a_dir), "%s/matrix_a", input_dir);
+    snprintf(matrix_b_dir, sizeof(matrix_b_dir), "%s/matrix_b", input_dir);
+    if (create_directory(input_dir) != 0 || create_directory(matrix_a_dir) != 0 || create_directory(matrix_b_dir) != 0) {
+        return -1;
+    }
+    return write_compressed_matrix(A, matrix_a_dir) != 0 || write_compressed_matrix(B, matrix_b_dir) != 0 ? -1 : 0;
+}
+
+// Function to size each rank's OpenMP team from the number of ranks sharing its node
+void configure_rank_threads(int threads_per_rank, int ranks_per_node) {
+    MPI_Comm node_comm;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &node_comm);
+
+    int rank, node_rank, node_size;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    MPI_Comm_rank(node_comm, &node_rank);
+    MPI_Comm_size(node_comm, &node_size);
+    MPI_Comm_free(&node_comm);
+
+    if (ranks_per_node > 0 && ranks_per_node != node_size && node_rank == 0) {
+        fprintf(stderr, "[Process %d] Warning: expected %d rank(s) per node but %d share this node\n",
+                rank, ranks_per_node, node_size);
+    }
+
+    // Without an explicit thread count, split the node's cores evenly between its ranks
+    if (threads_per_rank <= 0 && ranks_per_node > 0) {
+        const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads_per_rank = cores / ranks_per_node > 0 ? (int)(cores / ranks_per_node) : 1;
+    }
+    if (threads_per_rank > 0) {
+        omp_set_num_threads(threads_per_rank);
+    }
+
+    printf("[Process %d] Node rank %d of %d, %d thread(s) per rank\n",
+           rank, node_rank, node_size, omp_get_max_threads());
+}
+
+void print_usage(void) {
+    printf("FLAGS:\n\t-s [sizes]: comma separated matrix sizes\n\t-d [densities]: comma separated densities\n"
+           "\t-M [modes]: comma separated sequential,openmp,mpi,hybrid\n"
+           "\t-o: add openmp to the modes\n\t-m: add mpi to the modes\n\t-H: add hybrid (MPI with OpenMP inside each rank) to the modes\n"
+           "\t-T [threads]: comma separated OpenMP thread counts for openmp and hybrid modes\n"
+           "\t-R [ranks]: comma separated rank counts for mpi and hybrid modes (default: all ranks)\n"
+           "\t-w [runs]: warm-up runs per configuration\n\t-n [runs]: timed runs per configuration\n"
+           "\t-p: time the compressed product instead of the dense one\n"
+           "\t-K [marker|gustavson|hash|auto]: kernel for compressed products\n\t-C: sort product columns (gustavson, hash, auto)\n\t-F [csv|json]: results format\n"
+           "\t-t [threads]: OpenMP threads per rank\n"
+           "\t-r [ranks]: ranks per node, sets threads per rank to cores / ranks when -t is not given\n"
+           "\t-S [static|dynamic|guided|auto|balanced|stealing]: OpenMP schedule\n\t-c [chunk]: OpenMP chunk size, rows per stolen block\n"
+           "\t-W: write generated inputs so later runs can load them with -L\n"
+           "\t-L [dir]: load matrix_a/matrix.csr and matrix_b/matrix.csr from an earlier run's inputs directory\n"
+           "\t-A [file.mtx]: read A from a Matrix Market file\n\t-B [file.mtx]: read B from a Matrix Market file (default: A)\n"
+           "\t-P: back dense results with huge pages\n\t-V [scalar|avx2|avx512]: cap the instruction set of the compression kernels\n"
+           "\t-Y [int8|int16|int32|int64|float|double|int32-wide|int64-wide]: multiply copies of the inputs\n"
+           "\t   in this value storage, with a widened accumulator (sequential and openmp modes)\n"
+           "\t-G [seed]: seed for generated inputs, identical for any thread or rank count (default: time)\n"
+           "\t-g [patterns]: comma separated uniform,banded,block,rmat,skewed sparsity patterns of generated inputs\n"
+           "\t-O [MiB]: also time the out-of-core product, streaming panels of A this large from disk\n"
+           "\t   (sequential and openmp modes, on the root alone)\n"
+           "\t-X [cols|auto]: multiply dense products one column panel of B this wide at a time,\n"
+           "\t   auto sizes panels to L2 and checks neighbouring widths on a sample of rows\n"
+           "\t-v [k]: time A times a dense block of k vectors instead of A * B, 1 being a matrix-vector product\n"
+           "\t-E: time executions of a plan made once per configuration, the numeric phase of the compressed product\n"
+           "\t-a [MiB]: carve products and kernel workspaces from an arena this large on each rank, reset after every run\n"
+           "\t-N [close|spread]: pin OpenMP threads unless OMP_PLACES is set, place rows of A and of the product\n"
+           "\t   on the NUMA node of the thread that multiplies them and report where their pages landed\n");
+}
+
 int main(int argc, char** argv) {
 
-    MPI_Init(&argc, &argv);
+    // OpenMP threads never call MPI, so funneled support is enough for hybrid runs
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
 
     int rank, size;
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
-    MPI_Comm worker;
-    MPI_Comm_dup(MPI_COMM_WORLD, &worker);
-
-    parallelisation_type parallel_type = MULT_SEQUENTIAL;
-    int gen_size = DEFAULT_SIZE;
-    float density = DEFAULT_DENSITY;
+    BenchmarkConfig config = {
+        .sizes = {DEFAULT_SIZE},
+        .num_sizes = 1,
+        .densities = {DEFAULT_DENSITY},
+        .num_densities = 1,
+        .patterns = {PATTERN_UNIFORM},
+        .num_patterns = 1,
+        .num_modes = 0,
+        .num_threads = 0,
+        .num_ranks = 0,
+        .warmup = DEFAULT_WARMUP,
+        .reps = DEFAULT_REPS,
+        .schedule_type = SCHEDULE_DYNAMIC,
+        .kernel = KERNEL_MARKER,
+        .format = FORMAT_CSV,
+    };
+    int chunk_size = 0;
+    int threads_per_rank = 0;
+    int ranks_per_node = 0;
+    const char* load_dir = NULL;
+    const char* market_a = NULL;
+    const char* market_b = NULL;
+    unsigned long long seed = (unsigned long long)time(NULL);
 
     int opt;
+    int bad_option = 0;
 
-    while((opt = getopt(argc, argv, ":s:omt:")) != -1) {
+    while((opt = getopt(argc, argv, ":s:d:M:omHT:R:w:n:pK:CF:t:r:S:c:WL:A:B:PV:Y:G:g:O:X:v:Ea:N:")) != -1) {
         switch(opt) {
             case 's':
-                gen_size = atoi(optarg);
+                config.num_sizes = parse_int_list(optarg, config.sizes, MAX_SWEEP);
+                bad_option |= config.num_sizes < 0;
             break;
-            case 'o':
-                parallel_type = MULT_OMP;
+            case 'd':
+                config.num_densities = parse_float_list(optarg, config.densities, MAX_SWEEP);
+                bad_option |= config.num_densities < 0;
             break;
+            case 'g':
+                config.num_patterns = parse_pattern_list(optarg, config.patterns, MAX_SWEEP);
+                bad_option |= config.num_patterns < 0;
+            break;
+            case 'M':
+                config.num_modes = parse_mode_list(optarg, config.modes, MAX_SWEEP);
+                bad_option |= config.num_modes < 0;
+            break;
+            case 'o':
             case 'm':
-                parallel_type = MULT_MPI;
+            case 'H':
+                if (config.num_modes >= 0 && config.num_modes < MAX_SWEEP) {
+                    config.modes[config.num_modes++] = opt == 'o' ? MULT_OMP : opt == 'm' ? MULT_MPI : MULT_HYBRID;
+                }
+            break;
+            case 'T':
+                config.num_threads = parse_int_list(optarg, config.threads, MAX_SWEEP);
+                bad_option |= config.num_threads < 0;
+            break;
+            case 'R':
+                config.num_ranks = parse_int_list(optarg, config.ranks, MAX_SWEEP);
+                bad_option |= config.num_ranks < 0;
+            break;
+            case 'w':
+                config.warmup = atoi(optarg);
+            break;
+            case 'n':
+                config.reps = atoi(optarg);
+            break;
+            case 'p':
+                config.sparse_output = 1;
+            break;
+            case 'K':
+                if (parse_kernel(optarg, &config.kernel) != 0) {
+                    fprintf(stderr, "Unknown kernel %s\n", optarg);
+                    bad_option = 1;
+                }
+            break;
+            case 'C':
+                config.sort_columns = 1;
+            break;
+            case 'F':
+                if (strcmp(optarg, "json") == 0) {
+                    config.format = FORMAT_JSON;
+                } else if (strcmp(optarg, "csv") == 0) {
+                    config.format = FORMAT_CSV;
+                } else {
+                    bad_option = 1;
+                }
+            break;
+            case 't':
+                threads_per_rank = atoi(optarg);
+            break;
+            case 'r':
+                ranks_per_node = atoi(optarg);
+            break;
+            case 'S':
+                if (parse_schedule(optarg, &config.schedule_type) != 0) {
+                    fprintf(stderr, "Unknown schedule %s\n", optarg);
+                    bad_option = 1;
+                }
+            break;
+            case 'c':
+                chunk_size = atoi(optarg);
+            break;
+            case 'W':
+                config.write_inputs = 1;
+            break;
+            case 'L':
+                load_dir = optarg;
+            break;
+            case 'A':
+                market_a = optarg;
+            break;
+            case 'B':
+                market_b = optarg;
+            break;
+            case 'P':
+                set_dense_huge_pages(1);
+            break;
+            case 'Y':
+                if (parse_csr_variant(optarg, &config.value_variant) != 0) {
+                    fprintf(stderr, "Unknown value storage %s\n", optarg);
+                    bad_option = 1;
+                }
+                config.typed = 1;
+            break;
+            case 'X':
+                config.panel_cols = strcmp(optarg, "auto") == 0 ? TILE_AUTO : (size_t)strtoul(optarg, NULL, 10);
+                bad_option |= config.panel_cols == TILE_NONE;
+            break;
+            case 'E':
+                config.planned = 1;
+            break;
+            case 'N': {
+                ThreadBinding binding;
+                if (parse_binding(optarg, &binding) != 0) {
+                    fprintf(stderr, "Unknown thread binding %s\n", optarg);
+                    bad_option = 1;
+                } else {
+                    set_thread_binding(binding);
+                    config.numa = 1;
+                }
+            }
+            break;
+            case 'a':
+                config.arena_bytes = (size_t)strtoul(optarg, NULL, 10) << 20;
+                bad_option |= config.arena_bytes == 0;
+            break;
+            case 'v':
+                config.rhs_cols = (size_t)strtoul(optarg, NULL, 10);
+                bad_option |= config.rhs_cols == 0;
+            break;
+            case 'O':
+                config.panel_bytes = (size_t)strtoul(optarg, NULL, 10) << 20;
+                bad_option |= config.panel_bytes == 0;
+            break;
+            case 'G': {
+                char* end;
+                errno = 0;
+                seed = strtoull(optarg, &end, 10);
+                bad_option |= errno != 0 || end == optarg || *end != '\0';
+            }
+            break;
+            case 'V': {
+                SimdLevel level;
+                if (parse_simd_level(optarg, &level) != 0) {
+                    fprintf(stderr, "Unknown instruction set %s\n", optarg);
+                    bad_option = 1;
+                } else {
+                    set_simd_level(level);
+                }
+            }
+            break;
+            default:
+                bad_option = 1;
             break;
-            case '?':
-                printf("FLAGS:\n\t-s [size]: set matrix size\n\t-o: use OpenMP\n\t-m: use MPI\n");
-            return 1;
         }
     }
 
-    char* run_dir_path;
-    int run_dir_path_len;
-
-    // root node only
-    if( rank == 0 ) {
-        srand(time(NULL));
+    // Dense right-hand sides and plans have int storage and products of their own
+    bad_option |= config.rhs_cols > 0 && (config.typed || config.sparse_output || config.planned);
+    bad_option |= config.planned && config.typed;
 
-        run_dir_path = setup_dir_path();
-        if(run_dir_path[0] == '\0') {
-            MPI_Abort(MPI_COMM_WORLD, 1);
-            exit(0);
+    if (bad_option || config.reps < 1 || config.warmup < 0) {
+        if (rank == 0) {
+            print_usage();
         }
+        MPI_Finalize();
+        return 1;
+    }
 
-        run_dir_path_len = strlen(run_dir_path) + 1;
+    set_multiplication_schedule(config.schedule_type, chunk_size);
+    set_multiplication_kernel(config.kernel, config.sort_columns);
+    set_multiplication_tiling(config.panel_cols);
+    configure_rank_threads(threads_per_rank, ranks_per_node);
 
-        printf("Profiling matrix multiplication using %s\n", get_parallelisation_name(parallel_type));
-        printf("SIZE: %d\tDENSITY: %.2f\n", gen_size, density);
+    if (config.num_modes == 0) {
+        config.modes[config.num_modes++] = MULT_SEQUENTIAL;
+    }
+    if (config.num_threads == 0) {
+        config.threads[config.num_threads++] = omp_get_max_threads();
+    }
+    if (config.num_ranks == 0) {
+        config.ranks[config.num_ranks++] = size;
     }
 
-    // give alla this shit to the other processes
-    MPI_Bcast(&run_dir_path_len, 1, MPI_INT, 0, MPI_COMM_WORLD);
-    if( rank != 0) {
-        run_dir_path = (char*)malloc(run_dir_path_len);
+    for (int m = 0; m < config.num_modes; m++) {
+        if (config.modes[m] == MULT_HYBRID && provided < MPI_THREAD_FUNNELED && rank == 0) {
+            fprintf(stderr, "Warning: MPI library does not provide MPI_THREAD_FUNNELED\n");
+        }
     }
-    MPI_Bcast((void*)run_dir_path, run_dir_path_len, MPI_CHAR, 0, MPI_COMM_WORLD);
-    if( rank != 0) {
-        printf("\t[Process %d] Discovered path: %s\n", rank, run_dir_path);
+
+    // Only the root writes results, the other ranks just follow the same sweep
+    ResultWriter writer = {0};
+    const char* run_dir_path = NULL;
+    int setup_failed = 0;
+    if (rank == 0) {
+        run_dir_path = setup_dir_path();
+        setup_failed = run_dir_path[0] == '\0' || open_results(&writer, run_dir_path, config.format) != 0;
+    }
+    MPI_Bcast(&setup_failed, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if (setup_failed) {
+        MPI_Finalize();
+        return 1;
     }
 
-    // Barrier to ensure all processes have received the data
-    MPI_Barrier(MPI_COMM_WORLD);
+    if (market_a != NULL || load_dir != NULL) {
+        // A single pair of existing inputs; sizes and densities come from the files
+        CompressedMatrix* compressed_a = NULL;
+        CompressedMatrix* compressed_b = NULL;
+        if (rank == 0) {
+            if (market_a != NULL) {
+                // Real matrices; B defaults to A so square inputs can be squared
+                printf("Reading Matrix Market files %s and %s...\n", market_a, market_b ? market_b : market_a);
+                compressed_a = read_matrix_market(market_a);
+                compressed_b = read_matrix_market(market_b ? market_b : market_a);
+            } else {
+                char load_a_dir[512], load_b_dir[512];
+                snprintf(load_a_dir, sizeof(load_a_dir), "%s/matrix_a", load_dir);
+                snprintf(load_b_dir, sizeof(load_b_dir), "%s/matrix_b", load_dir);
+                printf("Loading matrices from %s...\n", load_dir);
+                compressed_a = load_compressed_matrix(load_a_dir);
+                compressed_b = load_compressed_matrix(load_b_dir);
+            }
+            if (!compressed_a || !compressed_b) {
+                fprintf(stderr, "Error loading input matrices\n");
+                MPI_Abort(MPI_COMM_WORLD, 1);
+            }
+        }
 
-    test_parallel_matrix_multiplication(gen_size, gen_size, gen_size, density, run_dir_path, parallel_type, worker);
+        float density = 0.0f;
+        if (rank == 0 && compressed_a->num_rows > 0 && compressed_a->num_cols > 0) {
+            density = (float)((double)compressed_a->nnz / compressed_a->num_rows / compressed_a->num_cols);
+        }
+        benchmark_inputs(&config, compressed_a, compressed_b, "file", density, &writer);
+        if (rank == 0 && config.panel_bytes > 0 && compressed_a->num_cols == compressed_b->num_rows) {
+            benchmark_out_of_core(&config, compressed_a, compressed_b, "file", density,
+                                  count_multiply_adds(compressed_a, compressed_b), run_dir_path, &writer);
+        }
+        free_compressed_matrix(compressed_a);
+        free_compressed_matrix(compressed_b);
+    } else {
+        if (rank == 0) {
+            printf("Generation seed: %llu\n", seed);
+        }
+        for (int s = 0; s < config.num_sizes; s++) {
+            for (int d = 0; d < config.num_densities; d++) {
+                for (int p = 0; p < config.num_patterns; p++) {
+                    const int gen_size = config.sizes[s];
+                    const float density = config.densities[d];
+                    const SparsityPattern pattern = config.patterns[p];
 
-    printf("Test completed. Results written to %s\n", run_dir_path);
+                    // Generation happens once per input pair, outside every timed region
+                    CompressedMatrix* compressed_a = NULL;
+                    CompressedMatrix* compressed_b = NULL;
+                    float actual_density = density;
+                    if (rank == 0) {
+                        printf("Generating %dx%d %s matrices with density %.4f...\n", gen_size, gen_size, getPatternName(pattern), density);
+                        compressed_a = generatePatternMatrix(gen_size, gen_size, density, pattern, seed);
+                        compressed_b = generatePatternMatrix(gen_size, gen_size, density, pattern, seed + 1);
+                        if (!compressed_a || !compressed_b
+                            || (config.write_inputs && write_inputs(compressed_a, compressed_b, run_dir_path, gen_size, density, pattern) != 0)) {
+                            fprintf(stderr, "Error generating compressed matrices\n");
+                            MPI_Abort(MPI_COMM_WORLD, 1);
+                        }
+                        // Structured patterns only approach the requested density, report what was generated
+                        if (pattern != PATTERN_UNIFORM && gen_size > 0) {
+                            actual_density = (float)((double)compressed_a->nnz / gen_size / gen_size);
+                        }
+                    }
 
-    // Another to ensure all processes have finished processing
-    MPI_Barrier(MPI_COMM_WORLD);
+                    benchmark_inputs(&config, compressed_a, compressed_b, getPatternName(pattern), actual_density, &writer);
+                    if (rank == 0 && config.panel_bytes > 0 && compressed_a->num_cols == compressed_b->num_rows) {
+                        benchmark_out_of_core(&config, compressed_a, compressed_b, getPatternName(pattern), actual_density,
+                                              count_multiply_adds(compressed_a, compressed_b), run_dir_path, &writer);
+                    }
+                    free_compressed_matrix(compressed_a);
+                    free_compressed_matrix(compressed_b);
+                }
+            }
+        }
+    }
+
+    if (rank == 0) {
+        close_results(&writer);
+        printf("Benchmark completed. Results written to %s\n", run_dir_path);
+    }
+
+    // Collective, so it has to run before MPI_Finalize
+    profile_report(stderr);
 
     MPI_Finalize();
 
     return 0;
-}
\ No newline at end of file
+}
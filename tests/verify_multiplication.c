@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <omp.h>
+#include <mpi.h>
+#include "matrix_generation.h"
+#include "matrix_compression.h"
+#include "matrix_multiplication.h"
+#include "matrix_io.h"
+#include "typed_matrix.h"
+#include "out_of_core.h"
+
+// Small enough for the triple-loop reference, large enough for several threads, ranks and panels
+#define VERIFY_ROWS 150
+#define VERIFY_INNER 120
+#define VERIFY_COLS 170
+#define VERIFY_DENSITY_A 0.05f
+#define VERIFY_DENSITY_B 0.01f  // Sparse enough that B has empty rows
+#define VERIFY_VECTORS 3
+#define VERIFY_PANEL_BYTES 1024
+#define VERIFY_SEED 12345ULL
+
+static int failures = 0;
+
+// Function to record a failed check, on the ranks that see it
+static void fail(const char* what, const char* detail) {
+    fprintf(stderr, "FAIL: %s (%s)\n", what, detail);
+    failures++;
+}
+
+// Function to multiply A and B with a plain triple loop over their dense expansions
+static DenseMatrix* reference_product(const CompressedMatrix* A, const CompressedMatrix* B) {
+    DenseMatrix* a = compressed_to_dense(A);
+    DenseMatrix* b = compressed_to_dense(B);
+    DenseMatrix* c = allocate_dense_matrix(A->num_rows, B->num_cols, 1);
+    for (size_t i = 0; i < A->num_rows; i++) {
+        for (size_t j = 0; j < B->num_cols; j++) {
+            int sum = 0;
+            for (size_t k = 0; k < A->num_cols; k++) {
+                sum += DENSE_ROW(a, i)[k] * DENSE_ROW(b, k)[j];
+            }
+            DENSE_ROW(c, i)[j] = sum;
+        }
+    }
+    free_dense_matrix(a);
+    free_dense_matrix(b);
+    return c;
+}
+
+static int same_dense(const DenseMatrix* x, const DenseMatrix* y) {
+    if (!x || !y || x->rows != y->rows || x->cols != y->cols) {
+        return 0;
+    }
+    for (size_t i = 0; i < x->rows; i++) {
+        if (memcmp(DENSE_ROW(x, i), DENSE_ROW(y, i), x->cols * sizeof(int)) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int same_values(const CompressedMatrix* product, const DenseMatrix* expected) {
+    DenseMatrix* dense = product ? compressed_to_dense(product) : NULL;
+    const int same = same_dense(dense, expected);
+    free_dense_matrix(dense);
+    return same;
+}
+
+// Function to check a compressed product against the reference: valid CSR, the same values, and no
+// stored zeros beyond the padding of empty rows
+static int same_product(const CompressedMatrix* product, const DenseMatrix* expected) {
+    if (!product || product->num_rows != expected->rows || product->num_cols != expected->cols
+        || product->row_ptr[0] != 0 || product->row_ptr[product->num_rows] != product->nnz) {
+        return 0;
+    }
+    for (size_t i = 0; i < product->num_rows; i++) {
+        if (product->row_ptr[i + 1] <= product->row_ptr[i]) {
+            return 0;
+        }
+        if (IS_EMPTY_ROW(product, i)) {
+            continue;
+        }
+        for (size_t k = product->row_ptr[i]; k < product->row_ptr[i + 1]; k++) {
+            if (product->values[k] == 0 || product->col_idx[k] < 0 || (size_t)product->col_idx[k] >= product->num_cols) {
+                return 0;
+            }
+        }
+    }
+    return same_values(product, expected);
+}
+
+static int same_compressed(const CompressedMatrix* x, const CompressedMatrix* y) {
+    return x && y && x->num_rows == y->num_rows && x->num_cols == y->num_cols && x->nnz == y->nnz
+        && memcmp(x->row_ptr, y->row_ptr, (x->num_rows + 1) * sizeof(size_t)) == 0
+        && memcmp(x->col_idx, y->col_idx, x->nnz * sizeof(int)) == 0
+        && memcmp(x->values, y->values, x->nnz * sizeof(int)) == 0;
+}
+
+// Function to copy A with every third stored value set to 0, keeping its pattern
+static CompressedMatrix* thin_values(const CompressedMatrix* A) {
+    CompressedMatrix* thin = allocate_compressed_matrix(A->num_rows, A->num_cols);
+    if (!thin || allocate_compressed_storage(thin, A->nnz) != 0) {
+        free_compressed_matrix(thin);
+        return NULL;
+    }
+    memcpy(thin->row_ptr, A->row_ptr, (A->num_rows + 1) * sizeof(size_t));
+    memcpy(thin->col_idx, A->col_idx, A->nnz * sizeof(int));
+    for (size_t k = 0; k < A->nnz; k++) {
+        thin->values[k] = k % 3 == 0 ? 0 : A->values[k];
+    }
+    return thin;
+}
+
+// Function to check compressed and dense products and plans with every kernel, schedule and mode.
+// Every rank holds the same inputs; MPI modes are collective and checked on rank 0.
+static void verify_products(const CompressedMatrix* A, const CompressedMatrix* B, const DenseMatrix* expected,
+                            const char* pattern, int rank) {
+    const parallelisation_type modes[] = {MULT_SEQUENTIAL, MULT_OMP, MULT_MPI, MULT_HYBRID};
+    const size_t tilings[] = {TILE_NONE, 16, TILE_AUTO};
+    char detail[256];
+
+    CompressedMatrix* thin = thin_values(A);
+    DenseMatrix* thin_expected = reference_product(thin, B);
+
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        const parallelisation_type mode = modes[m];
+        const int check = rank == 0 || mode == MULT_SEQUENTIAL || mode == MULT_OMP;
+        for (int s = SCHEDULE_STATIC; s <= SCHEDULE_WORK_STEALING; s++) {
+            set_multiplication_schedule((ScheduleType)s, 0);
+            for (int k = KERNEL_MARKER; k <= KERNEL_AUTO; k++) {
+                for (int sort = 0; sort <= 1; sort++) {
+                    set_multiplication_kernel((MultiplicationKernel)k, sort);
+                    snprintf(detail, sizeof(detail), "%s, mode %d, %s schedule, %s kernel%s", pattern, (int)mode,
+                             get_schedule_name((ScheduleType)s), get_kernel_name((MultiplicationKernel)k), sort ? " sorted" : "");
+
+                    CompressedMatrix* product = multiply_matrices_sparse(A, B, mode);
+                    if (check && !same_product(product, expected)) {
+                        fail("sparse product", detail);
+                    }
+                    free_compressed_matrix(product);
+
+                    // Made while some of A's values are 0, which still place their products as stored zeros,
+                    // then executed with all of them
+                    MultiplicationPlan* plan = create_multiplication_plan(thin, B, mode);
+                    if (check && (!plan || !same_values(get_plan_product(plan), thin_expected))) {
+                        fail("plan creation", detail);
+                    }
+                    const CompressedMatrix* planned = plan ? execute_multiplication_plan(plan, A, B) : NULL;
+                    if (check && !same_product(planned, expected)) {
+                        fail("plan execution", detail);
+                    }
+                    free_multiplication_plan(plan);
+                }
+            }
+
+            for (size_t t = 0; t < sizeof(tilings) / sizeof(tilings[0]); t++) {
+                set_multiplication_tiling(tilings[t]);
+                snprintf(detail, sizeof(detail), "%s, mode %d, %s schedule, %zu column panels (0 none, %zu auto)", pattern,
+                         (int)mode, get_schedule_name((ScheduleType)s), tilings[t], TILE_AUTO);
+                DenseMatrix* product = multiply_matrices(A, B, mode);
+                if (check && !same_dense(product, expected)) {
+                    fail("dense product", detail);
+                }
+                free_dense_matrix(product);
+            }
+            set_multiplication_tiling(TILE_NONE);
+        }
+    }
+    set_multiplication_schedule(SCHEDULE_DYNAMIC, 0);
+    set_multiplication_kernel(KERNEL_MARKER, 0);
+    free_compressed_matrix(thin);
+    free_dense_matrix(thin_expected);
+}
+
+// Function to check A times a block of dense vectors, and times one vector, in every mode
+static void verify_vectors(const CompressedMatrix* A, const char* pattern, int rank) {
+    const parallelisation_type modes[] = {MULT_SEQUENTIAL, MULT_OMP, MULT_MPI, MULT_HYBRID};
+    DenseMatrix* dense_a = compressed_to_dense(A);
+    DenseMatrix* X = allocate_dense_matrix(A->num_cols, VERIFY_VECTORS, 1);
+    DenseMatrix* expected = allocate_dense_matrix(A->num_rows, VERIFY_VECTORS, 1);
+    int* x = malloc(A->num_cols * sizeof(int));
+    int* y = malloc(A->num_rows * sizeof(int));
+    for (size_t k = 0; k < A->num_cols; k++) {
+        for (size_t j = 0; j < VERIFY_VECTORS; j++) {
+            DENSE_ROW(X, k)[j] = (int)((k * 7 + j * 3) % 11) - 5;
+        }
+        x[k] = DENSE_ROW(X, k)[0];
+    }
+    for (size_t i = 0; i < A->num_rows; i++) {
+        for (size_t j = 0; j < VERIFY_VECTORS; j++) {
+            int sum = 0;
+            for (size_t k = 0; k < A->num_cols; k++) {
+                sum += DENSE_ROW(dense_a, i)[k] * DENSE_ROW(X, k)[j];
+            }
+            DENSE_ROW(expected, i)[j] = sum;
+        }
+    }
+
+    char detail[128];
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        const int check = rank == 0 || modes[m] == MULT_SEQUENTIAL || modes[m] == MULT_OMP;
+        snprintf(detail, sizeof(detail), "%s, mode %d", pattern, (int)modes[m]);
+        DenseMatrix* Y = allocate_dense_matrix(A->num_rows, VERIFY_VECTORS, 1);
+        if (multiply_matrix_dense(A, X, Y, modes[m]) != 0 || (check && !same_dense(Y, expected))) {
+            fail("matrix times vectors", detail);
+        }
+        free_dense_matrix(Y);
+
+        int vector_ok = multiply_matrix_vector(A, x, y, modes[m]) == 0;
+        for (size_t i = 0; check && vector_ok && i < A->num_rows; i++) {
+            vector_ok = y[i] == DENSE_ROW(expected, i)[0];
+        }
+        if (!vector_ok) {
+            fail("matrix times vector", detail);
+        }
+    }
+    free(x);
+    free(y);
+    free_dense_matrix(dense_a);
+    free_dense_matrix(X);
+    free_dense_matrix(expected);
+}
+
+// Function to check products of every typed variant the inputs fit
+static void verify_typed(const CompressedMatrix* A, const CompressedMatrix* B, const DenseMatrix* expected, const char* pattern) {
+    const parallelisation_type modes[] = {MULT_SEQUENTIAL, MULT_OMP};
+    char detail[128];
+    for (int v = 0; v < CSR_VARIANT_COUNT; v++) {
+        TypedMatrix* typed_a = typed_from_compressed(A, (CsrVariant)v);
+        TypedMatrix* typed_b = typed_from_compressed(B, (CsrVariant)v);
+        for (size_t m = 0; typed_a && typed_b && m < sizeof(modes) / sizeof(modes[0]); m++) {
+            snprintf(detail, sizeof(detail), "%s, %s, mode %d", pattern, get_csr_variant_name((CsrVariant)v), (int)modes[m]);
+            TypedMatrix* typed_product = typed_multiply(typed_a, typed_b, modes[m]);
+            CompressedMatrix* product = typed_product ? typed_to_compressed(typed_product) : NULL;
+            if (!same_product(product, expected)) {
+                fail("typed product", detail);
+            }
+            free_compressed_matrix(product);
+            free_typed_matrix(typed_product);
+        }
+        free_typed_matrix(typed_a);
+        free_typed_matrix(typed_b);
+    }
+}
+
+// Function to round-trip A through both file formats and check the out-of-core product, under dir
+static void verify_files(const CompressedMatrix* A, const CompressedMatrix* B, const DenseMatrix* expected,
+                         const char* pattern, const char* dir) {
+    char a_path[512], b_path[512], out_path[512], market_path[512];
+    snprintf(a_path, sizeof(a_path), "%s/matrix_a.csr", dir);
+    snprintf(b_path, sizeof(b_path), "%s/matrix_b.csr", dir);
+    snprintf(out_path, sizeof(out_path), "%s/product.csr", dir);
+    snprintf(market_path, sizeof(market_path), "%s/matrix_a.mtx", dir);
+
+    if (write_compressed_matrix_binary(A, a_path) != 0 || write_compressed_matrix_binary(B, b_path) != 0) {
+        fail("binary write", pattern);
+    } else {
+        CompressedMatrix* mapped = map_compressed_matrix(a_path);
+        if (!same_compressed(mapped, A)) {
+            fail("binary round trip", pattern);
+        }
+        free_compressed_matrix(mapped);
+
+        const parallelisation_type modes[] = {MULT_SEQUENTIAL, MULT_OMP};
+        for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+            CompressedMatrix* product = NULL;
+            if (multiply_matrices_out_of_core(a_path, b_path, out_path, VERIFY_PANEL_BYTES, modes[m]) == 0) {
+                product = map_compressed_matrix(out_path);
+            }
+            if (!same_product(product, expected)) {
+                fail("out-of-core product", pattern);
+            }
+            free_compressed_matrix(product);
+        }
+    }
+
+    // Matrix Market files hold elements only, so values and positions must come back unchanged
+    CompressedMatrix* market = write_matrix_market(A, market_path) == 0 ? read_matrix_market(market_path) : NULL;
+    DenseMatrix* market_dense = market ? compressed_to_dense(market) : NULL;
+    DenseMatrix* dense_a = compressed_to_dense(A);
+    if (!same_dense(market_dense, dense_a)) {
+        fail("Matrix Market round trip", pattern);
+    }
+    free_compressed_matrix(market);
+    free_dense_matrix(market_dense);
+    free_dense_matrix(dense_a);
+
+    unlink(a_path);
+    unlink(b_path);
+    unlink(out_path);
+    unlink(market_path);
+}
+
+int main(int argc, char** argv) {
+
+    // OpenMP threads never call MPI, so funneled support is enough for hybrid runs
+    int provided;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    char dir[] = "/tmp/verify_multiplication_XXXXXX";
+    if (rank == 0 && !mkdtemp(dir)) {
+        fail("temporary directory", dir);
+    }
+
+    // Generation depends only on the seed, so every rank builds the same inputs
+    for (int p = 0; p < PATTERN_COUNT; p++) {
+        const SparsityPattern pattern = (SparsityPattern)p;
+        CompressedMatrix* A = generatePatternMatrix(VERIFY_ROWS, VERIFY_INNER, VERIFY_DENSITY_A, pattern, VERIFY_SEED + p);
+        CompressedMatrix* B = generatePatternMatrix(VERIFY_INNER, VERIFY_COLS, VERIFY_DENSITY_B, pattern, VERIFY_SEED + PATTERN_COUNT + p);
+        if (!A || !B) {
+            fail("generation", getPatternName(pattern));
+            free_compressed_matrix(A);
+            free_compressed_matrix(B);
+            continue;
+        }
+        DenseMatrix* expected = reference_product(A, B);
+
+        verify_products(A, B, expected, getPatternName(pattern), rank);
+        verify_vectors(A, getPatternName(pattern), rank);
+        if (rank == 0) {
+            verify_typed(A, B, expected, getPatternName(pattern));
+            verify_files(A, B, expected, getPatternName(pattern), dir);
+        }
+
+        free_dense_matrix(expected);
+        free_compressed_matrix(A);
+        free_compressed_matrix(B);
+    }
+    if (rank == 0) {
+        rmdir(dir);
+    }
+
+    int total = 0;
+    MPI_Allreduce(&failures, &total, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+    if (rank == 0) {
+        printf("%s: %d failed check(s)\n", total == 0 ? "PASSED" : "FAILED", total);
+    }
+    MPI_Finalize();
+    return total == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}